@@ -0,0 +1,214 @@
+/*******************************************************************************
+ * Copyright (C) 2022-2023 Olivier Delaneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#ifndef _VBYTE_CODEC_H
+#define _VBYTE_CODEC_H
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+/*****************************************************************************/
+/*****************************************************************************/
+/******						VBYTE_CODEC									******/
+/*****************************************************************************/
+/*****************************************************************************/
+
+// Delta + stream-vbyte coding of sorted sparse records (Lemire et al., 2017).
+// Record layout: [uint32 n][ceil(n/4) control bytes][data bytes]
+// Each control byte holds the (length-1) of four consecutive values on 2 bits,
+// lowest bits first. Values are stored little-endian on 1 to 4 bytes.
+// Haplotype records store the gaps between consecutive carrier indices.
+// Genotype records store ((idx gap) << 5 | flags), flags being the 5 low bits
+// of the packed sparse_genotype word.
+
+namespace vbyte {
+
+	struct shuffle_table {
+		uint8_t shuf[256][16];
+		uint8_t len[256];
+
+		shuffle_table() {
+			for (uint32_t c = 0 ; c < 256 ; c ++) {
+				uint8_t off = 0;
+				for (uint32_t j = 0 ; j < 4 ; j ++) {
+					uint8_t l = ((c >> (2*j)) & 3) + 1;
+					for (uint32_t b = 0 ; b < 4 ; b ++) shuf[c][4*j+b] = (b < l) ? (off + b) : 0xFF;
+					off += l;
+				}
+				len[c] = off;
+			}
+		}
+	};
+
+	inline const shuffle_table & table() {
+		static const shuffle_table t;
+		return t;
+	}
+
+	//Maximum number of bytes needed to encode n values
+	inline uint32_t bound(uint32_t n) {
+		return sizeof(uint32_t) + (n + 3) / 4 + n * sizeof(uint32_t);
+	}
+
+	//Number of values in an encoded record
+	inline uint32_t count(const char * in) {
+		uint32_t n;
+		memcpy(&n, in, sizeof(uint32_t));
+		return n;
+	}
+
+	inline uint32_t length(uint32_t v) {
+		return (v < (1U << 8)) ? 1 : ((v < (1U << 16)) ? 2 : ((v < (1U << 24)) ? 3 : 4));
+	}
+
+	//Encode a single value, returns the 2-bit code
+	inline uint32_t put(uint32_t v, uint8_t *& data) {
+		uint32_t l = length(v);
+		memcpy(data, &v, l);
+		data += l;
+		return l - 1;
+	}
+
+	//Exact number of bytes needed to encode the haplotype indices in[0..n)
+	inline uint32_t sizeHaplotypes(const int32_t * in, uint32_t n) {
+		uint32_t nbytes = sizeof(uint32_t) + (n + 3) / 4;
+		for (uint32_t i = 0, prev = 0 ; i < n ; i ++) {
+			nbytes += length(in[i] - prev);
+			prev = in[i];
+		}
+		return nbytes;
+	}
+
+	//Exact number of bytes needed to encode the packed sparse genotypes in[0..n)
+	inline uint32_t sizeGenotypes(const int32_t * in, uint32_t n) {
+		uint32_t nbytes = sizeof(uint32_t) + (n + 3) / 4;
+		for (uint32_t i = 0, prev = 0 ; i < n ; i ++) {
+			uint32_t idx = ((uint32_t)in[i]) >> 5;
+			nbytes += length(((idx - prev) << 5) | (in[i] & 31U));
+			prev = idx;
+		}
+		return nbytes;
+	}
+
+	//Encode sorted haplotype indices, returns the number of bytes written
+	inline uint32_t encodeHaplotypes(const int32_t * in, uint32_t n, char * out) {
+		memcpy(out, &n, sizeof(uint32_t));
+		uint8_t * ctrl = (uint8_t *)out + sizeof(uint32_t);
+		uint8_t * data = ctrl + (n + 3) / 4;
+		memset(ctrl, 0, (n + 3) / 4);
+		for (uint32_t i = 0, prev = 0 ; i < n ; i ++) {
+			ctrl[i/4] |= put(in[i] - prev, data) << (2 * (i % 4));
+			prev = in[i];
+		}
+		return data - (uint8_t *)out;
+	}
+
+	//Encode packed sparse genotypes sorted by index, returns the number of bytes written
+	inline uint32_t encodeGenotypes(const int32_t * in, uint32_t n, char * out) {
+		memcpy(out, &n, sizeof(uint32_t));
+		uint8_t * ctrl = (uint8_t *)out + sizeof(uint32_t);
+		uint8_t * data = ctrl + (n + 3) / 4;
+		memset(ctrl, 0, (n + 3) / 4);
+		for (uint32_t i = 0, prev = 0 ; i < n ; i ++) {
+			uint32_t idx = ((uint32_t)in[i]) >> 5;
+			ctrl[i/4] |= put(((idx - prev) << 5) | (in[i] & 31U), data) << (2 * (i % 4));
+			prev = idx;
+		}
+		return data - (uint8_t *)out;
+	}
+
+	//Decode the raw values (no delta) of an encoded record of nbytes, returns the number of values
+	inline uint32_t decodeRaw(const char * in, uint32_t nbytes, uint32_t * out) {
+		uint32_t n = count(in);
+		const uint8_t * ctrl = (const uint8_t *)in + sizeof(uint32_t);
+		const uint8_t * data = ctrl + (n + 3) / 4;
+		uint32_t i = 0;
+#if defined(__SSSE3__)
+		const uint8_t * end = (const uint8_t *)in + nbytes;
+		const shuffle_table & T = table();
+		for ( ; i + 4 <= n && data + 16 <= end ; i += 4) {
+			uint8_t c = ctrl[i/4];
+			__m128i v = _mm_loadu_si128((const __m128i *)data);
+			v = _mm_shuffle_epi8(v, _mm_loadu_si128((const __m128i *)T.shuf[c]));
+			_mm_storeu_si128((__m128i *)(out + i), v);
+			data += T.len[c];
+		}
+#endif
+		for ( ; i < n ; i ++) {
+			uint32_t l = ((ctrl[i/4] >> (2 * (i % 4))) & 3) + 1, v = 0;
+			memcpy(&v, data, l);
+			data += l;
+			out[i] = v;
+		}
+		return n;
+	}
+
+	//Decode haplotype indices, returns the number of indices
+	inline uint32_t decodeHaplotypes(const char * in, uint32_t nbytes, int32_t * out) {
+		uint32_t n = decodeRaw(in, nbytes, (uint32_t *)out);
+		uint32_t i = 0;
+#if defined(__SSSE3__)
+		__m128i prev = _mm_setzero_si128();
+		for ( ; i + 4 <= n ; i += 4) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(out + i));
+			v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+			v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+			v = _mm_add_epi32(v, prev);
+			_mm_storeu_si128((__m128i *)(out + i), v);
+			prev = _mm_shuffle_epi32(v, 0xFF);
+		}
+#endif
+		for ( ; i < n ; i ++) out[i] += (i ? out[i-1] : 0);
+		return n;
+	}
+
+	//Decode packed sparse genotypes, returns the number of genotypes
+	inline uint32_t decodeGenotypes(const char * in, uint32_t nbytes, int32_t * out) {
+		uint32_t n = decodeRaw(in, nbytes, (uint32_t *)out);
+		uint32_t i = 0, idx = 0;
+#if defined(__SSSE3__)
+		__m128i prev = _mm_setzero_si128();
+		const __m128i flags = _mm_set1_epi32(31);
+		for ( ; i + 4 <= n ; i += 4) {
+			__m128i w = _mm_loadu_si128((const __m128i *)(out + i));
+			__m128i v = _mm_srli_epi32(w, 5);
+			v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+			v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+			v = _mm_add_epi32(v, prev);
+			prev = _mm_shuffle_epi32(v, 0xFF);
+			_mm_storeu_si128((__m128i *)(out + i), _mm_or_si128(_mm_slli_epi32(v, 5), _mm_and_si128(w, flags)));
+		}
+		if (i) idx = ((uint32_t)out[i-1]) >> 5;
+#endif
+		for ( ; i < n ; i ++) {
+			idx += ((uint32_t)out[i]) >> 5;
+			out[i] = (idx << 5) | (out[i] & 31U);
+		}
+		return n;
+	}
+}
+
+#endif
@@ -0,0 +1,114 @@
+/*******************************************************************************
+ * Copyright (C) 2022-2023 Olivier Delaneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#ifndef _VCF_TEXT_H
+#define _VCF_TEXT_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*****************************************************************************/
+/*****************************************************************************/
+/******						VCF_TEXT									******/
+/*****************************************************************************/
+/*****************************************************************************/
+
+// Minimal parsing of VCF text lines: columns are located with a vectorised
+// scan for separators, and only the GT sub-field of sample columns is read.
+// Genotypes use the BCF integer encoding [(allele+1)<<1 | phased, 0 for missing].
+
+namespace vcf_text {
+
+	//First occurrence of c in [p, end), or end
+	inline const char * find(const char * p, const char * end, char c) {
+#if defined(__AVX2__)
+		const __m256i C = _mm256_set1_epi8(c);
+		for ( ; p + 32 <= end ; p += 32) {
+			uint32_t m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), C));
+			if (m) return p + __builtin_ctz(m);
+		}
+#elif defined(__SSE2__)
+		const __m128i C = _mm_set1_epi8(c);
+		for ( ; p + 16 <= end ; p += 16) {
+			uint32_t m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), C));
+			if (m) return p + __builtin_ctz(m);
+		}
+#endif
+		for ( ; p < end && *p != c ; p ++);
+		return p;
+	}
+
+	//Start of the column following the one at p, or end
+	inline const char * column(const char * p, const char * end) {
+		p = find(p, end, '\t');
+		return (p < end) ? (p + 1) : end;
+	}
+
+	//Integer values of key in the INFO column [info, end), returns their number or -1 when absent or missing
+	inline int32_t infoInt(const char * info, const char * end, const char * key, std::vector < int32_t > & out) {
+		uint32_t l = strlen(key);
+		out.clear();
+		for (const char * p = info ; p < end ; p = find(p, end, ';') + 1) {
+			if (p + l >= end || strncmp(p, key, l) || p[l] != '=') continue;
+			for (p += l + 1 ; p < end ; p ++) {
+				char * q;
+				long v = strtol(p, &q, 10);
+				if (q == p) return -1;
+				out.push_back(v);
+				p = q;
+				if (p >= end || *p != ',') break;
+			}
+			return out.size();
+		}
+		return -1;
+	}
+
+	//Parse the GT sub-field at p, storing at most max alleles in gt; p is left on the character ending the sub-field
+	//Returns the number of alleles
+	inline int32_t parseGenotype(const char *& p, const char * end, int32_t * gt, int32_t max) {
+		int32_t n = 0, phased = 0;
+		while (p < end) {
+			int32_t v;
+			if (*p == '.') { v = 0; p ++; }
+			else if (*p >= '0' && *p <= '9') {
+				uint32_t a = 0;
+				for ( ; p < end && *p >= '0' && *p <= '9' ; p ++) a = 10 * a + (*p - '0');
+				v = (a + 1) << 1;
+			} else break;
+			if (n < max) gt[n] = v | phased;
+			n ++;
+			if (p < end && (*p == '/' || *p == '|')) { phased = (*p == '|'); p ++; }
+			else break;
+		}
+		return n;
+	}
+}
+
+#endif
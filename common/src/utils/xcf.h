@@ -33,6 +33,8 @@
 #include <map>
 
 #include "otools.h"
+#include "vbyte_codec.h"
+#include "xcf_stream.h"
 
 //INCLUDE HTS LIBRARY
 extern "C" {
@@ -49,9 +51,24 @@ extern "C" {
 #define RECORD_SPARSE_HAPLOTYPE	3		//Record in sparse haplotype format (uint32_t for indexing)
 #define RECORD_BINARY_GENOTYPE	4		//Record in binary genotype format (2bits per genotype; 10 for missing)
 #define RECORD_BINARY_HAPLOTYPE	5		//Record in binary haplotype format (1bit per allele; no missing allowed)
-#define RECORD_NUMBER_TYPES		6
+#define RECORD_VBYTE_GENOTYPE	6		//Record in sparse genotype format, delta + stream-vbyte coded (see vbyte_codec.h)
+#define RECORD_VBYTE_HAPLOTYPE	7		//Record in sparse haplotype format, delta + stream-vbyte coded (see vbyte_codec.h)
+#define RECORD_SPARSE_MULTIALLELIC	8	//Record in sparse multiallelic format, one list of haplotypes per allele (see sparse_multiallelic.h)
+#define RECORD_DENSE_DOSAGE8	9		//Record in dense dosage format (8bits per sample; see dosage_record.h)
+#define RECORD_DENSE_DOSAGE16	10		//Record in dense dosage format (16bits per sample; see dosage_record.h)
+#define RECORD_SPARSE_DOSAGE	11		//Record in sparse dosage format (non zero dosages only; see dosage_record.h)
+#define RECORD_XOR_HAPLOTYPE	12		//Record in binary haplotype format, XOR coded against the previous dense haplotype record (see xor_header)
+#define RECORD_BINARY_HAPLOID	13		//Record in binary format over the ploidy of each sample (1bit per allele; 1 or 2 alleles per sample; see xcf_writer::encodeHaploid)
+#define RECORD_SPARSE_HAPLOID	14		//Record in sparse format over the ploidy of each sample (uint32_t for indexing alleles; see xcf_writer::encodeHaploid)
+#define RECORD_MISSING_HAPLOTYPE	15	//Record in binary haplotype format, followed by the sparse list of missing haplotypes (uint32_t count, then indices)
+#define RECORD_SHARDED_GENOTYPE	16		//Record in binary genotype format, split in groups of samples stored in separate files (see XCF_SHARDS)
+#define RECORD_SHARDED_HAPLOTYPE	17	//Record in binary haplotype format, split in groups of samples stored in separate files (see XCF_SHARDS)
+#define RECORD_NUMBER_TYPES		18
 
 #define MOD30BITS			0x40000000
+#define BIN_ALIGNMENT		64					//Boundary of records in aligned binary files
+#define BIN_WINDOW_MIN		(1U<<16)			//Read-ahead on binary files after a jump [region mode]
+#define BIN_WINDOW_MAX		(1U<<22)			//Read-ahead on binary files along a run of records [region mode]
 
 /*****************************************************************************/
 /*****************************************************************************/
@@ -98,6 +115,41 @@ namespace helper_tools
 		return filename;
 	}
 
+	//Binary file holding group g of the samples of a sharded XCF file
+	inline std::string get_shard_name(std::string fname, uint32_t g) {
+		return get_name_from_vcf(fname) + ".s" + std::to_string(g) + ".bin";
+	}
+
+	//Copy n bytes between two files at given locations; in the kernel with copy_file_range when available
+	inline void copyRange(int fd_in, uint64_t off_in, int fd_out, uint64_t off_out, uint64_t n) {
+#if defined(__linux__)
+		while (n) {
+			loff_t i = off_in, o = off_out;
+			ssize_t c = copy_file_range(fd_in, &i, fd_out, &o, n, 0);
+			if (c < 0 && errno == EINTR) continue;
+			if (c <= 0) break;		//Not supported across these files; plain copy of the rest
+			off_in += c;
+			off_out += c;
+			n -= c;
+		}
+#endif
+		std::vector < char > buffer (std::min(n, (uint64_t)XCF_STREAM_CHUNK));
+		while (n) {
+			ssize_t r = pread(fd_in, buffer.data(), std::min(n, (uint64_t)buffer.size()), off_in);
+			if (r < 0 && errno == EINTR) continue;
+			if (r <= 0) vrb.error("Failing to read binary data to copy");
+			for (ssize_t w = 0 ; w < r ; ) {
+				ssize_t k = pwrite(fd_out, buffer.data() + w, r - w, off_out + w);
+				if (k < 0 && errno == EINTR) continue;
+				if (k < 0) vrb.error("Failing to write copied binary data");
+				w += k;
+			}
+			off_in += r;
+			off_out += r;
+			n -= r;
+		}
+	}
+
 	inline int split(const std::string & str, std::vector < std::string > & tokens, std::string sep = " 	", unsigned int n_max_tokens = 1000000) {
 		tokens.clear();
 		if (str == ""){
@@ -119,6 +171,75 @@ namespace helper_tools
 		vrb.error(s);
 	}
 
+	//Read a file of regions [BED, 0-based; or CHR POS / CHR BEG END, 1-based] as a list of regions for --region
+	//Overlapping and adjacent regions are merged; regions are sorted within contigs, contigs keep their order of first appearance
+	inline std::string readRegions(const std::string & fname) {
+		std::string ext = fname.substr(0, fname.size() - ((findExtension(fname) == "gz") ? 3 : 0));
+		bool bed = (findExtension(ext) == "bed");
+		input_file fd (fname);
+		if (fd.fail()) error("Cannot open regions file [" + fname + "]");
+		std::vector < std::string > contigs;
+		std::map < std::string, std::vector < std::pair < uint64_t, uint64_t > > > intervals;
+		std::string buffer;
+		std::vector < std::string > tokens;
+		while (getline(fd, buffer)) {
+			if (buffer.empty() || buffer[0] == '#' || buffer.compare(0, 5, "track") == 0 || buffer.compare(0, 7, "browser") == 0) continue;
+			split(buffer, tokens);
+			if (tokens.size() < 2) error("Regions file [" + fname + "] needs at least 2 columns [" + buffer + "]");
+			uint64_t beg, end;
+			try {
+				beg = std::stoull(tokens[1]) + bed;
+				end = (tokens.size() > 2) ? std::stoull(tokens[2]) : beg;
+			} catch (const std::exception &) {
+				error("Regions file [" + fname + "] has a malformed position [" + buffer + "]");
+			}
+			if (bed && end + 1 == beg) continue;		//Zero-length BED interval
+			if (end < beg) error("Region ends before its start in [" + fname + "] [" + buffer + "]");
+			if (!intervals.count(tokens[0])) contigs.push_back(tokens[0]);
+			intervals[tokens[0]].push_back(std::make_pair(beg, end));
+		}
+		std::string region;
+		for (uint32_t c = 0 ; c < contigs.size() ; c ++) {
+			std::vector < std::pair < uint64_t, uint64_t > > & I = intervals[contigs[c]];
+			std::sort(I.begin(), I.end());
+			for (uint32_t i = 0, j = 0 ; i < I.size() ; i = j) {
+				uint64_t end = I[i].second;
+				for (j = i + 1 ; j < I.size() && I[j].first <= end + 1 ; j ++) end = std::max(end, I[j].second);
+				region += (region.empty() ? "" : ",") + contigs[c] + ":" + std::to_string(I[i].first) + "-" + std::to_string(end);
+			}
+		}
+		if (region.empty()) error("No region in [" + fname + "]");
+		return region;
+	}
+
+	//Short description of a region or of a list of regions, for the log
+	inline std::string regionName(const std::string & region) {
+		uint32_t n = std::count(region.begin(), region.end(), ',') + 1;
+		return (n > 1) ? (std::to_string(n) + " regions") : region;
+	}
+
+	//Regions of a comma separated list grouped by contig, in the order of the contigs in hdr [contigs absent from hdr go last]
+	inline std::string sortRegions(const std::string & region, const bcf_hdr_t * hdr) {
+		std::vector < std::string > items, contigs;
+		std::map < std::string, std::vector < std::string > > by_contig;
+		split(region, items, ",");
+		for (uint32_t r = 0 ; r < items.size() ; r ++) {
+			size_t colon = items[r].find_last_of(':');
+			bool range = (colon != std::string::npos && colon + 1 < items[r].size() && items[r].find_first_not_of("0123456789-", colon + 1) == std::string::npos);
+			std::string chr = range ? items[r].substr(0, colon) : items[r];
+			if (!by_contig.count(chr)) contigs.push_back(chr);
+			by_contig[chr].push_back(items[r]);
+		}
+		std::stable_sort(contigs.begin(), contigs.end(), [hdr](const std::string & a, const std::string & b) {
+			uint32_t ia = bcf_hdr_name2id(hdr, a.c_str()), ib = bcf_hdr_name2id(hdr, b.c_str());
+			return ia < ib;
+		});
+		std::string sorted;
+		for (uint32_t c = 0 ; c < contigs.size() ; c ++)
+			for (uint32_t r = 0 ; r < by_contig[contigs[c]].size() ; r ++) sorted += (sorted.empty() ? "" : ",") + by_contig[contigs[c]][r];
+		return sorted;
+	}
+
 	inline void warning(std::string s) {
 		vrb.warning(s);
 	}
@@ -131,8 +252,40 @@ namespace helper_tools
 	    return ss.str();
 	}
 
+	inline std::string recordName(uint32_t type) {
+		switch (type) {
+		case RECORD_BCFVCF_GENOTYPE:	return "BCF/VCF genotype";
+		case RECORD_SPARSE_GENOTYPE:	return "Sparse genotype";
+		case RECORD_SPARSE_HAPLOTYPE:	return "Sparse haplotype";
+		case RECORD_BINARY_GENOTYPE:	return "Binary genotype";
+		case RECORD_BINARY_HAPLOTYPE:	return "Binary haplotype";
+		case RECORD_VBYTE_GENOTYPE:		return "VByte genotype";
+		case RECORD_VBYTE_HAPLOTYPE:	return "VByte haplotype";
+		case RECORD_SPARSE_MULTIALLELIC:	return "Sparse multiallelic";
+		case RECORD_DENSE_DOSAGE8:		return "Dense dosage 8bits";
+		case RECORD_DENSE_DOSAGE16:		return "Dense dosage 16bits";
+		case RECORD_SPARSE_DOSAGE:		return "Sparse dosage";
+		case RECORD_XOR_HAPLOTYPE:		return "XOR haplotype";
+		case RECORD_BINARY_HAPLOID:		return "Binary haploid";
+		case RECORD_SPARSE_HAPLOID:		return "Sparse haploid";
+		case RECORD_MISSING_HAPLOTYPE:	return "Binary haplotype w/ missing";
+		case RECORD_SHARDED_GENOTYPE:	return "Sharded genotype";
+		case RECORD_SHARDED_HAPLOTYPE:	return "Sharded haplotype";
+		default:						return "Void";
+		}
+	}
+
 }
 
+//Header of XOR coded haplotype records, followed by the delta/vbyte coded indices of the bits flipped since the reference record.
+//The reference is the previous dense haplotype record; chains of references end on a keyframe stored as RECORD_BINARY_HAPLOTYPE.
+//Locations are relative, so that records remain valid once binary files are concatenated.
+struct xor_header {
+	uint64_t back;								//Distance in bytes back to the start of the reference record
+	uint32_t ref_type;							//Type of the reference record
+	uint32_t ref_size;							//Size in bytes of the reference record
+};
+
 /*****************************************************************************/
 /*****************************************************************************/
 /******						XCF_READER									******/
@@ -144,19 +297,24 @@ public:
 	//HTS part
 	uint32_t sync_number;
 	bcf_srs_t * sync_reader;
+	std::string sync_region;						//Regions set along the first file [empty once set]
 	std::vector < bcf1_t * > sync_lines;
 	std::vector < int32_t > sync_types;			//Type of data: [DATA_EMPTY, FILE_BCF, FILE_BINARY]
 	std::vector < bool > sync_flags;			//Has record?
 
 	//Variant information
-	bool multi;
+	bool multi;									//Accept multiallelic records? [ALTs comma separated in alt]
 	std::string chr;
 	uint32_t pos;
 	std::string ref;
 	std::string alt;
 	std::string rsid;
+	uint32_t n_allele;
 	std::vector < uint32_t > AC;
 	std::vector < uint32_t > AN;
+	std::vector < uint32_t > ACalt;				//AC of each ALT allele, summed across files
+	std::vector < uint32_t > ACcount;			//AC of each ALT allele counted from FORMAT/GT
+	bool counted;								//AC/AN of the current record counted from FORMAT/GT?
 	std::vector < int32_t > ploidy;
 
 	//INFO field
@@ -171,6 +329,7 @@ public:
 	std::vector < std::vector < std::string > > ind_fathers;
 	std::vector < std::vector < std::string > > ind_mothers;
 	std::vector < std::vector < std::string > > ind_pops;
+	std::vector < std::vector < uint8_t > > ind_ploidy;		//Ploidy of each sample in haploid records [5th column of the PED file]
 
 	//Binary files [files x types]
 	std::vector < std::ifstream > bin_fds;		//File Descriptors
@@ -178,10 +337,27 @@ public:
 	std::vector < uint64_t > bin_seek;			//Location of Binary record				//Integer 2 and 3 in INFO/SEEK field
 	std::vector < uint32_t > bin_size;			//Amount of Binary records in bytes		//Integer 4 in INFO/SEEK field
 	std::vector < uint64_t > bin_curr;			//Location of Binary record				//Integer 2 and 3 in INFO/SEEK field
-
+	std::vector < std::vector < char > > bin_window;	//Read-ahead of binary data, only when reading regions
+	std::vector < uint64_t > bin_wseek;			//Location of the read-ahead window
+	std::vector < uint32_t > bin_wnext;			//Size of the next read-ahead, doubling while records are read in a row
+	std::vector < char > bin_buffer;			//Scratch buffer for coded records
+	std::vector < int32_t > query_buffer;		//Scratch buffer for the records queried by sample [see readSampleGenotypes]
+	std::vector < std::vector < char > > xor_state;	//Bits of the last dense haplotype record decoded [only once XOR coded records are met]
+	std::vector < uint64_t > xor_seek;			//Location of the last dense haplotype record decoded
+	std::vector < bool > xor_coded;				//XOR coded records met in the file
+	std::vector < char > xor_record;			//Scratch buffer for XOR coded records
+	std::vector < int32_t > xor_flips;			//Scratch buffer for the indices of the bits flipped
+	std::vector < std::pair < uint64_t, uint32_t > > xor_chain;	//Location and size of the XOR coded records to decode back to a known reference
+
+	//Sharded binary files [files x groups of samples]
+	std::vector < uint32_t > shard_size;		//Number of samples per group [0 for no sharding]	//##XCF_SHARDS header line
+	std::vector < std::vector < std::ifstream > > shard_fds;	//File Descriptors, one per group
+
+	//Streamed XCF files and stdin, split or passed through a pipe read by HTSlib [NULL for files on disk; see xcf_stream.h]
+	std::vector < xcf_stream_reader * > stream_fds;
 
 	//CONSTRUCTOR
-	xcf_reader(std::string region, uint32_t nthreads) : multi(false),pos(0) {
+	xcf_reader(std::string region, uint32_t nthreads) : multi(false),pos(0),n_allele(0),counted(false) {
 		if (region.empty())
 		{
 			sync_number = 0;
@@ -200,15 +376,14 @@ public:
 		if (!region.empty())
 		{
 			sync_reader->require_index = 1;
-			if (bcf_sr_set_regions(sync_reader, region.c_str(), 0) == -1) helper_tools::error("Impossible to jump to region [" + region + "]");
-			if (bcf_sr_set_targets(sync_reader, region.c_str(), 0, 0) == -1) helper_tools::error("Impossible to constrain to region [" + region + "]");
+			sync_region = region;	//Set along the first file, once its contig order is known
 		}
 		vAC = vAN = vSK = NULL;
 		nAC = nAN = nSK = 0;
 	}
 
 	//CONSTRUCTOR
-	xcf_reader(uint32_t nthreads) : multi(false),pos(0) {
+	xcf_reader(uint32_t nthreads) : multi(false),pos(0),n_allele(0),counted(false) {
 		sync_number = 0;
 		sync_reader = bcf_sr_init();
 		sync_reader->collapse = COLLAPSE_NONE;
@@ -229,27 +404,25 @@ public:
 		if ( !isatty(fileno((FILE *)stdin)) ) fname = "-";
 		else helper_tools::error("Error trying to set stdin as input");
 
-		std::string buffer;
-		std::vector < std::string > tokens;
+		//Stdin was read when checking for a stream; pass it through a pipe, bytes already read first
+		xcf_stream_reader * forward = NULL;
+		std::string hname = fname;
+		if (!xcf_stream_input::stdin_prefix().empty()) {
+			forward = new xcf_stream_reader();
+			hname = forward->openForward(fname);
+		}
 
 		//Open BCF file and add it in the synchronized reader
-		if (!(bcf_sr_add_reader (sync_reader, fname.c_str()))) {
+		setRegions("");
+		if (!(bcf_sr_add_reader (sync_reader, hname.c_str()))) {
 			if (sync_reader->errnum) {
 				helper_tools::error("Opening stdin: unknown error. " + std::to_string(sync_reader->errnum));
 			}
 		}
+		if (forward) forward->detach();
 		//Allocation for Binary record information
-		sync_lines.push_back(NULL);
-		sync_types.push_back(FILE_VOID);
-		sync_flags.push_back(false);
-		bin_fds.push_back(std::ifstream());
-		bin_type.push_back(0);
-		bin_seek.push_back(0);
-		bin_size.push_back(0);
-		bin_curr.push_back(0);
-		AC.push_back(0);
-		AN.push_back(0);
-		ploidy.push_back(-1);
+		allocateFile();
+		stream_fds[sync_number] = forward;
 
 		//Check header for associated binary file
 		int32_t flagSEEK = bcf_hdr_idinfo_exists(sync_reader->readers[sync_number].header, BCF_HL_INFO, bcf_hdr_id2int(sync_reader->readers[sync_number].header, BCF_DT_ID, "SEEK"));
@@ -269,24 +442,10 @@ public:
 			std::string ped_fname = helper_tools::get_name_from_vcf(fname) + ".fam";
 			std::ifstream fdp(ped_fname);
 			if (!fdp.is_open()) helper_tools::error("Cannot open pedigree file [" + ped_fname + "] for reading");
-			ind_names.push_back(std::vector < std::string >());
-			ind_fathers.push_back(std::vector < std::string >());
-			ind_mothers.push_back(std::vector < std::string >());
-			ind_pops.push_back(std::vector < std::string >());
-			while (getline(fdp, buffer)) {
-				helper_tools::split(buffer, tokens);
-				ind_names[sync_number].push_back(tokens[0]);
-				if (tokens.size() >=3 )
-				{
-					ind_fathers[sync_number].push_back(tokens[1]); ind_mothers[sync_number].push_back(tokens[2]);
-					if (tokens.size() > 3) ind_pops[sync_number].push_back(tokens[3]);
-					else ind_pops[sync_number].push_back("NA");
-				}
-				else { ind_fathers[sync_number].push_back("NA"); ind_mothers[sync_number].push_back("NA"); ind_pops[sync_number].push_back("NA");}
-			}
-			ind_number.push_back(ind_names[sync_number].size());
+			readPedigree(fdp);
 			sync_types[sync_number] = FILE_BINARY;
 			fdp.close();
+			openShards(sync_number, fname);
 		}
 
 		/************************************************************************************/
@@ -300,6 +459,7 @@ public:
 			ind_fathers.push_back(std::vector < std::string >(ind_number[sync_number], "NA"));
 			ind_mothers.push_back(std::vector < std::string >(ind_number[sync_number], "NA"));
 			ind_pops.push_back(std::vector < std::string >(ind_number[sync_number], "NA"));
+			ind_ploidy.push_back(std::vector < uint8_t >(ind_number[sync_number], 2));
 			sync_types[sync_number] = FILE_BCF;
 		}
 
@@ -323,10 +483,11 @@ public:
 
 	//ADD A NEW FILE IN THE SYNCHRONIZED READER
 	int32_t addFile(std::string fname) {
-		std::string buffer;
-		std::vector < std::string > tokens;
+		if (fname == "-" || helper_tools::isStreamName(fname)) return addStream(fname);
+		if (sync_number > 0 && stream_fds[0]) helper_tools::error("Cannot use streams in combination with other files.");
 
 		//Open BCF file and add it in the synchronized reader
+		setRegions(fname);
 		if (!(bcf_sr_add_reader (sync_reader, fname.c_str()))) {
 			switch (sync_reader->errnum) {
 			case not_bgzf:			helper_tools::error("Opening [" + fname + "]: not compressed with bgzip"); break;
@@ -337,17 +498,7 @@ public:
 		}
 
 		//Allocation for Binary record information
-		sync_lines.push_back(NULL);
-		sync_types.push_back(FILE_VOID);
-		sync_flags.push_back(false);
-		bin_fds.push_back(std::ifstream());
-		bin_type.push_back(0);
-		bin_seek.push_back(0);
-		bin_size.push_back(0);
-		bin_curr.push_back(0);
-		AC.push_back(0);
-		AN.push_back(0);
-		ploidy.push_back(-1);
+		allocateFile();
 
 		//Check header for associated binary file
 		int32_t flagSEEK = bcf_hdr_idinfo_exists(sync_reader->readers[sync_number].header, BCF_HL_INFO, bcf_hdr_id2int(sync_reader->readers[sync_number].header, BCF_DT_ID, "SEEK"));
@@ -367,24 +518,10 @@ public:
 			std::string ped_fname = helper_tools::get_name_from_vcf(fname) + ".fam";
 			std::ifstream fdp(ped_fname);
 			if (!fdp.is_open()) helper_tools::error("Cannot open pedigree file [" + ped_fname + "] for reading");
-			ind_names.push_back(std::vector < std::string >());
-			ind_fathers.push_back(std::vector < std::string >());
-			ind_mothers.push_back(std::vector < std::string >());
-			ind_pops.push_back(std::vector < std::string >());
-			while (getline(fdp, buffer)) {
-				helper_tools::split(buffer, tokens);
-				ind_names[sync_number].push_back(tokens[0]);
-				if (tokens.size() >=3 )
-				{
-					ind_fathers[sync_number].push_back(tokens[1]); ind_mothers[sync_number].push_back(tokens[2]);
-					if (tokens.size() > 3) ind_pops[sync_number].push_back(tokens[3]);
-					else ind_pops[sync_number].push_back("NA");
-				}
-				else { ind_fathers[sync_number].push_back("NA"); ind_mothers[sync_number].push_back("NA"); ind_pops[sync_number].push_back("NA");}
-			}
-			ind_number.push_back(ind_names[sync_number].size());
+			readPedigree(fdp);
 			sync_types[sync_number] = FILE_BINARY;
 			fdp.close();
+			openShards(sync_number, fname);
 		}
 
 		/************************************************************************************/
@@ -398,6 +535,7 @@ public:
 			ind_fathers.push_back(std::vector < std::string >(ind_number[sync_number], "NA"));
 			ind_mothers.push_back(std::vector < std::string >(ind_number[sync_number], "NA"));
 			ind_pops.push_back(std::vector < std::string >(ind_number[sync_number], "NA"));
+			ind_ploidy.push_back(std::vector < uint8_t >(ind_number[sync_number], 2));
 			sync_types[sync_number] = FILE_BCF;
 		}
 
@@ -419,6 +557,98 @@ public:
 		return (sync_number-1);
 	}
 
+	//ADD A STREAMED XCF FILE [see xcf_stream.h]; sites are read by HTSlib through a pipe, binary data through bin_fds
+	int32_t addStream(std::string fname) {
+		if (sync_number > 0) helper_tools::error("Cannot use streams in combination with other files.");
+		if (sync_reader->require_index) helper_tools::error("Streams cannot be read by region [" + fname + "]");
+
+		//Open the pipe of sites and add it in the synchronized reader
+		xcf_stream_reader * stream = new xcf_stream_reader();
+		std::string pname = stream->open(fname);
+		setRegions("");
+		if (!(bcf_sr_add_reader (sync_reader, pname.c_str()))) helper_tools::error("Opening [" + fname + "]: unknown error. " + std::to_string(sync_reader->errnum));
+		stream->detach();
+
+		//Allocation for Binary record information
+		allocateFile();
+		stream_fds[sync_number] = stream;
+
+		//Check header for binary data and no sample data
+		bcf_hdr_t * hdr = sync_reader->readers[sync_number].header;
+		int32_t flagSEEK = bcf_hdr_idinfo_exists(hdr, BCF_HL_INFO, bcf_hdr_id2int(hdr, BCF_DT_ID, "SEEK"));
+		if (!flagSEEK || bcf_hdr_nsamples(hdr) != 0) helper_tools::error("Stream [" + fname + "] does not hold XCF data");
+
+		//Binary data is read from the stream as from a file
+		bin_fds[sync_number].std::ios::rdbuf(&stream->payload);
+		std::istringstream fdp(stream->fam);
+		readPedigree(fdp);
+		sync_types[sync_number] = FILE_BINARY;
+
+		//Increment number of readers
+		sync_number++;
+		return (sync_number-1);
+	}
+
+	//Allocation for Binary record information of a new file
+	void allocateFile() {
+		sync_lines.push_back(NULL);
+		sync_types.push_back(FILE_VOID);
+		sync_flags.push_back(false);
+		bin_fds.push_back(std::ifstream());
+		bin_type.push_back(0);
+		bin_seek.push_back(0);
+		bin_size.push_back(0);
+		bin_curr.push_back(0);
+		bin_window.push_back(std::vector < char > ());
+		bin_wseek.push_back(0);
+		bin_wnext.push_back(BIN_WINDOW_MIN);
+		xor_state.push_back(std::vector < char > ());
+		xor_seek.push_back(UINT64_MAX);
+		xor_coded.push_back(false);
+		shard_size.push_back(0);
+		shard_fds.push_back(std::vector < std::ifstream > ());
+		stream_fds.push_back(NULL);
+		AC.push_back(0);
+		AN.push_back(0);
+		ploidy.push_back(-1);
+	}
+
+	//Read the PED file of a new file
+	void readPedigree(std::istream & fdp) {
+		std::string buffer;
+		std::vector < std::string > tokens;
+		ind_names.push_back(std::vector < std::string >());
+		ind_fathers.push_back(std::vector < std::string >());
+		ind_mothers.push_back(std::vector < std::string >());
+		ind_pops.push_back(std::vector < std::string >());
+		ind_ploidy.push_back(std::vector < uint8_t >());
+		while (getline(fdp, buffer)) {
+			helper_tools::split(buffer, tokens);
+			ind_names[sync_number].push_back(tokens[0]);
+			if (tokens.size() >=3 )
+			{
+				ind_fathers[sync_number].push_back(tokens[1]); ind_mothers[sync_number].push_back(tokens[2]);
+				if (tokens.size() > 3) ind_pops[sync_number].push_back(tokens[3]);
+				else ind_pops[sync_number].push_back("NA");
+			}
+			else { ind_fathers[sync_number].push_back("NA"); ind_mothers[sync_number].push_back("NA"); ind_pops[sync_number].push_back("NA");}
+			ind_ploidy[sync_number].push_back((tokens.size() > 4 && tokens[4] == "1") ? 1 : 2);
+		}
+		ind_number.push_back(ind_names[sync_number].size());
+	}
+
+	//Ploidy sent along a stream ahead of its first haploid record
+	void updatePloidy(uint32_t file) {
+		std::string fam, buffer;
+		std::vector < std::string > tokens;
+		if (!stream_fds[file]->payload.pullPedigree(fam)) return;
+		std::istringstream fdp(fam);
+		for (uint32_t i = 0 ; i < ind_number[file] && getline(fdp, buffer) ; i ++) {
+			helper_tools::split(buffer, tokens);
+			ind_ploidy[file][i] = (tokens.size() > 4 && tokens[4] == "1") ? 1 : 2;
+		}
+	}
+
 	//ADD A NEW FILE IN THE SYNCHRONIZED READER
 	int32_t removeFile(uint32_t file) {
 		//update the sync reader
@@ -433,6 +663,15 @@ public:
 		bin_seek.erase(bin_seek.begin() + file);
 		bin_size.erase(bin_size.begin() + file);
 		bin_curr.erase(bin_curr.begin() + file);
+		bin_window.erase(bin_window.begin() + file);
+		bin_wseek.erase(bin_wseek.begin() + file);
+		bin_wnext.erase(bin_wnext.begin() + file);
+		xor_state.erase(xor_state.begin() + file);
+		xor_seek.erase(xor_seek.begin() + file);
+		xor_coded.erase(xor_coded.begin() + file);
+		shard_size.erase(shard_size.begin() + file);
+		shard_fds.erase(shard_fds.begin() + file);
+		stream_fds.erase(stream_fds.begin() + file);
 		AC.erase(AC.begin() + file);
 		AN.erase(AN.begin() + file);
 		ploidy.erase(ploidy.begin() + file);
@@ -440,6 +679,7 @@ public:
 		ind_fathers.erase(ind_fathers.begin() + file);
 		ind_mothers.erase(ind_mothers.begin() + file);
 		ind_pops.erase(ind_pops.begin() + file);
+		ind_ploidy.erase(ind_ploidy.begin() + file);
 		ind_number.erase(ind_number.begin()+file);
 
 		//Decrement number of readers
@@ -470,6 +710,7 @@ public:
 	uint32_t getAC(uint32_t file) { return AC[file]; }
 	uint32_t getAN(uint32_t file) { return AN[file]; }
 	uint32_t getAC() { return std::accumulate(AC.begin(), AC.end(), 0); }
+	std::vector < uint32_t > & getACs() { return ACalt; }
 	uint32_t getAN() { return std::accumulate(AN.begin(), AN.end(), 0); }
 	float getAF(uint32_t file) const { return AC[file]*1.0f/AN[file]; }
 	float getAF() const { return std::accumulate(AC.begin(), AC.end(), 0)*1.0f/std::accumulate(AN.begin(), AN.end(), 0); }
@@ -487,6 +728,7 @@ public:
 		if (!ret) return 0;
 
 		//Initialize
+		counted = false;
 		std::fill(sync_flags.begin(), sync_flags.end(), false);
 		std::fill(AC.begin(), AC.end(), 0);
 		std::fill(AN.begin(), AN.end(), 0);
@@ -506,8 +748,8 @@ public:
 				//Get the record
 				sync_lines[r] = bcf_sr_get_line(sync_reader, r);
 
-				//If bi-allelic, proceed
-				if (sync_lines[r]->n_allele == 2) {
+				//If bi-allelic [or multiallelic when requested], proceed
+				if (sync_lines[r]->n_allele == 2 || (multi && sync_lines[r]->n_allele > 2)) {
 
 					//If first time we see the record across files
 					if (firstfile) {
@@ -518,15 +760,24 @@ public:
 						rsid = std::string(sync_lines[r]->d.id);
 						ref = std::string(sync_lines[r]->d.allele[0]);
 						alt = std::string(sync_lines[r]->d.allele[1]);
+						for (uint32_t a = 2 ; a < sync_lines[r]->n_allele ; a ++) alt += "," + std::string(sync_lines[r]->d.allele[a]);
+						n_allele = sync_lines[r]->n_allele;
+						ACalt.assign(n_allele - 1, 0);
 						firstfile = 0;
 					}
 
-					//Get AC/AN information
+					//Get AC/AN information [counted from FORMAT/GT in BCF files without INFO/AC or INFO/AN]
 					int32_t rAC = bcf_get_info_int32(sync_reader->readers[r].header, sync_lines[r], "AC", &vAC, &nAC);
 					int32_t rAN = bcf_get_info_int32(sync_reader->readers[r].header, sync_lines[r], "AN", &vAN, &nAN);
-					if (rAC != 1) helper_tools::error("AC field is needed in file");
-					if (rAN != 1) helper_tools::error("AN field is needed in file");
-					AC[r] = vAC[0]; AN[r] = vAN[0];
+					if ((rAC != (int32_t)n_allele - 1 || rAN != 1) && sync_types[r] == FILE_BCF) {
+						countAlleles(r);
+						counted = true;
+					} else {
+						if (rAC != (int32_t)n_allele - 1) helper_tools::error("AC field is needed in file");
+						if (rAN != 1) helper_tools::error("AN field is needed in file");
+						for (int32_t a = 0 ; a < rAC ; a ++) { AC[r] += vAC[a]; ACalt[a] += vAC[a]; }
+						AN[r] = vAN[0];
+					}
 
 					//Get SEEK information
 					if (sync_types[r] == FILE_BINARY) {
@@ -540,6 +791,7 @@ public:
 							bin_seek[r] += vSK[2];
 							bin_size[r] = vSK[3];
 						}
+						if (stream_fds[r] && (bin_type[r] == RECORD_BINARY_HAPLOID || bin_type[r] == RECORD_SPARSE_HAPLOID)) updatePloidy(r);
 					} else if (sync_types[r] == FILE_BCF) {
 						bin_type[r] = RECORD_BCFVCF_GENOTYPE;
 						bin_seek[r] = 0;
@@ -556,6 +808,32 @@ public:
 		return ret;
 	}
 
+	//COUNT ALT ALLELES [AC] AND CALLED ALLELES [AN] IN FORMAT/GT OF THE CURRENT RECORD OF A BCF FILE
+	void countAlleles(uint32_t file) {
+		bcf_fmt_t * fmt = bcf_get_fmt(sync_reader->readers[file].header, sync_lines[file], "GT");
+		if (!fmt) helper_tools::error("AC/AN fields or FORMAT/GT are needed in file");
+		int32_t n = fmt->n * ind_number[file];
+		ACcount.assign(n_allele - 1, 0);
+		switch (fmt->type) {
+		case BCF_BT_INT8: countAlleles((const int8_t *)fmt->p, n, bcf_int8_vector_end, ACcount, AN[file]); break;
+		case BCF_BT_INT16: countAlleles((const int16_t *)fmt->p, n, bcf_int16_vector_end, ACcount, AN[file]); break;
+		default: countAlleles((const int32_t *)fmt->p, n, bcf_int32_vector_end, ACcount, AN[file]);
+		}
+		for (uint32_t a = 0 ; a < n_allele - 1 ; a ++) { AC[file] += ACcount[a]; ACalt[a] += ACcount[a]; }
+	}
+
+	//Count ALT alleles [AC, one per ALT, to be zeroed] and called alleles [AN] in n genotypes encoded as in BCF files
+	template < typename T >
+	static void countAlleles(const T * gt, int32_t n, int32_t vector_end, std::vector < uint32_t > & AC, uint32_t & AN) {
+		for (int32_t i = 0 ; i < n ; i ++) {
+			if (gt[i] == vector_end || bcf_gt_is_missing(gt[i])) continue;
+			int32_t a = bcf_gt_allele(gt[i]);
+			if (a < 0) continue;
+			AN ++;
+			if (a > 0 && a <= (int32_t)AC.size()) AC[a-1] ++;
+		}
+	}
+
 	//CHECK IF FILE HAS A RECORD THERE
 	int32_t hasRecord(uint32_t file) {
 		return (sync_flags[file]);
@@ -603,23 +881,16 @@ public:
 			int32_t ndp = 0;//ind_number[file]*2;
 			int32_t rdp = bcf_get_genotypes(sync_reader->readers[file].header, sync_lines[file], buffer, &ndp);
 			int32_t max_ploidy = rdp/ind_number[file];
-			if (ploidy[file] < 0) ploidy[file] = rdp/ind_number[file];
 			assert ( rdp>=0 && max_ploidy>0); // GT present
-			assert(max_ploidy==ploidy[file]);
+			ploidy[file] = max_ploidy;			//Varies across records with haploid samples [e.g. chrX]
 			//assert(rdp == (ind_number[file]*2));
 			return ndp * sizeof(int32_t);
 		}
 
 		//Data is in binary file
 		else {
-			if (bin_curr[file] != bin_seek[file])
-			{
-				//Seek to right position
-				bin_fds[file].seekg(bin_seek[file], bin_fds[file].beg);
-			}
 			//Read data in Binary file
-			bin_fds[file].read(*buffer, bin_size[file]);
-			bin_curr[file] = bin_seek[file] + bin_size[file];
+			readBinary(file, bin_seek[file], bin_size[file], *buffer);
 			//Return amount of data in bytes read in file
 			return bin_size[file];
 		}
@@ -639,28 +910,440 @@ public:
 			int32_t ndp = 0;//ind_number[file]*2;
 			int32_t rdp = bcf_get_genotypes(sync_reader->readers[file].header, sync_lines[file], buffer, &ndp);
 			int32_t max_ploidy = rdp/ind_number[file];
-			if (ploidy[file] < 0) ploidy[file] = rdp/ind_number[file];
 			assert ( rdp>=0 && max_ploidy>0); // GT present
-			assert(max_ploidy==ploidy[file]);
+			ploidy[file] = max_ploidy;			//Varies across records with haploid samples [e.g. chrX]
 			//assert(rdp == (ind_number[file]*2));
 			return ndp * sizeof(int32_t);
 		}
 
 		//Data is in binary file
 		else {
-			if (bin_curr[file] != bin_seek[file])
-			{
-				//Seek to right position
-				bin_fds[file].seekg(bin_seek[file], bin_fds[file].beg);
-			}
 			//Read data in Binary file
-			bin_fds[file].read(buffer, bin_size[file]);
-			bin_curr[file] = bin_seek[file] + bin_size[file];
+			readBinary(file, bin_seek[file], bin_size[file], buffer);
 			//Return amount of data in bytes read in file
 			return bin_size[file];
 		}
 	}
 
+	//READ FORMAT/GT OF THE AVAILABLE RECORD AS STORED IN THE BCF [no copy, no widening to int32]
+	// =NULL: No GT field, or GT stored on 32 bits
+	// else : Raw field, fmt->n values of type fmt->type [BCF_BT_INT8 or BCF_BT_INT16] per sample, valid until the next record
+	bcf_fmt_t * readRawGenotypes(uint32_t file) {
+		if (!sync_flags[file] || sync_types[file] != FILE_BCF) return NULL;
+		bcf_fmt_t * fmt = bcf_get_fmt(sync_reader->readers[file].header, sync_lines[file], "GT");
+		if (!fmt || fmt->n <= 0 || (fmt->type != BCF_BT_INT8 && fmt->type != BCF_BT_INT16)) return NULL;
+		ploidy[file] = fmt->n;
+		return fmt;
+	}
+
+	//READ FORMAT/GT OF THE AVAILABLE RECORD WIDENED TO INT32 INTO A BUFFER OF CAPACITY *nbuffer [grown when needed, kept across records]
+	// =0: No sample data available
+	// >0: Amount of data read in bytes
+	int32_t readRecord(uint32_t file, int32_t ** buffer, int32_t * nbuffer) {
+		if (!sync_flags[file] || sync_types[file] != FILE_BCF) return readRecord(file, reinterpret_cast< char** > (buffer));
+
+		//Narrow encodings are widened straight from the raw field
+		bcf_fmt_t * fmt = readRawGenotypes(file);
+		if (!fmt) {
+			int32_t rdp = bcf_get_genotypes(sync_reader->readers[file].header, sync_lines[file], buffer, nbuffer);
+			int32_t max_ploidy = rdp/ind_number[file];
+			assert ( rdp>=0 && max_ploidy>0); // GT present
+			ploidy[file] = max_ploidy;
+			return rdp * sizeof(int32_t);
+		}
+		int32_t n = fmt->n * ind_number[file];
+		if (*nbuffer < n) {
+			*buffer = (int32_t*)realloc(*buffer, n * sizeof(int32_t));
+			*nbuffer = n;
+		}
+		if (fmt->type == BCF_BT_INT8) widenGenotypes((const int8_t *)fmt->p, n, bcf_int8_vector_end, bcf_int8_missing, *buffer);
+		else widenGenotypes((const int16_t *)fmt->p, n, bcf_int16_vector_end, bcf_int16_missing, *buffer);
+		return n * sizeof(int32_t);
+	}
+
+	template < typename T >
+	static void widenGenotypes(const T * in, int32_t n, int32_t vector_end, int32_t missing, int32_t * out) {
+		for (int32_t i = 0 ; i < n ; i ++) {
+			if (in[i] == vector_end) out[i] = bcf_int32_vector_end;
+			else if (in[i] == missing) out[i] = bcf_int32_missing;
+			else out[i] = in[i];
+		}
+	}
+
+	//READ DATA OF THE AVAILABLE SPARSE RECORD, DECODING DELTA/VBYTE CODED ONES
+	// =0: No sample data available
+	// >0: Number of sparse elements read [assuming buffer to be allocated!]
+	int32_t readSparseRecord(uint32_t file, int32_t * buffer) {
+		switch (bin_type[file]) {
+		case RECORD_SPARSE_GENOTYPE:
+		case RECORD_SPARSE_HAPLOTYPE:
+			return readRecord(file, reinterpret_cast< char * > (buffer)) / sizeof(int32_t);
+		case RECORD_VBYTE_GENOTYPE:
+		case RECORD_VBYTE_HAPLOTYPE:
+			if (bin_buffer.size() < bin_size[file]) bin_buffer.resize(bin_size[file]);
+			if (!readRecord(file, bin_buffer.data())) return 0;
+			if (bin_type[file] == RECORD_VBYTE_GENOTYPE) return vbyte::decodeGenotypes(bin_buffer.data(), bin_size[file], buffer);
+			else return vbyte::decodeHaplotypes(bin_buffer.data(), bin_size[file], buffer);
+		}
+		return 0;
+	}
+
+	//READ DATA OF THE AVAILABLE DENSE RECORD, DECODING XOR CODED HAPLOTYPES
+	// =0: No sample data available
+	// >0: Amount of dense data in bytes [assuming buffer to be allocated!]
+	int32_t readBinaryRecord(uint32_t file, char * buffer) {
+		if (bin_type[file] == RECORD_SHARDED_GENOTYPE || bin_type[file] == RECORD_SHARDED_HAPLOTYPE) return readShardedRecord(file, buffer);
+		if (bin_type[file] != RECORD_XOR_HAPLOTYPE) {
+			int32_t nbytes = readRecord(file, buffer);
+			if (bin_type[file] == RECORD_BINARY_HAPLOTYPE && nbytes && xor_coded[file]) {
+				xor_state[file].assign(buffer, buffer + nbytes);
+				xor_seek[file] = bin_seek[file];
+			}
+			return nbytes;
+		}
+		if (!sync_flags[file]) return 0;
+		return readXorRecord(file, bin_seek[file], bin_size[file], buffer);
+	}
+
+	//READ DATA OF THE AVAILABLE SHARDED RECORD, ONLY FOR THE GROUPS OF SAMPLES FLAGGED IN groups [all groups when NULL]
+	// =0: No sample data available
+	// >0: Amount of dense data in bytes [assuming buffer to be allocated!; bytes of groups not read are left untouched]
+	int32_t readShardedRecord(uint32_t file, char * buffer, const std::vector < bool > * groups = NULL) {
+		if (!sync_flags[file]) return 0;
+		uint64_t row = bin_seek[file];
+		uint32_t nbytes = bin_size[file], gbytes = shard_size[file] / 4;
+		for (uint32_t g = 0 ; g < shard_fds[file].size() ; g ++) {
+			if (groups && !(*groups)[g]) continue;
+			uint32_t size = std::min(gbytes, nbytes - g * gbytes);
+			uint64_t seek = row * size;
+			if ((uint64_t)shard_fds[file][g].tellg() != seek) shard_fds[file][g].seekg(seek, shard_fds[file][g].beg);
+			shard_fds[file][g].read(buffer + g * gbytes, size);
+		}
+		return nbytes;
+	}
+
+	//READ BINARY HAPLOTYPES ALONG WITH THE LIST OF MISSING HAPLOTYPES [missing haplotypes have their bit unset]
+	// =0: No sample data available
+	// >0: Amount of dense data in bytes [assuming buffer to be allocated!]
+	int32_t readMissingRecord(uint32_t file, char * buffer, std::vector < int32_t > & missing) {
+		missing.clear();
+		if (bin_type[file] != RECORD_MISSING_HAPLOTYPE) return readBinaryRecord(file, buffer);
+		if (bin_buffer.size() < bin_size[file]) bin_buffer.resize(bin_size[file]);
+		if (!readRecord(file, bin_buffer.data())) return 0;
+		uint32_t nbytes = DIVU(2 * ind_number[file], 8), nmissing;
+		memcpy(buffer, bin_buffer.data(), nbytes);
+		memcpy(&nmissing, bin_buffer.data() + nbytes, sizeof(uint32_t));
+		missing.resize(nmissing);
+		memcpy(missing.data(), bin_buffer.data() + nbytes + sizeof(uint32_t), nmissing * sizeof(int32_t));
+		return nbytes;
+	}
+
+	//Read binary data at any location of the binary file
+	//When reading regions, records come through a read-ahead window: it restarts small after a jump between regions and doubles along a region,
+	//so that a region costs a single seek and a few large reads instead of one small read per record
+	void readBinary(uint32_t file, uint64_t seek, uint32_t nbytes, char * buffer) {
+		if (!sync_reader->require_index || stream_fds[file] || nbytes > BIN_WINDOW_MAX) {
+			if (bin_curr[file] != seek) bin_fds[file].seekg(seek, bin_fds[file].beg);
+			bin_fds[file].read(buffer, nbytes);
+			bin_curr[file] = seek + nbytes;
+			return;
+		}
+		std::vector < char > & window = bin_window[file];
+		uint64_t wend = bin_wseek[file] + window.size();
+		if (seek < bin_wseek[file] || seek + nbytes > wend) {
+			bool run = !window.empty() && seek >= bin_wseek[file] && seek <= wend + BIN_ALIGNMENT;
+			bin_wnext[file] = run ? std::min(2 * bin_wnext[file], (uint32_t)BIN_WINDOW_MAX) : BIN_WINDOW_MIN;
+			window.resize(std::max(bin_wnext[file], nbytes));
+			if (bin_curr[file] != seek) bin_fds[file].seekg(seek, bin_fds[file].beg);
+			bin_fds[file].read(window.data(), window.size());
+			window.resize(bin_fds[file].gcount());
+			if (!bin_fds[file]) bin_fds[file].clear();			//End of file reached within the window
+			bin_wseek[file] = seek;
+			bin_curr[file] = seek + window.size();
+			if (window.size() < nbytes) helper_tools::error("Binary file truncated at [" + std::to_string(seek) + "]");
+		}
+		memcpy(buffer, window.data() + (seek - bin_wseek[file]), nbytes);
+	}
+
+	//Decode a XOR coded record; the reference is the last decoded record when possible, otherwise it is rebuilt along the chain from the last keyframe
+	int32_t readXorRecord(uint32_t file, uint64_t seek, uint32_t size, char * buffer) {
+		xor_coded[file] = true;
+		if (!flipXorRecord(file, seek, size)) {
+			xor_header H;
+			memcpy(&H, xor_record.data(), sizeof(xor_header));
+			uint64_t ref_seek = seek - H.back;
+			xor_chain.clear();
+			xor_chain.push_back(std::make_pair(seek, size));
+			while (H.ref_type == RECORD_XOR_HAPLOTYPE && xor_seek[file] != ref_seek) {
+				xor_chain.push_back(std::make_pair(ref_seek, H.ref_size));
+				readBinary(file, ref_seek, sizeof(xor_header), reinterpret_cast< char * > (&H));
+				ref_seek -= H.back;
+			}
+			if (xor_seek[file] != ref_seek) {
+				xor_state[file].resize(H.ref_size);
+				readBinary(file, ref_seek, H.ref_size, xor_state[file].data());
+				xor_seek[file] = ref_seek;
+			}
+			for (uint32_t c = xor_chain.size() ; c > 0 ; c --) flipXorRecord(file, xor_chain[c-1].first, xor_chain[c-1].second);
+		}
+		memcpy(buffer, xor_state[file].data(), xor_state[file].size());
+		return xor_state[file].size();
+	}
+
+	//Flip the bits of the last decoded record as given by a XOR coded record, when the former is the reference of the latter
+	bool flipXorRecord(uint32_t file, uint64_t seek, uint32_t size) {
+		if (xor_record.size() < size) xor_record.resize(size);
+		readBinary(file, seek, size, xor_record.data());
+		xor_header H;
+		memcpy(&H, xor_record.data(), sizeof(xor_header));
+		if (xor_seek[file] != seek - H.back) return false;
+		xor_flips.resize(vbyte::count(xor_record.data() + sizeof(xor_header)));
+		vbyte::decodeHaplotypes(xor_record.data() + sizeof(xor_header), size - sizeof(xor_header), xor_flips.data());
+		char * bits = xor_state[file].data();
+		for (uint32_t f = 0 ; f < xor_flips.size() ; f ++) bits[xor_flips[f] >> 3] ^= (0x80 >> (xor_flips[f] & 7));
+		xor_seek[file] = seek;
+		return true;
+	}
+
+	//READ HAPLOID RECORD AS BCF GENOTYPES [2 per sample; second allele of haploid samples set to vector end]
+	// =0: No sample data available
+	// >0: Number of alleles decoded
+	int32_t readHaploidRecord(uint32_t file, int32_t * buffer) {
+		const std::vector < uint8_t > & P = ind_ploidy[file];
+		if (bin_buffer.size() < bin_size[file]) bin_buffer.resize(bin_size[file]);
+		if (!readRecord(file, bin_buffer.data())) return 0;
+
+		//Phasing and missing haplotypes first, then the bits of all haplotypes or the sorted haplotypes away from the major allele
+		const int32_t * head = reinterpret_cast< const int32_t * > (bin_buffer.data());
+		const bool phased = head[0], sparse = (bin_type[file] == RECORD_SPARSE_HAPLOID), major = sparse && (getAF(file) >= 0.5f);
+		const int32_t * miss = head + 2, * miss_end = miss + head[1], * list = miss_end, * list_end = head + bin_size[file] / sizeof(int32_t);
+		const uint8_t * bits = reinterpret_cast< const uint8_t * > (miss_end);
+
+		uint32_t h = 0;
+		for (uint32_t i = 0 ; i < P.size() ; i ++) {
+			for (uint32_t a = 0 ; a < P[i] ; a ++, h ++) {
+				bool al = sparse ? (major != (list < list_end && *list == (int32_t)h)) : ((bits[h >> 3] >> (7 - (h & 7))) & 1);
+				if (sparse && list < list_end && *list == (int32_t)h) list ++;
+				if (miss < miss_end && *miss == (int32_t)h) { buffer[2*i+a] = (a && phased) ? bcf_gt_phased(-1) : bcf_gt_missing; miss ++; }
+				else buffer[2*i+a] = phased ? bcf_gt_phased(al) : bcf_gt_unphased(al);
+			}
+			if (P[i] == 1) {
+				if (!bcf_gt_is_missing(buffer[2*i+0])) buffer[2*i+0] = bcf_gt_unphased(bcf_gt_allele(buffer[2*i+0]));
+				buffer[2*i+1] = bcf_int32_vector_end;
+			}
+		}
+		return h;
+	}
+
+	//READ GENOTYPES OF A FEW SAMPLES IN THE AVAILABLE RECORD AS BCF GENOTYPES [2 per requested sample; first 2 alleles in BCF files]
+	//Dense records are only read at the bytes of the requested samples; sparse records are read once, then binary searched per sample
+	// =0: No sample data available
+	// >0: Number of samples read
+	int32_t readSampleGenotypes(uint32_t file, const uint32_t * samples, uint32_t n, int32_t * buffer) {
+		if (!sync_flags[file] || sync_types[file] == FILE_VOID) return 0;
+		for (uint32_t i = 0 ; i < n ; i ++) if (samples[i] >= ind_number[file]) helper_tools::error("Sample index [" + std::to_string(samples[i]) + "] out of range");
+
+		//Data is in BCF file; samples are picked in the raw field
+		if (sync_types[file] == FILE_BCF) {
+			bcf_fmt_t * fmt = bcf_get_fmt(sync_reader->readers[file].header, sync_lines[file], "GT");
+			if (!fmt || fmt->n <= 0) return 0;
+			ploidy[file] = fmt->n;
+			int32_t na = std::min(fmt->n, 2);
+			for (uint32_t i = 0 ; i < n ; i ++) {
+				const uint8_t * p = fmt->p + samples[i] * fmt->size;
+				buffer[2*i+1] = bcf_int32_vector_end;
+				if (fmt->type == BCF_BT_INT8) widenGenotypes((const int8_t *)p, na, bcf_int8_vector_end, bcf_int8_missing, buffer + 2*i);
+				else if (fmt->type == BCF_BT_INT16) widenGenotypes((const int16_t *)p, na, bcf_int16_vector_end, bcf_int16_missing, buffer + 2*i);
+				else memcpy(buffer + 2*i, p, na * sizeof(int32_t));
+			}
+			return n;
+		}
+
+		//Keyframes of XOR coded files are decoded in full, so that the next XOR coded records find their reference
+		const int32_t type = (bin_type[file] == RECORD_BINARY_HAPLOTYPE && xor_coded[file]) ? RECORD_XOR_HAPLOTYPE : bin_type[file];
+		const bool major = (getAF(file) >= 0.5f);
+		switch (type) {
+
+		//Dense records; 2 bits per sample from the start of the record, or of its row in the file of the group holding the sample
+		case RECORD_BINARY_GENOTYPE:
+		case RECORD_BINARY_HAPLOTYPE:
+		case RECORD_MISSING_HAPLOTYPE:
+		case RECORD_SHARDED_GENOTYPE:
+		case RECORD_SHARDED_HAPLOTYPE: {
+			const bool genotype = (type == RECORD_BINARY_GENOTYPE || type == RECORD_SHARDED_GENOTYPE);
+			for (uint32_t i = 0 ; i < n ; i ++) {
+				char c;
+				if (type == RECORD_SHARDED_GENOTYPE || type == RECORD_SHARDED_HAPLOTYPE) {
+					uint32_t g = samples[i] / shard_size[file], gbytes = shard_size[file] / 4;
+					uint64_t seek = bin_seek[file] * std::min(gbytes, bin_size[file] - g * gbytes) + (samples[i] % shard_size[file]) / 4;
+					if ((uint64_t)shard_fds[file][g].tellg() != seek) shard_fds[file][g].seekg(seek, shard_fds[file][g].beg);
+					shard_fds[file][g].read(&c, 1);
+				} else readBinary(file, bin_seek[file] + samples[i] / 4, 1, &c);
+				bool a0 = (c >> (7 - 2 * (samples[i] % 4))) & 1;
+				bool a1 = (c >> (6 - 2 * (samples[i] % 4))) & 1;
+				if (!genotype) {
+					buffer[2*i+0] = bcf_gt_phased(a0);
+					buffer[2*i+1] = bcf_gt_phased(a1);
+				} else if (a0 && !a1) buffer[2*i+0] = buffer[2*i+1] = bcf_gt_missing;
+				else {
+					buffer[2*i+0] = bcf_gt_unphased(a0);
+					buffer[2*i+1] = bcf_gt_unphased(a1);
+				}
+			}
+
+			//Missing haplotypes are listed after the dense data [uint32_t count, then indices]
+			if (type == RECORD_MISSING_HAPLOTYPE) {
+				uint32_t nbytes = DIVU(2 * ind_number[file], 8);
+				query_buffer.resize((bin_size[file] - nbytes) / sizeof(int32_t));
+				readBinary(file, bin_seek[file] + nbytes, bin_size[file] - nbytes, reinterpret_cast< char * > (query_buffer.data()));
+				const int32_t * first = query_buffer.data() + 1, * last = first + query_buffer[0];
+				for (uint32_t i = 0 ; i < n ; i ++) {
+					if (std::binary_search(first, last, (int32_t)(2 * samples[i] + 0))) buffer[2*i+0] = bcf_gt_missing;
+					if (std::binary_search(first, last, (int32_t)(2 * samples[i] + 1))) buffer[2*i+1] = bcf_gt_phased(-1);
+				}
+			}
+			return n;
+		}
+
+		//Sparse records, sorted by sample or by haplotype; unlisted samples carry the major allele
+		case RECORD_SPARSE_GENOTYPE:
+		case RECORD_VBYTE_GENOTYPE:
+		case RECORD_SPARSE_HAPLOTYPE:
+		case RECORD_VBYTE_HAPLOTYPE: {
+			query_buffer.resize(std::max(bin_size[file], 4U));		//Coded values take at least one byte each
+			const int32_t * first = query_buffer.data(), * last = first + readSparseRecord(file, query_buffer.data());
+			for (uint32_t i = 0 ; i < n ; i ++) {
+				if (type == RECORD_SPARSE_HAPLOTYPE || type == RECORD_VBYTE_HAPLOTYPE) {
+					for (uint32_t a = 0 ; a < 2 ; a ++) buffer[2*i+a] = bcf_gt_phased(major != std::binary_search(first, last, (int32_t)(2 * samples[i] + a)));
+					continue;
+				}
+				//Packed sparse genotypes [idx << 5 | het | mis | al0 | al1 | pha; see sparse_genotype.h]
+				const int32_t * e = std::lower_bound(first, last, samples[i], [](int32_t v, uint32_t idx) { return (((uint32_t)v) >> 5) < idx; });
+				if (e == last || (((uint32_t)*e) >> 5) != samples[i]) buffer[2*i+0] = buffer[2*i+1] = bcf_gt_unphased(major);
+				else if ((*e >> 3) & 1) buffer[2*i+0] = buffer[2*i+1] = bcf_gt_missing;
+				else {
+					buffer[2*i+0] = bcf_gt_unphased((*e >> 2) & 1);
+					buffer[2*i+1] = bcf_gt_unphased((*e >> 1) & 1);
+				}
+			}
+			return n;
+		}
+
+		//Sparse multiallelic records; sorted haplotypes of each allele, then of missing data, then samples with the other phasing [see sparse_multiallelic.h]
+		case RECORD_SPARSE_MULTIALLELIC: {
+			query_buffer.resize(bin_size[file] / sizeof(int32_t));
+			readRecord(file, reinterpret_cast< char * > (query_buffer.data()));
+			const int32_t * in = query_buffer.data();
+			const int32_t n_allele = in[0], phased = in[2];
+			for (uint32_t i = 0 ; i < n ; i ++) {
+				const int32_t * list = in + 5 + n_allele;
+				int32_t allele[2] = { in[1], in[1] };
+				for (int32_t l = 0 ; l <= n_allele ; list += in[3 + l], l ++)
+					for (uint32_t a = 0 ; a < 2 ; a ++)
+						if (std::binary_search(list, list + in[3 + l], (int32_t)(2 * samples[i] + a))) allele[a] = (l == n_allele) ? -1 : l;
+				bool exception = std::binary_search(list, list + in[4 + n_allele], (int32_t)samples[i]);
+				for (uint32_t a = 0 ; a < 2 ; a ++) {
+					if (allele[a] < 0) buffer[2*i+a] = (a && allele[0] >= 0 && phased != exception) ? bcf_gt_phased(-1) : bcf_gt_missing;
+					else buffer[2*i+a] = (phased != exception) ? bcf_gt_phased(allele[a]) : bcf_gt_unphased(allele[a]);
+				}
+			}
+			return n;
+		}
+
+		//Dosage records; hard calls from the dosages, read at the bytes of the requested samples or binary searched in the listed samples [see dosage_record.h]
+		case RECORD_DENSE_DOSAGE8:
+		case RECORD_DENSE_DOSAGE16: {
+			const uint32_t width = (type == RECORD_DENSE_DOSAGE8) ? 1 : 2;
+			for (uint32_t i = 0 ; i < n ; i ++) {
+				uint8_t q [2];
+				readBinary(file, bin_seek[file] + (uint64_t)samples[i] * width, width, reinterpret_cast< char * > (q));
+				if (width == 1) dosageGenotype(q[0], 0xFF, 127.0f, buffer + 2*i);
+				else {
+					uint16_t q16;
+					memcpy(&q16, q, sizeof(uint16_t));
+					dosageGenotype(q16, 0xFFFF, 32767.0f, buffer + 2*i);
+				}
+			}
+			return n;
+		}
+		case RECORD_SPARSE_DOSAGE: {
+			query_buffer.resize(DIVU(bin_size[file], sizeof(int32_t)));
+			readRecord(file, reinterpret_cast< char * > (query_buffer.data()));
+			const int32_t * first = query_buffer.data() + 1, * last = first + query_buffer[0];
+			const char * values = reinterpret_cast< const char * > (last);
+			for (uint32_t i = 0 ; i < n ; i ++) {
+				const int32_t * e = std::lower_bound(first, last, (int32_t)samples[i]);
+				uint16_t q = 0;
+				if (e != last && *e == (int32_t)samples[i]) memcpy(&q, values + (e - first) * sizeof(uint16_t), sizeof(uint16_t));
+				dosageGenotype(q, 0xFFFF, 32767.0f, buffer + 2*i);
+			}
+			return n;
+		}
+
+		//Other records are decoded in full
+		case RECORD_XOR_HAPLOTYPE: {
+			query_buffer.resize(DIVU(DIVU(2 * ind_number[file], 8), sizeof(int32_t)));
+			const char * bytes = reinterpret_cast< const char * > (query_buffer.data());
+			readBinaryRecord(file, reinterpret_cast< char * > (query_buffer.data()));
+			for (uint32_t i = 0 ; i < n ; i ++)
+				for (uint32_t a = 0 ; a < 2 ; a ++) buffer[2*i+a] = bcf_gt_phased((bytes[samples[i] / 4] >> (7 - 2 * (samples[i] % 4) - a)) & 1);
+			return n;
+		}
+		case RECORD_BINARY_HAPLOID:
+		case RECORD_SPARSE_HAPLOID:
+		case RECORD_BCFVCF_GENOTYPE: {
+			query_buffer.resize(std::max(2 * ind_number[file], bin_size[file] / (uint32_t)sizeof(int32_t)));
+			if (type == RECORD_BCFVCF_GENOTYPE) readRecord(file, reinterpret_cast< char * > (query_buffer.data()));
+			else readHaploidRecord(file, query_buffer.data());
+			for (uint32_t i = 0 ; i < n ; i ++) {
+				buffer[2*i+0] = query_buffer[2*samples[i]+0];
+				buffer[2*i+1] = query_buffer[2*samples[i]+1];
+			}
+			return n;
+		}
+		default:
+			helper_tools::error("Genotypes cannot be queried by sample in " + helper_tools::recordName(type) + " records");
+		}
+		return 0;
+	}
+
+	//Hard call from a quantised dosage, as dosage_record::genotypes [unphased]
+	static void dosageGenotype(uint16_t q, uint16_t missing, float scale, int32_t * gt) {
+		if (q == missing) gt[0] = gt[1] = bcf_gt_missing;
+		else {
+			float ds = q / scale;
+			gt[0] = bcf_gt_unphased(ds >= 1.5f);
+			gt[1] = bcf_gt_unphased(ds >= 0.5f);
+		}
+	}
+
+	//READ GENOTYPE OF A SINGLE SAMPLE IN THE AVAILABLE RECORD [2 BCF genotypes]
+	int32_t readSampleGenotype(uint32_t file, uint32_t sample, int32_t * buffer) {
+		return readSampleGenotypes(file, &sample, 1, buffer);
+	}
+
+	//READ DOSAGES OF THE AVAILABLE RECORD FROM FORMAT/DS, OR FROM FORMAT/GP IF DS IS ABSENT [BCF files only]
+	// =0: No dosage available
+	// >0: Number of dosages read, one per sample
+	int32_t readDosages(uint32_t file, float ** buffer, int32_t * nbuffer) {
+		if (!sync_flags[file] || sync_types[file] != FILE_BCF) return 0;
+		bcf_hdr_t * hdr = sync_reader->readers[file].header;
+		if (bcf_get_format_float(hdr, sync_lines[file], "DS", buffer, nbuffer) == (int32_t)ind_number[file]) return ind_number[file];
+		if (bcf_get_format_float(hdr, sync_lines[file], "GP", buffer, nbuffer) != 3 * (int32_t)ind_number[file]) return 0;
+		for (uint32_t i = 0 ; i < ind_number[file] ; i ++) {
+			float * gp = (*buffer) + 3 * i;
+			if (bcf_float_is_missing(gp[0])) bcf_float_set_missing((*buffer)[i]);
+			else (*buffer)[i] = gp[1] + 2.0f * gp[2];
+		}
+		return ind_number[file];
+	}
+
+	//CHECK IF HEADER DEFINES FORMAT/DS
+	bool hasDosages(uint32_t file) {
+		bcf_hdr_t * hdr = sync_reader->readers[file].header;
+		return bcf_hdr_idinfo_exists(hdr, BCF_HL_FMT, bcf_hdr_id2int(hdr, BCF_DT_ID, "DS"));
+	}
+
 	void seek(const char * seek_chr, int seek_pos) {
 		bcf_sr_seek(sync_reader, seek_chr, seek_pos);
 	}
@@ -668,7 +1351,38 @@ public:
 	void close() {
 		free(vSK); free(vAC); free(vAN);
 		for (uint32_t r = 0 ; r < sync_number ; r++) if (sync_types[r]>=2) bin_fds[r].close();
+		for (uint32_t r = 0 ; r < sync_number ; r++) for (uint32_t g = 0 ; g < shard_fds[r].size() ; g ++) shard_fds[r][g].close();
 		bcf_sr_destroy(sync_reader);
+		for (uint32_t r = 0 ; r < sync_number ; r++) if (stream_fds[r]) { stream_fds[r]->close(); delete stream_fds[r]; }
+	}
+
+private:
+
+	//Set the pending regions before the first file is added; contigs go in the order of the header of fname when it can be read
+	void setRegions(const std::string & fname) {
+		if (sync_region.empty()) return;
+		htsFile * fp = fname.empty() ? NULL : hts_open(fname.c_str(), "r");
+		bcf_hdr_t * hdr = fp ? bcf_hdr_read(fp) : NULL;
+		if (hdr) sync_region = helper_tools::sortRegions(sync_region, hdr);
+		if (hdr) bcf_hdr_destroy(hdr);
+		if (fp) hts_close(fp);
+		if (bcf_sr_set_regions(sync_reader, sync_region.c_str(), 0) == -1) helper_tools::error("Impossible to jump to region [" + helper_tools::regionName(sync_region) + "]");
+		if (bcf_sr_set_targets(sync_reader, sync_region.c_str(), 0, 0) == -1) helper_tools::error("Impossible to constrain to region [" + helper_tools::regionName(sync_region) + "]");
+		sync_region.clear();
+	}
+
+	//Open the sharded binary files of file, one per group of samples as given by the XCF_SHARDS header line
+	void openShards(uint32_t file, const std::string & fname) {
+		bcf_hrec_t * hrec = bcf_hdr_get_hrec(sync_reader->readers[file].header, BCF_HL_GEN, "XCF_SHARDS", NULL, NULL);
+		if (!hrec) return;
+		shard_size[file] = std::stoi(hrec->value);
+		if (!shard_size[file] || shard_size[file] % 4) helper_tools::error("Sample groups of [" + std::string(hrec->value) + "] samples in [" + fname + "] are not a multiple of 4");
+		shard_fds[file] = std::vector < std::ifstream > (DIVU(ind_number[file], shard_size[file]));
+		for (uint32_t g = 0 ; g < shard_fds[file].size() ; g ++) {
+			std::string sfname = helper_tools::get_shard_name(fname, g);
+			shard_fds[file][g].open(sfname.c_str(), std::ios::in | std::ios::binary);
+			if (!shard_fds[file][g]) helper_tools::error("Cannot open file [" + sfname + "] for reading");
+		}
 	}
 };
 
@@ -688,6 +1402,8 @@ public:
 	bcf_hdr_t * hts_hdr;
 	bcf1_t * hts_record;
 	bool hts_genotypes;
+	bool hts_dosages;							//Declare FORMAT/DS in header?
+	bool hts_text;								//VCF text with genotypes? [lines formatted by the caller, see writeLine; indexed on close]
 	uint32_t nthreads;
 
 	//INFO field
@@ -701,6 +1417,7 @@ public:
 	std::vector < std::string > ind_fathers;
 	std::vector < std::string > ind_mothers;
 	std::vector < std::string > ind_pops;
+	std::vector < uint8_t > ind_ploidy;			//Ploidy of each sample in haploid records [written in the PED file on close; empty when all diploid]
 
 
 	//Binary files [files x types]
@@ -708,13 +1425,48 @@ public:
 	uint32_t bin_type;							//Type of Binary record					//Integer 1 in INFO/SEEK field
 	uint64_t bin_seek;							//Location of Binary record				//Integer 2 and 3 in INFO/SEEK field
 	uint32_t bin_size;							//Amount of Binary records in bytes		//Integer 4 in INFO/SEEK field
+	std::vector < char > bin_buffer;			//Scratch buffer for coded records
+	std::vector < uint64_t > bin_type_count;	//Number of records written per type
+	std::vector < uint64_t > bin_type_bytes;	//Amount of bytes written per type
+	uint32_t bin_align;							//Records start on multiples of bin_align bytes [0 for no padding]
+
+	//XOR coding of dense haplotype records
+	uint32_t xor_keyframe;						//Keyframe every xor_keyframe dense haplotype records [0 for no XOR coding]
+	uint32_t xor_count;							//Number of dense haplotype records since the last keyframe
+	uint32_t xor_type;							//Type of the reference record
+	uint64_t xor_seek;							//Location of the reference record
+	uint32_t xor_size;							//Size in bytes of the reference record
+	std::vector < char > xor_state;				//Bits of the reference record
+	std::vector < int32_t > xor_flips;			//Indices of the bits flipped since the reference record
+
+	//Sharding of dense records in groups of samples
+	uint32_t shard_size;						//Number of samples per group [0 for no sharding; multiple of 4]
+	uint32_t shard_rows;						//Number of sharded records written
+	std::vector < std::ofstream > shard_fds;	//File Descriptors, one per group
+
+	//Single stream instead of the .bcf/.bin/.fam triplet [see xcf_stream.h]
+	bool stream;								//Writing a stream? [- or .xcfs with binary data]
+	xcf_stream_output stream_fd;				//Stream, also receiving the binary data written in bin_fds
+	kstring_t stream_line;						//Scratch buffer for the header text
+	std::string stream_fam;						//Content of the FAM frame
+	bool stream_ploidy;							//FAM frame sent with the ploidy?
+
+	//Binary data copied as is from another binary file, in runs of contiguous records [see copyRecord]
+	int copy_fd;								//Binary file opened for copies [-1 until the first run]
+	int copy_src;								//Binary file the current run is copied from
+	uint64_t copy_seek;							//Location of the current run in the source
+	uint64_t copy_out;							//Location of the current run in the output
+	uint64_t copy_size;							//Amount of bytes in the current run [0 for none]
 
 	//CONSTRUCTOR
 	xcf_writer(std::string _hts_fname, bool _hts_genotypes, uint32_t _nthreads, bool write_genotypes=true) : hts_hdr(nullptr) , ind_number(0) {
 		std::string oformat;
 		hts_fname = _hts_fname;
+		stream = !_hts_genotypes && write_genotypes && (hts_fname == "-" || helper_tools::isStreamName(hts_fname));
 
-		if (hts_fname == "-") {
+		if (stream) {
+			oformat = "";			//Sites go as BCF records in the stream
+		} else if (hts_fname == "-") {
 			oformat = "wbu";		//Uncompressed BCF for stdout
 		} else if (hts_fname.size() > 3 && hts_fname.substr(hts_fname.size()-3) == "bcf") {
 			oformat = "wb";			//Compressed BCF for file
@@ -730,17 +1482,39 @@ public:
 		}
 
 		hts_genotypes = _hts_genotypes;
+		hts_dosages = false;
+		hts_text = hts_genotypes && (oformat == "wz" || oformat == "wv");
 		nthreads = _nthreads;
 		bin_type = 0;
 		bin_seek = 0;
 		bin_size = 0;
+		bin_align = 0;
+		xor_keyframe = xor_count = xor_type = xor_size = 0;
+		xor_seek = 0;
+		shard_size = shard_rows = 0;
+		bin_type_count = std::vector < uint64_t > (RECORD_NUMBER_TYPES, 0);
+		bin_type_bytes = std::vector < uint64_t > (RECORD_NUMBER_TYPES, 0);
 		hts_record = bcf_init1();
 		vsk = (int32_t *)malloc(4 * sizeof(int32_t *));
 		nsk = rsk = 0;
+		stream_line = { 0, 0, NULL };
+		stream_ploidy = false;
+		copy_fd = copy_src = -1;
+		copy_seek = copy_out = copy_size = 0;
+
+		if (stream) {
+			//Binary data goes in the stream, ahead of the site pointing to it
+			stream_fd.open(hts_fname);
+			bin_fds.std::ios::rdbuf(&stream_fd);
+			hts_fd = NULL;
+			hts_fidx = "";
+			return;
+		}
 
 		hts_fd = hts_open(hts_fname.c_str(), oformat.c_str());
 	    if (!hts_fd)  helper_tools::error("Could not open " + hts_fname);
-	    if (hts_fname!="-") hts_fidx = hts_fname + ".csi";
+	    if (nthreads > 1 && hts_set_threads(hts_fd, nthreads) < 0) helper_tools::error("Could not set threads for " + hts_fname);
+	    if (hts_fname!="-" && oformat != "wv") hts_fidx = hts_fname + ".csi";
 	    else hts_fidx = "";
 
 		if (!hts_genotypes && write_genotypes) {
@@ -761,10 +1535,7 @@ public:
 		hts_hdr = bcf_hdr_subset(hdr, 0, NULL,NULL);
 		bcf_hdr_add_sample(hts_hdr, NULL);
 		bcf_hdr_remove(hts_hdr, BCF_HL_FMT, NULL);
-		if (bcf_hdr_write(hts_fd, hts_hdr) < 0) helper_tools::error("Failing to write BCF/header");
-		if (!hts_fidx.empty())
-			if (bcf_idx_init(hts_fd, hts_hdr, 14, hts_fidx.c_str()))
-				helper_tools::error("Initializing .csi");
+		writeHeaderHTS();
 		bcf_clear1(hts_record);
 	}
 
@@ -773,10 +1544,7 @@ public:
 		hts_hdr = bcf_hdr_dup(hdr);
 		bcf_hdr_add_sample(hts_hdr, NULL);
 		//bcf_hdr_remove(hts_hdr, BCF_HL_FMT, NULL);
-		if (bcf_hdr_write(hts_fd, hts_hdr) < 0) helper_tools::error("Failing to write BCF/header");
-		if (!hts_fidx.empty())
-			if (bcf_idx_init(hts_fd, hts_hdr, 14, hts_fidx.c_str()))
-				helper_tools::error("Initializing .csi");
+		writeHeaderHTS();
 		bcf_clear1(hts_record);
 	}
 
@@ -793,6 +1561,7 @@ public:
 			bcf_hdr_append(hts_hdr, "##INFO=<ID=AN,Number=1,Type=Integer,Description=\"Number of alleles\">");
 			if (hts_genotypes) bcf_hdr_append(hts_hdr, "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Phased genotypes\">");
 			else bcf_hdr_append(hts_hdr, "##INFO=<ID=SEEK,Number=4,Type=Integer,Description=\"SEEK binary file information\">");
+			if (hts_dosages) bcf_hdr_append(hts_hdr, "##FORMAT=<ID=DS,Number=A,Type=Float,Description=\"Genotype dosage\">");
 		}
 		else
 		{
@@ -810,26 +1579,23 @@ public:
 			bcf_hdr_append(hts_hdr, "##INFO=<ID=AN,Number=1,Type=Integer,Description=\"Number of alleles\">");
 			if (hts_genotypes) bcf_hdr_append(hts_hdr, "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Phased genotypes\">");
 			else bcf_hdr_append(hts_hdr, "##INFO=<ID=SEEK,Number=4,Type=Integer,Description=\"SEEK binary file information\">");
+			if (hts_dosages) bcf_hdr_append(hts_hdr, "##FORMAT=<ID=DS,Number=A,Type=Float,Description=\"Genotype dosage\">");
 		}
 
 		//Write sample IDs
 		if (hts_genotypes) {
 			//Samples are in BCF header
-			for (uint32_t i = 0 ; i < subs2full.size() ; i++) bcf_hdr_add_sample(hts_hdr, XR.ind_names[0][i].c_str());
+			for (uint32_t i = 0 ; i < subs2full.size() ; i++) bcf_hdr_add_sample(hts_hdr, XR.ind_names[0][subs2full[i]].c_str());
 			bcf_hdr_add_sample(hts_hdr, NULL);      // to update internal structures
 		} else {
 			//Samples are in PED file
-			std::string ffname = helper_tools::get_name_from_vcf(hts_fname) + ".fam";
-			std::ofstream fd (ffname);
-			if (!fd.is_open()) helper_tools::error("Cannot open [" + ffname + "] for writing");
-			for (uint32_t i = 0 ; i < subs2full.size() ; i++) fd << XR.ind_names[0][i] << "\t"<< XR.ind_fathers[0][i] << "\t" << XR.ind_mothers[0][i] << "\t" << XR.ind_pops[0][i] << std::endl;
-			fd.close();
+			std::ostringstream fd;
+			for (uint32_t i = 0 ; i < subs2full.size() ; i++) fd << XR.ind_names[0][subs2full[i]] << "\t"<< XR.ind_fathers[0][subs2full[i]] << "\t" << XR.ind_mothers[0][subs2full[i]] << "\t" << XR.ind_pops[0][subs2full[i]] << std::endl;
+			writePedigree(fd.str());
 		}
+		declareShards(subs2full.size());
 
-		if (bcf_hdr_write(hts_fd, hts_hdr) < 0) helper_tools::error("Failing to write BCF/header");
-		if (!hts_fidx.empty())
-			if (bcf_idx_init(hts_fd, hts_hdr, 14, hts_fidx.c_str()))
-				helper_tools::error("Initializing .csi");
+		writeHeaderHTS();
 		bcf_clear1(hts_record);
 
 	}
@@ -845,6 +1611,7 @@ public:
 		bcf_hdr_append(hts_hdr, "##INFO=<ID=AN,Number=1,Type=Integer,Description=\"Number of alleles\">");
 		if (hts_genotypes) bcf_hdr_append(hts_hdr, "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Phased genotypes\">");
 		else bcf_hdr_append(hts_hdr, "##INFO=<ID=SEEK,Number=4,Type=Integer,Description=\"SEEK binary file information\">");
+		if (hts_dosages) bcf_hdr_append(hts_hdr, "##FORMAT=<ID=DS,Number=A,Type=Float,Description=\"Genotype dosage\">");
 		//Write sample IDs
 		if (hts_genotypes) {
 			//Samples are in BCF header
@@ -852,17 +1619,13 @@ public:
 			bcf_hdr_add_sample(hts_hdr, NULL);      // to update internal structures
 		} else {
 			//Samples are in PED file
-			std::string ffname = helper_tools::get_name_from_vcf(hts_fname) + ".fam";
-			std::ofstream fd (ffname);
-			if (!fd.is_open()) helper_tools::error("Cannot open [" + ffname + "] for writing");
+			std::ostringstream fd;
 			for (uint32_t i = 0 ; i < samples.size() ; i++) fd << samples[i] << "\tNA\tNA" << std::endl;
-			fd.close();
+			writePedigree(fd.str());
 		}
+		declareShards(samples.size());
 
-		if (bcf_hdr_write(hts_fd, hts_hdr) < 0) helper_tools::error("Failing to write BCF/header");
-		if (!hts_fidx.empty())
-			if (bcf_idx_init(hts_fd, hts_hdr, 14, hts_fidx.c_str()))
-				helper_tools::error("Initializing .csi");
+		writeHeaderHTS();
 		bcf_clear1(hts_record);
 	}
 
@@ -884,6 +1647,7 @@ public:
 		bcf_hdr_append(hts_hdr, "##INFO=<ID=AN,Number=1,Type=Integer,Description=\"Number of alleles\">");
 		if (hts_genotypes) bcf_hdr_append(hts_hdr, "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Phased genotypes\">");
 		else bcf_hdr_append(hts_hdr, "##INFO=<ID=SEEK,Number=4,Type=Integer,Description=\"SEEK binary file information\">");
+		if (hts_dosages) bcf_hdr_append(hts_hdr, "##FORMAT=<ID=DS,Number=A,Type=Float,Description=\"Genotype dosage\">");
 
 		//Write sample IDs
 		if (hts_genotypes) {
@@ -892,16 +1656,12 @@ public:
 			bcf_hdr_add_sample(hts_hdr, NULL);      // to update internal structures
 		} else {
 			//Samples are in PED file
-			std::string ffname = helper_tools::get_name_from_vcf(hts_fname) + ".fam";
-			std::ofstream fd (ffname);
-			if (!fd.is_open()) helper_tools::error("Cannot open [" + ffname + "] for writing");
+			std::ostringstream fd;
 			for (uint32_t i = 0 ; i < samples.size() ; i++) fd << samples[i] << "\tNA\tNA" << std::endl;
-			fd.close();
+			writePedigree(fd.str());
 		}
-		if (bcf_hdr_write(hts_fd, hts_hdr) < 0) helper_tools::error("Failing to write BCF/header");
-		if (!hts_fidx.empty())
-			if (bcf_idx_init(hts_fd, hts_hdr, 14, hts_fidx.c_str()))
-				helper_tools::error("Initializing .csi");
+		declareShards(samples.size());
+		writeHeaderHTS();
 
 		bcf_clear1(hts_record);
 	}
@@ -917,6 +1677,7 @@ public:
 		bcf_hdr_append(hts_hdr, "##INFO=<ID=AN,Number=1,Type=Integer,Description=\"Number of alleles\">");
 		if (hts_genotypes) bcf_hdr_append(hts_hdr, "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Phased genotypes\">");
 		else bcf_hdr_append(hts_hdr, "##INFO=<ID=SEEK,Number=4,Type=Integer,Description=\"SEEK binary file information\">");
+		if (hts_dosages) bcf_hdr_append(hts_hdr, "##FORMAT=<ID=DS,Number=A,Type=Float,Description=\"Genotype dosage\">");
 
 		//Write sample IDs
 		if (hts_genotypes) {
@@ -925,32 +1686,128 @@ public:
 			bcf_hdr_add_sample(hts_hdr, NULL);      // to update internal structures
 		} else {
 			//Samples are in PED file
-			std::string ffname = helper_tools::get_name_from_vcf(hts_fname) + ".fam";
-			std::ofstream fd (ffname);
-			if (!fd.is_open()) helper_tools::error("Cannot open [" + ffname + "] for writing");
+			std::ostringstream fd;
 			for (uint32_t i = 0 ; i < samples.size() ; i++) {
 				std::string sfather = (fathers[i]>=0)?samples[fathers[i]]:"NA";
 				std::string smother = (mothers[i]>=0)?samples[mothers[i]]:"NA";
 				fd << samples[i] << "\t" << sfather << "\t" << smother << std::endl;
 			}
-			fd.close();
+			writePedigree(fd.str());
 		}
-		if (bcf_hdr_write(hts_fd, hts_hdr) < 0) helper_tools::error("Failing to write VCF/header");
-		if (!hts_fidx.empty())
+		declareShards(samples.size());
+		writeHeaderHTS();
+		bcf_clear1(hts_record);
+	}
+
+	//Write the header in the BCF file, or as the HEADER frame of a stream
+	void writeHeaderHTS() {
+		if (stream) {
+			bcf_hdr_sync(hts_hdr);
+			stream_line.l = 0;
+			if (bcf_hdr_format(hts_hdr, 1, &stream_line) < 0) helper_tools::error("Failing to write VCF/header");
+			stream_fd.writeFrame(FRAME_HEADER, stream_line.s, stream_line.l);
+			return;
+		}
+		if (bcf_hdr_write(hts_fd, hts_hdr) < 0) helper_tools::error("Failing to write BCF/header");
+		if (!hts_fidx.empty() && !hts_text)
 			if (bcf_idx_init(hts_fd, hts_hdr, 14, hts_fidx.c_str()))
 				helper_tools::error("Initializing .csi");
-		bcf_clear1(hts_record);
+	}
+
+	//Write the PED file, or the FAM frame of a stream
+	void writePedigree(const std::string & fam) {
+		if (stream) {
+			stream_fam = fam;
+			stream_fd.writeFrame(FRAME_FAM, fam.data(), fam.size());
+			return;
+		}
+		std::string ffname = helper_tools::get_name_from_vcf(hts_fname) + ".fam";
+		std::ofstream fd (ffname);
+		if (!fd.is_open()) helper_tools::error("Cannot open [" + ffname + "] for writing");
+		fd << fam;
+		fd.close();
+	}
+
+	//Declare the groups of samples in the header and open one binary file per group [cloned headers drop any inherited declaration]
+	void declareShards(uint32_t nsamples) {
+		bcf_hdr_remove(hts_hdr, BCF_HL_GEN, "XCF_SHARDS");
+		if (!shard_size || hts_genotypes || !bin_fds.is_open()) return;
+		bcf_hdr_append(hts_hdr, std::string("##XCF_SHARDS=" + std::to_string(shard_size)).c_str());
+		shard_fds = std::vector < std::ofstream > (DIVU(nsamples, shard_size));
+		for (uint32_t g = 0 ; g < shard_fds.size() ; g ++) {
+			std::string sfname = helper_tools::get_shard_name(hts_fname, g);
+			shard_fds[g].open(sfname.c_str(), std::ios::out | std::ios::binary);
+			if (!shard_fds[g]) helper_tools::error("Cannot open file [" + sfname + "] for writing");
+		}
 	}
 
 	//Write variant information
 	void writeInfo(std::string chr, uint32_t pos, std::string ref, std::string alt, std::string rsid, uint32_t AC, uint32_t AN) {
-		hts_record->rid = bcf_hdr_name2id(hts_hdr, chr.c_str());
-		hts_record->pos = pos - 1;
-		bcf_update_id(hts_hdr, hts_record, rsid.c_str());
+		writeInfo(hts_record, chr, pos, ref, alt, rsid, AC, AN);
+	}
+
+	//Write variant information for multiallelic records [ALTs comma separated, one AC per ALT]
+	void writeInfo(std::string chr, uint32_t pos, std::string ref, std::string alt, std::string rsid, std::vector < uint32_t > & AC, uint32_t AN) {
+		writeInfo(hts_record, chr, pos, ref, alt, rsid, AC, AN);
+	}
+
+	//Write variant information in a given record [records built concurrently; the header is only read]
+	void writeInfo(bcf1_t * rec, const std::string & chr, uint32_t pos, const std::string & ref, const std::string & alt, const std::string & rsid, uint32_t AC, uint32_t AN) {
+		rec->rid = bcf_hdr_name2id(hts_hdr, chr.c_str());
+		rec->pos = pos - 1;
+		bcf_update_id(hts_hdr, rec, rsid.c_str());
+		std::string alleles = ref + "," + alt;
+		bcf_update_alleles_str(hts_hdr, rec, alleles.c_str());
+		bcf_update_info_int32(hts_hdr, rec, "AC", &AC, 1);
+		bcf_update_info_int32(hts_hdr, rec, "AN", &AN, 1);
+	}
+
+	void writeInfo(bcf1_t * rec, const std::string & chr, uint32_t pos, const std::string & ref, const std::string & alt, const std::string & rsid, std::vector < uint32_t > & AC, uint32_t AN) {
+		rec->rid = bcf_hdr_name2id(hts_hdr, chr.c_str());
+		rec->pos = pos - 1;
+		bcf_update_id(hts_hdr, rec, rsid.c_str());
 		std::string alleles = ref + "," + alt;
-		bcf_update_alleles_str(hts_hdr, hts_record, alleles.c_str());
-		bcf_update_info_int32(hts_hdr, hts_record, "AC", &AC, 1);
-		bcf_update_info_int32(hts_hdr, hts_record, "AN", &AN, 1);
+		bcf_update_alleles_str(hts_hdr, rec, alleles.c_str());
+		bcf_update_info_int32(hts_hdr, rec, "AC", AC.data(), AC.size());
+		bcf_update_info_int32(hts_hdr, rec, "AN", &AN, 1);
+	}
+
+	//Write genotypes, and dosages when given, in a given record [records built concurrently; the header is only read]
+	void writeGenotypes(bcf1_t * rec, char * buffer, uint32_t nbytes, float * dosages = NULL, uint32_t ndosages = 0) {
+		bcf_update_genotypes(hts_hdr, rec, buffer, nbytes/sizeof(int32_t));
+		if (dosages) bcf_update_format_float(hts_hdr, rec, "DS", dosages, ndosages);
+	}
+
+	//Write FORMAT/GT of a given record as one block of int8 values, straight in the FORMAT bytes of the record [no int32 staging, no type scan]
+	//Returns where the 2 values of each sample go, to be filled by the caller with bcf_gt_* values [records built concurrently; the header is only read]
+	int8_t * writeGenotypes8(bcf1_t * rec) {
+		uint32_t n = bcf_hdr_nsamples(hts_hdr);
+		rec->indiv.l = 0;
+		bcf_enc_int1(&rec->indiv, bcf_hdr_id2int(hts_hdr, BCF_DT_ID, "GT"));
+		bcf_enc_size(&rec->indiv, 2, BCF_BT_INT8);
+		if (ks_resize(&rec->indiv, rec->indiv.l + 2 * n) < 0) helper_tools::error("Failing to allocate FORMAT/GT");
+		int8_t * gt = (int8_t *)(rec->indiv.s + rec->indiv.l);
+		rec->indiv.l += 2 * n;
+		rec->n_fmt = 1;
+		rec->n_sample = n;
+		return gt;
+	}
+
+	//Format the site of a given record as a VCF line ending with the FORMAT column, to be followed by sample columns [records built concurrently; the header is only read]
+	void formatSite(bcf1_t * rec, kstring_t * line) {
+		if (vcf_format(hts_hdr, rec, line) < 0) helper_tools::error("Failing to format VCF/record");
+		line->l --;
+		kputs("\tGT", line);
+	}
+
+	//Format a given record as a VCF line [records built concurrently; the header is only read]
+	void formatRecord(bcf1_t * rec, kstring_t * line) {
+		if (vcf_format(hts_hdr, rec, line) < 0) helper_tools::error("Failing to format VCF/record");
+	}
+
+	//Write VCF lines formatted with formatSite/formatRecord
+	void writeLine(kstring_t * line) {
+		if (line->l && vcf_write_line(hts_fd, line) < 0) helper_tools::error("Failing to write VCF/record");
 	}
 
 	void writeSeekField(uint32_t type, uint64_t seek, uint32_t nbytes)
@@ -966,35 +1823,233 @@ public:
 	void writeRecord(uint32_t type, char * buffer, uint32_t nbytes) {
 		if (hts_genotypes) {
 			bcf_update_genotypes(hts_hdr, hts_record, buffer, nbytes/sizeof(int32_t));
+		} else if (!shard_fds.empty() && (type == RECORD_BINARY_GENOTYPE || type == RECORD_BINARY_HAPLOTYPE)) {
+			writeShardedRecord((type == RECORD_BINARY_GENOTYPE) ? RECORD_SHARDED_GENOTYPE : RECORD_SHARDED_HAPLOTYPE, buffer, nbytes);
+			return;
 		} else {
+			//Readers of a stream need the ploidy before the first haploid record
+			if (stream && !stream_ploidy && !ind_ploidy.empty() && (type == RECORD_BINARY_HAPLOID || type == RECORD_SPARSE_HAPLOID)) writePloidy();
+			pad();
 			vsk[0] = type;
 			vsk[1] = bin_seek / MOD30BITS;		//Split addr in 2 30bits integer (max number of sparse genotypes ~1.152922e+18)
 			vsk[2] = bin_seek % MOD30BITS;		//Split addr in 2 30bits integer (max number of sparse genotypes ~1.152922e+18)
 			vsk[3] = nbytes;
 			bin_fds.write(buffer, nbytes);
 			bin_seek += nbytes;
+			bin_type_count[type] ++;
+			bin_type_bytes[type] += nbytes;
 			bcf_update_info_int32(hts_hdr, hts_record, "SEEK", vsk, 4);
 		}
 		writeRecord(hts_record);
 	}
+	//Write dense genotypes/haplotypes split in groups of samples, one file per group; the location in SEEK is the row of the record in each group file
+	void writeShardedRecord(uint32_t type, char * buffer, uint32_t nbytes) {
+		uint32_t gbytes = shard_size / 4;
+		for (uint32_t g = 0 ; g < shard_fds.size() ; g ++) shard_fds[g].write(buffer + g * gbytes, std::min(gbytes, nbytes - g * gbytes));
+		vsk[0] = type;
+		vsk[1] = shard_rows / MOD30BITS;
+		vsk[2] = shard_rows % MOD30BITS;
+		vsk[3] = nbytes;
+		shard_rows ++;
+		bin_type_count[type] ++;
+		bin_type_bytes[type] += nbytes;
+		bcf_update_info_int32(hts_hdr, hts_record, "SEEK", vsk, 4);
+		writeRecord(hts_record);
+	}
+
+	//Write sparse genotypes/haplotypes, delta/vbyte coding them for RECORD_VBYTE_* types
+	void writeSparseRecord(uint32_t type, int32_t * buffer, uint32_t n) {
+		if (type == RECORD_VBYTE_GENOTYPE || type == RECORD_VBYTE_HAPLOTYPE) {
+			if (bin_buffer.size() < vbyte::bound(n)) bin_buffer.resize(vbyte::bound(n));
+			uint32_t nbytes = (type == RECORD_VBYTE_GENOTYPE) ? vbyte::encodeGenotypes(buffer, n, bin_buffer.data()) : vbyte::encodeHaplotypes(buffer, n, bin_buffer.data());
+			writeRecord(type, bin_buffer.data(), nbytes);
+		} else writeRecord(type, reinterpret_cast< char * > (buffer), n * sizeof(int32_t));
+	}
+
+	//Write binary haplotypes followed by the list of missing haplotypes
+	void writeMissingRecord(char * buffer, uint32_t nbytes, int32_t * missing, uint32_t nmissing) {
+		uint32_t size = nbytes + sizeof(uint32_t) + nmissing * sizeof(int32_t);
+		if (bin_buffer.size() < size) bin_buffer.resize(size);
+		memcpy(bin_buffer.data(), buffer, nbytes);
+		memcpy(bin_buffer.data() + nbytes, &nmissing, sizeof(uint32_t));
+		memcpy(bin_buffer.data() + nbytes + sizeof(uint32_t), missing, nmissing * sizeof(int32_t));
+		writeRecord(RECORD_MISSING_HAPLOTYPE, bin_buffer.data(), size);
+	}
+
+	//Encode a haploid record from BCF genotypes [2 per sample; alleles follow the ploidy of each sample]
+	//Layout: [phased][#missing][missing haplotypes], then the bits of all haplotypes [binary] or the haplotypes away from the major allele [sparse]
+	//Returns the number of bytes written into out, at most haploidBound bytes
+	static uint32_t encodeHaploid(const int32_t * gt, const std::vector < uint8_t > & ploidy, bool phased, bool sparse, bool major, char * out) {
+		int32_t * head = reinterpret_cast< int32_t * > (out);
+		uint32_t n_haps = std::accumulate(ploidy.begin(), ploidy.end(), 0U), n_missing = 0, n_listed = 0;
+		head[0] = phased;
+		for (uint32_t i = 0, h = 0 ; i < ploidy.size() ; i ++)
+			for (uint32_t a = 0 ; a < ploidy[i] ; a ++, h ++) if (bcf_gt_is_missing(gt[2*i+a])) head[2 + n_missing++] = h;
+		head[1] = n_missing;
+		int32_t * list = head + 2 + n_missing;
+		uint8_t * bits = reinterpret_cast< uint8_t * > (list);
+		if (!sparse) memset(bits, 0, DIVU(n_haps, 8));
+		for (uint32_t i = 0, h = 0 ; i < ploidy.size() ; i ++)
+			for (uint32_t a = 0 ; a < ploidy[i] ; a ++, h ++) {
+				if (bcf_gt_is_missing(gt[2*i+a])) continue;
+				bool al = (bcf_gt_allele(gt[2*i+a]) == 1);
+				if (sparse && al != major) list[n_listed++] = h;
+				if (!sparse && al) bits[h >> 3] |= (0x80 >> (h & 7));
+			}
+		return (2 + n_missing) * sizeof(int32_t) + (sparse ? n_listed * sizeof(int32_t) : DIVU(n_haps, 8));
+	}
+
+	static uint32_t haploidBound(uint32_t n_haps) {
+		return (2 + n_haps) * sizeof(int32_t) + DIVU(n_haps, 8);
+	}
+
+	//Cheapest encoding in bytes of a record amongst binary, sparse and delta/vbyte coded sparse; ties go to the fastest to decode
+	static uint32_t cheapestRecord(bool genotype, int32_t * buffer, uint32_t n, uint32_t nbytes_binary) {
+		uint32_t nbytes_sparse = n * sizeof(int32_t);
+		//Lower bound of the vbyte coding; saves a scan of the buffer for common variants
+		if (std::min(nbytes_sparse, (uint32_t)sizeof(uint32_t) + (n + 3) / 4 + n) >= nbytes_binary)
+			return genotype ? RECORD_BINARY_GENOTYPE : RECORD_BINARY_HAPLOTYPE;
+		uint32_t nbytes_vbyte = genotype ? vbyte::sizeGenotypes(buffer, n) : vbyte::sizeHaplotypes(buffer, n);
+		if (nbytes_binary <= std::min(nbytes_sparse, nbytes_vbyte)) return genotype ? RECORD_BINARY_GENOTYPE : RECORD_BINARY_HAPLOTYPE;
+		if (nbytes_sparse <= nbytes_vbyte) return genotype ? RECORD_SPARSE_GENOTYPE : RECORD_SPARSE_HAPLOTYPE;
+		return genotype ? RECORD_VBYTE_GENOTYPE : RECORD_VBYTE_HAPLOTYPE;
+	}
+
+	//Write binary haplotypes, XOR coding them against the previous dense haplotype record when enabled
+	void writeHaplotypeRecord(char * buffer, uint32_t nbytes) {
+		uint32_t type = RECORD_BINARY_HAPLOTYPE, size = nbytes;
+		if (xor_keyframe && shard_fds.empty() && (xor_count % xor_keyframe) && xor_state.size() == nbytes) {
+			//Bits flipped since the reference, giving up as soon as the record cannot be smaller than the dense one
+			xor_flips.clear();
+			for (uint32_t b = 0 ; b < nbytes && (sizeof(xor_header) + 5 * xor_flips.size() / 4) < nbytes ; b ++) {
+				if (!(b & 7) && b + 8 <= nbytes && !memcmp(buffer + b, xor_state.data() + b, 8)) { b += 7; continue; }
+				for (uint32_t d = (uint8_t)(buffer[b] ^ xor_state[b]) ; d ; ) {
+					uint32_t k = __builtin_clz(d) - 24;
+					xor_flips.push_back(8 * b + k);
+					d &= ~(0x80U >> k);
+				}
+			}
+			uint32_t size_xor = sizeof(xor_header) + vbyte::sizeHaplotypes(xor_flips.data(), xor_flips.size());
+			if (size_xor < nbytes) {
+				type = RECORD_XOR_HAPLOTYPE;
+				size = size_xor;
+			}
+		}
+
+		pad();
+		if (type == RECORD_XOR_HAPLOTYPE) {
+			if (bin_buffer.size() < size) bin_buffer.resize(size);
+			xor_header H = { bin_seek - xor_seek, xor_type, xor_size };
+			memcpy(bin_buffer.data(), &H, sizeof(xor_header));
+			vbyte::encodeHaplotypes(xor_flips.data(), xor_flips.size(), bin_buffer.data() + sizeof(xor_header));
+			xor_count ++;
+		} else xor_count = 1;
+		xor_type = type;
+		xor_seek = bin_seek;
+		xor_size = size;
+		xor_state.assign(buffer, buffer + nbytes);
+		writeRecord(type, (type == RECORD_XOR_HAPLOTYPE) ? bin_buffer.data() : buffer, size);
+	}
+
+	//Write genotypes along with dosages [FORMAT/GT first, then FORMAT/DS]
+	void writeRecord(char * buffer, uint32_t nbytes, float * dosages, uint32_t ndosages) {
+		bcf_update_genotypes(hts_hdr, hts_record, buffer, nbytes/sizeof(int32_t));
+		bcf_update_format_float(hts_hdr, hts_record, "DS", dosages, ndosages);
+		writeRecord(hts_record);
+	}
+
+	//Write a record whose binary data is copied as is from bytes [seek, seek+nbytes) of the binary file open on fd.
+	//Contiguous records make a single run, copied in one go before other binary data is written [see flushCopy]
+	void copyRecord(uint32_t type, int fd, uint64_t seek, uint32_t nbytes) {
+		if (copy_size && (fd != copy_src || seek < copy_seek + copy_size || seek - copy_seek - copy_size >= BIN_ALIGNMENT)) flushCopy();
+		if (!copy_size) {
+			pad();
+			copy_src = fd;
+			copy_seek = seek;
+			copy_out = bin_seek;
+		}
+		copy_size = seek + nbytes - copy_seek;
+		bin_seek = copy_out + copy_size;
+		vsk[0] = type;
+		vsk[1] = (copy_out + seek - copy_seek) / MOD30BITS;
+		vsk[2] = (copy_out + seek - copy_seek) % MOD30BITS;
+		vsk[3] = nbytes;
+		bin_type_count[type] ++;
+		bin_type_bytes[type] += nbytes;
+		bcf_update_info_int32(hts_hdr, hts_record, "SEEK", vsk, 4);
+		writeRecord(hts_record);
+	}
+
+	//Copy the current run of records in the binary file, behind the data buffered in bin_fds
+	void flushCopy() {
+		if (copy_fd < 0) {
+			std::string bfname = helper_tools::get_name_from_vcf(hts_fname) + ".bin";
+			copy_fd = ::open(bfname.c_str(), O_WRONLY);
+			if (copy_fd < 0) helper_tools::error("Cannot open file [" + bfname + "] for copying records");
+		}
+		bin_fds.flush();
+		helper_tools::copyRange(copy_src, copy_seek, copy_fd, copy_out, copy_size);
+		bin_fds.seekp(copy_out + copy_size);
+		copy_size = 0;
+	}
+
+	//Zero padding of the binary file up to the next record boundary
+	void pad() {
+		if (copy_size) flushCopy();
+		if (!bin_align || !(bin_seek % bin_align)) return;
+		static const char zeros[BIN_ALIGNMENT] = {0};
+		uint32_t npad = bin_align - bin_seek % bin_align;
+		bin_fds.write(zeros, npad);
+		bin_seek += npad;
+	}
+
 	//Write only info field (empty genotypes)
 	void writeRecord() {
 		writeRecord(hts_record);
 	}
 
 	void writeRecord(bcf1_t* rec) {
-			if (bcf_write1(hts_fd, hts_hdr, rec) < 0) helper_tools::error("Failing to write VCF/record for rare variants");
+			if (stream) stream_fd.writeSite(rec);
+			else if (bcf_write1(hts_fd, hts_hdr, rec) < 0) helper_tools::error("Failing to write VCF/record for rare variants");
 			bcf_clear1(hts_record);
 		}
 
+	//Add the ploidy of each sample to the PED file, as a 5th column [population being the 4th]; streams get a new FAM frame
+	void writePloidy() {
+		std::string ffname = stream ? hts_fname : (helper_tools::get_name_from_vcf(hts_fname) + ".fam");
+		std::vector < std::string > lines, tokens;
+		std::string buffer;
+		std::stringstream fdi;
+		if (stream) fdi << stream_fam;
+		else { std::ifstream fdf (ffname); fdi << fdf.rdbuf(); }
+		while (getline(fdi, buffer)) lines.push_back(buffer);
+		if (lines.size() != ind_ploidy.size()) helper_tools::error("Ploidy of [" + std::to_string(ind_ploidy.size()) + "] samples for [" + std::to_string(lines.size()) + "] samples in [" + ffname + "]");
+		std::ostringstream fdo;
+		for (uint32_t i = 0 ; i < lines.size() ; i++) {
+			helper_tools::split(lines[i], tokens);
+			tokens.resize(4, "NA");
+			fdo << tokens[0] << "\t" << tokens[1] << "\t" << tokens[2] << "\t" << tokens[3] << "\t" << (int)ind_ploidy[i] << std::endl;
+		}
+		stream_ploidy = true;
+		writePedigree(fdo.str());
+	}
+
 	void close()
 	{
-		if (!hts_fidx.empty()) if (bcf_idx_save(hts_fd)) helper_tools::error("Writing .csi index");
+		//Aligned binary files end on a boundary, so that they remain aligned once concatenated
+		if (bin_fds.is_open() || stream) pad();
+		if ((bin_fds.is_open() || (stream && !stream_ploidy)) && !ind_ploidy.empty()) writePloidy();
+		for (uint32_t g = 0 ; g < shard_fds.size() ; g ++) shard_fds[g].close();
+		if (copy_fd >= 0) ::close(copy_fd);
+		if (!hts_fidx.empty() && !hts_text) if (bcf_idx_save(hts_fd)) helper_tools::error("Writing .csi index");
 
 		free(vsk);
+		free(stream_line.s);
 		bcf_destroy1(hts_record);
 		bcf_hdr_destroy(hts_hdr);
-		if (hts_close(hts_fd)) helper_tools::error("Non zero status when closing [" + hts_fname + "]");
+		if (stream) stream_fd.close();
+		else if (hts_close(hts_fd)) helper_tools::error("Non zero status when closing [" + hts_fname + "]");
+		if (!hts_fidx.empty() && hts_text) if (bcf_index_build3(hts_fname.c_str(), hts_fidx.c_str(), 14, nthreads)) helper_tools::error("Writing .csi index");
 	}
 };
 
@@ -0,0 +1,492 @@
+/*******************************************************************************
+ * Copyright (C) 2022-2023 Olivier Delaneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#ifndef _XCF_STREAM_H
+#define _XCF_STREAM_H
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <streambuf>
+#include <fstream>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "otools.h"
+
+/*****************************************************************************/
+/*****************************************************************************/
+/******						XCF_STREAM									******/
+/*****************************************************************************/
+/*****************************************************************************/
+
+// Streamable XCF container [.xcfs, or - for stdin/stdout]: the .bcf/.bin/.fam
+// triplet of a XCF file interleaved in a single byte stream, so that XCF files
+// can go through pipes. Frames are [uint8 kind][uint64 length][length bytes]:
+//  - FRAME_HEADER  : text of the sites-only header, as formatted in BCF files
+//  - FRAME_FAM     : content of the .fam file; sent again with the ploidy column
+//                    ahead of the first haploid record [the last one wins]
+//  - FRAME_PAYLOAD : bytes appended to the .bin file, padding included, so that
+//                    INFO/SEEK locations are those of the .bin file
+//  - FRAME_SITE    : one record of the sites-only file, as stored in BCF files
+//                    [fixed fields, shared and indiv blocks; see xcf_stream_site]
+//  - FRAME_END     : end of the stream
+// Payloads always come before the site pointing to them.
+//
+// Layout:
+// [magic][HEADER][FAM] ([PAYLOAD][SITE])* [FAM] [PAYLOAD] [END]
+
+#define XCF_STREAM_MAGIC		"XCFSTRM1"
+#define XCF_STREAM_MAGIC_LEN	8
+#define XCF_STREAM_CHUNK		(1U << 20)		//Size of reads on the input stream
+#define XCF_STREAM_SITE		32				//Size of the fixed fields of a BCF record
+
+#define FRAME_END		0
+#define FRAME_HEADER	1
+#define FRAME_FAM		2
+#define FRAME_PAYLOAD	3
+#define FRAME_SITE		4
+
+namespace helper_tools
+{
+	inline bool isStreamName(const std::string & fname) {
+		return fname.size() > 5 && fname.substr(fname.size() - 5) == ".xcfs";
+	}
+
+	//Write n bytes on a file descriptor; false when the other end of a pipe is closed
+	inline bool writeFd(int fd, const char * data, uint64_t n) {
+		while (n) {
+			ssize_t w = ::write(fd, data, n);
+			if (w < 0 && errno == EINTR) continue;
+			if (w < 0 && errno == EPIPE) return false;
+			if (w < 0) vrb.error("Failing to write on file descriptor [" + std::to_string(fd) + "]");
+			data += w;
+			n -= w;
+		}
+		return true;
+	}
+}
+
+//Packing of sites in FRAME_SITE frames, in the layout of BCF records so that they go through streams as they are
+namespace xcf_stream_site
+{
+	//Write the fixed fields of rec, packed by a copy into site
+	inline void pack(bcf1_t * rec, bcf1_t * site, uint32_t * fixed) {
+		bcf_copy(site, rec);
+		fixed[0] = site->shared.l + XCF_STREAM_SITE - 2 * sizeof(uint32_t);
+		fixed[1] = site->indiv.l;
+		fixed[2] = site->rid;
+		fixed[3] = site->pos;
+		fixed[4] = site->rlen;
+		memcpy(fixed + 5, &site->qual, sizeof(float));
+		fixed[6] = (uint32_t)site->n_allele << 16 | site->n_info;
+		fixed[7] = (uint32_t)site->n_fmt << 24 | site->n_sample;
+	}
+
+	//Read a FRAME_SITE frame into rec; false when the frame is not a BCF record
+	inline bool unpack(const std::string & frame, bcf1_t * rec) {
+		uint32_t fixed [XCF_STREAM_SITE / sizeof(uint32_t)];
+		if (frame.size() < XCF_STREAM_SITE) return false;
+		memcpy(fixed, frame.data(), XCF_STREAM_SITE);
+		if (fixed[0] < XCF_STREAM_SITE - 2 * sizeof(uint32_t)) return false;
+		uint64_t nshared = fixed[0] - (XCF_STREAM_SITE - 2 * sizeof(uint32_t));
+		if (XCF_STREAM_SITE + nshared + fixed[1] != frame.size()) return false;
+		bcf_clear(rec);
+		rec->rid = fixed[2];
+		rec->pos = fixed[3];
+		rec->rlen = fixed[4];
+		memcpy(&rec->qual, fixed + 5, sizeof(float));
+		rec->n_info = fixed[6] & 0xffff;
+		rec->n_allele = fixed[6] >> 16;
+		rec->n_fmt = fixed[7] >> 24;
+		rec->n_sample = fixed[7] & 0xffffff;
+		kputsn(frame.data() + XCF_STREAM_SITE, nshared, &rec->shared);
+		kputsn(frame.data() + XCF_STREAM_SITE + nshared, fixed[1], &rec->indiv);
+		return true;
+	}
+}
+
+//Writes a stream; bytes written through the streambuf interface are the payload of the next site
+class xcf_stream_output : public std::streambuf {
+public:
+	std::string fname;
+	FILE * fd;
+	std::vector < char > payload;				//Binary data written since the last site
+	bcf1_t * site;								//Scratch record for packing sites
+
+	xcf_stream_output() : fd(NULL), site(NULL) {
+	}
+
+	void open(std::string _fname) {
+		fname = _fname;
+		fd = (fname == "-") ? stdout : fopen(fname.c_str(), "wb");
+		if (!fd) vrb.error("Cannot open [" + fname + "] for writing");
+		write(XCF_STREAM_MAGIC, XCF_STREAM_MAGIC_LEN);
+	}
+
+	void write(const char * data, uint64_t n) {
+		if (n && fwrite(data, 1, n, fd) != n) vrb.error("Failing to write stream [" + fname + "]");
+	}
+
+	void writeFrame(uint8_t kind, const char * data, uint64_t n) {
+		write(reinterpret_cast < char * > (&kind), sizeof(uint8_t));
+		write(reinterpret_cast < char * > (&n), sizeof(uint64_t));
+		write(data, n);
+	}
+
+	void writePayload() {
+		if (payload.empty()) return;
+		writeFrame(FRAME_PAYLOAD, payload.data(), payload.size());
+		payload.clear();
+	}
+
+	//Write a site, after the binary data it points to
+	void writeSite(bcf1_t * rec) {
+		writePayload();
+		if (!site) site = bcf_init();
+		uint32_t fixed [XCF_STREAM_SITE / sizeof(uint32_t)];
+		xcf_stream_site::pack(rec, site, fixed);
+		uint8_t kind = FRAME_SITE;
+		uint64_t n = XCF_STREAM_SITE + site->shared.l + site->indiv.l;
+		write(reinterpret_cast < char * > (&kind), sizeof(uint8_t));
+		write(reinterpret_cast < char * > (&n), sizeof(uint64_t));
+		write(reinterpret_cast < char * > (fixed), XCF_STREAM_SITE);
+		write(site->shared.s, site->shared.l);
+		write(site->indiv.s, site->indiv.l);
+	}
+
+	void close() {
+		writePayload();
+		writeFrame(FRAME_END, NULL, 0);
+		if (fflush(fd)) vrb.error("Failing to write stream [" + fname + "]");
+		if (fd != stdout) fclose(fd);
+		fd = NULL;
+		if (site) bcf_destroy(site);
+		site = NULL;
+	}
+
+protected:
+	std::streamsize xsputn(const char * s, std::streamsize n) override {
+		payload.insert(payload.end(), s, s + n);
+		return n;
+	}
+
+	int_type overflow(int_type c) override {
+		if (!traits_type::eq_int_type(c, traits_type::eof())) payload.push_back(traits_type::to_char_type(c));
+		return traits_type::not_eof(c);
+	}
+};
+
+//Reads the frames of a stream
+class xcf_stream_input {
+public:
+	std::string fname;
+	int fd;
+	std::vector < char > buffer;				//Bytes read but not consumed yet, from buffer_pos onwards
+	uint64_t buffer_pos;
+	uint64_t remaining;							//Bytes left in the input [UINT64_MAX when unknown, e.g. pipes]
+
+	xcf_stream_input() : fd(-1), buffer_pos(0), remaining(UINT64_MAX) {
+	}
+
+	//Bytes of stdin read when checking for a stream, handed over to the next reader of stdin
+	static std::vector < char > & stdin_prefix() {
+		static std::vector < char > prefix;
+		return prefix;
+	}
+
+	//Check for the magic number; stdin is left untouched for the next reader
+	static bool isStream(std::string fname) {
+		if (fname != "-") {
+			std::ifstream fdi (fname, std::ios::in | std::ios::binary);
+			char magic [XCF_STREAM_MAGIC_LEN];
+			fdi.read(magic, XCF_STREAM_MAGIC_LEN);
+			return fdi.gcount() == XCF_STREAM_MAGIC_LEN && !memcmp(magic, XCF_STREAM_MAGIC, XCF_STREAM_MAGIC_LEN);
+		}
+		if (isatty(STDIN_FILENO)) return false;
+		std::vector < char > & P = stdin_prefix();
+		while (P.size() < XCF_STREAM_MAGIC_LEN) {
+			char magic [XCF_STREAM_MAGIC_LEN];
+			ssize_t r = ::read(STDIN_FILENO, magic, XCF_STREAM_MAGIC_LEN - P.size());
+			if (r < 0 && errno == EINTR) continue;
+			if (r <= 0) break;
+			P.insert(P.end(), magic, magic + r);
+		}
+		return P.size() == XCF_STREAM_MAGIC_LEN && !memcmp(P.data(), XCF_STREAM_MAGIC, XCF_STREAM_MAGIC_LEN);
+	}
+
+	void open(std::string _fname) {
+		fname = _fname;
+		buffer.clear();
+		buffer_pos = 0;
+		if (fname == "-") {
+			fd = STDIN_FILENO;
+			buffer.swap(stdin_prefix());
+		} else fd = ::open(fname.c_str(), O_RDONLY);
+		if (fd < 0) vrb.error("Cannot open [" + fname + "] for reading");
+		struct stat st;
+		off_t offset = lseek(fd, 0, SEEK_CUR);
+		remaining = (!fstat(fd, &st) && S_ISREG(st.st_mode) && offset >= 0) ? (st.st_size - offset + buffer.size()) : UINT64_MAX;
+	}
+
+	//Read n bytes; less than n only at the end of the input
+	uint64_t read(char * data, uint64_t n) {
+		uint64_t m = 0;
+		while (m < n) {
+			if (buffer_pos == buffer.size()) {
+				buffer.resize(XCF_STREAM_CHUNK);
+				ssize_t r = ::read(fd, buffer.data(), XCF_STREAM_CHUNK);
+				if (r < 0 && errno == EINTR) r = 0;
+				else if (r < 0) vrb.error("Failing to read stream [" + fname + "]");
+				else if (r == 0) { buffer.clear(); buffer_pos = 0; break; }
+				buffer.resize(r);
+				buffer_pos = 0;
+			}
+			uint64_t c = std::min(n - m, (uint64_t)(buffer.size() - buffer_pos));
+			memcpy(data + m, buffer.data() + buffer_pos, c);
+			buffer_pos += c;
+			m += c;
+		}
+		if (remaining != UINT64_MAX) remaining -= std::min(remaining, m);
+		return m;
+	}
+
+	void readMagic() {
+		char magic [XCF_STREAM_MAGIC_LEN];
+		if (read(magic, XCF_STREAM_MAGIC_LEN) != XCF_STREAM_MAGIC_LEN || memcmp(magic, XCF_STREAM_MAGIC, XCF_STREAM_MAGIC_LEN))
+			vrb.error("[" + fname + "] is not a XCF stream");
+	}
+
+	//Read the next frame; false at the end of the stream
+	//Lengths are checked against the bytes left in files; in pipes, frames grow as their bytes come in, so that a corrupted length ends as a truncated stream
+	bool readFrame(uint8_t & kind, std::string & data) {
+		uint64_t n;
+		if (read(reinterpret_cast < char * > (&kind), sizeof(uint8_t)) != sizeof(uint8_t) || read(reinterpret_cast < char * > (&n), sizeof(uint64_t)) != sizeof(uint64_t))
+			vrb.error("Truncated stream [" + fname + "]");
+		if (kind > FRAME_SITE) vrb.error("Corrupted stream [" + fname + "]: unknown frame kind [" + std::to_string(kind) + "]");
+		if (n > remaining) vrb.error("Corrupted stream [" + fname + "]: frame of [" + std::to_string(n) + "] bytes for [" + std::to_string(remaining) + "] bytes left");
+		data.clear();
+		for (uint64_t m = 0 ; m < n ; ) {
+			uint64_t c = std::min(n - m, (uint64_t)XCF_STREAM_CHUNK);
+			data.resize(m + c);
+			if (read(&data[m], c) != c) vrb.error("Truncated stream [" + fname + "]");
+			m += c;
+		}
+		return kind != FRAME_END;
+	}
+
+	//Copy the rest of the input, bytes already buffered first, to a file descriptor
+	void forward(int out) {
+		std::vector < char > chunk = std::vector < char > (XCF_STREAM_CHUNK);
+		for (uint64_t n = read(chunk.data(), chunk.size()) ; n ; n = read(chunk.data(), chunk.size()))
+			if (!helper_tools::writeFd(out, chunk.data(), n)) return;
+	}
+
+	void close() {
+		if (fd > STDIN_FILENO) ::close(fd);
+		fd = -1;
+	}
+};
+
+//Window over the .bin data of a stream, read as a file through std::istream; reads wait for the data to come in
+class xcf_stream_payload : public std::streambuf {
+public:
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::vector < char > data;					//Binary data from offset base onwards
+	uint64_t base;								//Location in the .bin file of data[0]
+	uint64_t gpos;								//Location in the .bin file of the next read
+	bool done;									//No more data to come?
+	std::string fam;							//Last FAM frame received
+	bool fam_new;								//FAM frame not picked up yet?
+
+	xcf_stream_payload() : base(0), gpos(0), done(false), fam_new(false) {
+	}
+
+	void push(const char * buffer, uint64_t n) {
+		std::lock_guard < std::mutex > lock (mtx);
+		data.insert(data.end(), buffer, buffer + n);
+		cv.notify_all();
+	}
+
+	void finish() {
+		std::lock_guard < std::mutex > lock (mtx);
+		done = true;
+		cv.notify_all();
+	}
+
+	void pushPedigree(const std::string & _fam) {
+		std::lock_guard < std::mutex > lock (mtx);
+		fam = _fam;
+		fam_new = true;
+	}
+
+	//Get the last FAM frame when not picked up yet
+	bool pullPedigree(std::string & _fam) {
+		std::lock_guard < std::mutex > lock (mtx);
+		if (!fam_new) return false;
+		_fam = fam;
+		fam_new = false;
+		return true;
+	}
+
+protected:
+	//Wait for n bytes from gpos, returns the number of bytes available [less than n at the end of the stream only]
+	std::streamsize available(std::unique_lock < std::mutex > & lock, std::streamsize n) {
+		cv.wait(lock, [&] { return done || base + data.size() >= gpos + n; });
+		if (gpos < base) vrb.error("Binary record at [" + std::to_string(gpos) + "] is gone from the stream; streams must be read in order");
+		if (base + data.size() <= gpos) return 0;
+		return std::min((uint64_t)n, base + data.size() - gpos);
+	}
+
+	std::streamsize xsgetn(char * s, std::streamsize n) override {
+		std::unique_lock < std::mutex > lock (mtx);
+		std::streamsize m = available(lock, n);
+		memcpy(s, data.data() + (gpos - base), m);
+		gpos += m;
+		//Drop the data read once it makes up most of the window
+		if (gpos - base >= XCF_STREAM_CHUNK && gpos - base >= data.size() / 2) {
+			data.erase(data.begin(), data.begin() + (gpos - base));
+			base = gpos;
+		}
+		return m;
+	}
+
+	int_type underflow() override {
+		std::unique_lock < std::mutex > lock (mtx);
+		if (!available(lock, 1)) return traits_type::eof();
+		return traits_type::to_int_type(data[gpos - base]);
+	}
+
+	int_type uflow() override {
+		int_type c = underflow();
+		if (!traits_type::eq_int_type(c, traits_type::eof())) {
+			std::lock_guard < std::mutex > lock (mtx);
+			gpos ++;
+		}
+		return c;
+	}
+
+	pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode /*which*/) override {
+		if (dir == std::ios_base::end) return pos_type(off_type(-1));
+		std::lock_guard < std::mutex > lock (mtx);
+		gpos = (dir == std::ios_base::beg) ? off : (gpos + off);
+		return pos_type(gpos);
+	}
+
+	pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+		return seekoff(off_type(pos), std::ios_base::beg, which);
+	}
+};
+
+//Splits an input stream: sites go to a pipe read by HTSlib as an uncompressed BCF file, binary data to a xcf_stream_payload
+class xcf_stream_reader {
+public:
+	xcf_stream_input input;
+	xcf_stream_payload payload;
+	std::string header;							//Text of the sites-only header
+	std::string fam;							//Content of the .fam file
+	int pipe_fds [2];
+	std::thread demux;
+
+	xcf_stream_reader() {
+		pipe_fds[0] = pipe_fds[1] = -1;
+	}
+
+	//Read the frames up to the first site, and start splitting the rest; returns the file name of the pipe to read sites from
+	std::string open(std::string fname) {
+		input.open(fname);
+		input.readMagic();
+		uint8_t kind;
+		std::string frame;
+		while (header.empty() || fam.empty()) {
+			if (!input.readFrame(kind, frame)) vrb.error("No header or sample list in stream [" + fname + "]");
+			if (kind == FRAME_HEADER) header = frame;
+			else if (kind == FRAME_FAM) fam = frame;
+			else vrb.error("Records before the header or the sample list in stream [" + fname + "]");
+		}
+		if (pipe(pipe_fds)) vrb.error("Cannot create pipe for stream [" + fname + "]");
+		demux = std::thread(&xcf_stream_reader::run, this);
+		return "/dev/fd/" + std::to_string(pipe_fds[0]);
+	}
+
+	//Pass the input through a pipe as it is [stdin already read when checking for a stream]
+	std::string openForward(std::string fname) {
+		input.open(fname);
+		if (pipe(pipe_fds)) vrb.error("Cannot create pipe for [" + fname + "]");
+		demux = std::thread(&xcf_stream_reader::runForward, this);
+		return "/dev/fd/" + std::to_string(pipe_fds[0]);
+	}
+
+	//A closed pipe stops the thread writing in it, instead of the program
+	static void ignorePipeSignal() {
+		sigset_t mask;
+		sigemptyset(&mask);
+		sigaddset(&mask, SIGPIPE);
+		pthread_sigmask(SIG_BLOCK, &mask, NULL);
+	}
+
+	void runForward() {
+		ignorePipeSignal();
+		input.forward(pipe_fds[1]);
+		::close(pipe_fds[1]);
+	}
+
+	void run() {
+		ignorePipeSignal();
+		uint8_t kind;
+		std::string frame;
+		uint32_t hlen = header.size() + 1;
+		bool reading = helper_tools::writeFd(pipe_fds[1], "BCF\2\2", 5) && helper_tools::writeFd(pipe_fds[1], reinterpret_cast < char * > (&hlen), sizeof(uint32_t)) && helper_tools::writeFd(pipe_fds[1], header.c_str(), hlen);
+		while (reading && input.readFrame(kind, frame)) {
+			switch (kind) {
+			case FRAME_PAYLOAD: payload.push(frame.data(), frame.size()); break;
+			case FRAME_SITE: reading = helper_tools::writeFd(pipe_fds[1], frame.data(), frame.size()); break;
+			case FRAME_FAM: payload.pushPedigree(frame); break;
+			}
+		}
+		::close(pipe_fds[1]);
+		payload.finish();
+	}
+
+	//Close our end of the pipe once HTSlib opened it, so that the splitting stops when HTSlib closes it
+	void detach() {
+		::close(pipe_fds[0]);
+		pipe_fds[0] = -1;
+	}
+
+	void close() {
+		if (pipe_fds[0] >= 0) detach();
+		if (demux.joinable()) demux.join();
+		input.close();
+	}
+};
+
+#endif
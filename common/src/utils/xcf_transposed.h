@@ -0,0 +1,245 @@
+/*******************************************************************************
+ * Copyright (C) 2022-2023 Olivier Delaneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#ifndef _XCF_TRANSPOSED_H
+#define _XCF_TRANSPOSED_H
+
+#include "xcf.h"
+
+/*****************************************************************************/
+/*****************************************************************************/
+/******						XCF_TRANSPOSED								******/
+/*****************************************************************************/
+/*****************************************************************************/
+
+// Sample-major companion of a XCF file [.tbin].
+// Variants are cut in blocks of B variants. Within a block, each sample owns a
+// chunk of 2 x ceil(B/8) bytes: the bits of its first haplotype, then of its
+// second one, for all variants of the block [MSB first, as in bitvector].
+// Reading a sample over a region thus costs one chunk per overlapping block.
+// Variants coded as genotypes [unphased or with missing data] follow the
+// binary genotype convention: hets as 01 and missing as 10.
+//
+// Layout:
+// [magic][version][#samples][B]
+// [block 0: sample 0 chunk, sample 1 chunk, ...][block 1] ...
+// [footer: #variants, #blocks, #contigs, #samples, contig names, sample names,
+//          per variant (contig, position, genotype flag)]
+// [footer offset][magic]
+
+#define XCF_TRANSPOSED_MAGIC	0x54464358			//"XCFT"
+#define XCF_TRANSPOSED_VERSION	1
+
+namespace helper_tools
+{
+	inline void writeString(std::ofstream & fd, const std::string & s) {
+		uint32_t n = s.size();
+		fd.write(reinterpret_cast< char * > (&n), sizeof(uint32_t));
+		fd.write(s.c_str(), n);
+	}
+
+	inline void readString(std::ifstream & fd, std::string & s) {
+		uint32_t n;
+		fd.read(reinterpret_cast< char * > (&n), sizeof(uint32_t));
+		s.resize(n);
+		fd.read(&s[0], n);
+	}
+}
+
+class xcf_transposed_writer {
+public:
+	std::string fname;
+	std::ofstream fd;
+	uint32_t nsamples;
+	uint32_t block_size;						//Number of variants per block
+	uint32_t half_size;							//Number of bytes per haplotype and block
+	uint32_t block_nvariants;					//Number of variants in the current block
+	std::vector < char > block;					//Current block [nsamples x 2 x half_size bytes]
+
+	std::vector < std::string > contigs;
+	std::vector < std::string > samples;
+	std::vector < uint32_t > variant_contig;
+	std::vector < uint32_t > variant_pos;
+	std::vector < uint8_t > variant_genotype;
+
+	xcf_transposed_writer(std::string _fname, std::vector < std::string > & _samples, uint32_t _block_size) {
+		fname = _fname;
+		samples = _samples;
+		nsamples = samples.size();
+		block_size = _block_size;
+		half_size = DIVU(block_size, 8);
+		block_nvariants = 0;
+		block = std::vector < char > (2UL * nsamples * half_size, 0);
+		fd.open(fname.c_str(), std::ios::out | std::ios::binary);
+		if (!fd) helper_tools::error("Cannot open file [" + fname + "] for writing");
+		uint32_t header [4] = { XCF_TRANSPOSED_MAGIC, XCF_TRANSPOSED_VERSION, nsamples, block_size };
+		fd.write(reinterpret_cast< char * > (header), 4 * sizeof(uint32_t));
+	}
+
+	//Set the alleles of a sample at the current variant [bits are cleared at each new block]
+	void set(uint32_t sample, bool a0, bool a1) {
+		char * chunk = block.data() + 2UL * sample * half_size;
+		char mask = 1 << (7 - block_nvariants % 8);
+		if (a0) chunk[block_nvariants / 8] |= mask;
+		if (a1) chunk[half_size + block_nvariants / 8] |= mask;
+	}
+
+	//Move on to next variant once the alleles of all samples are set
+	void next(std::string & chr, uint32_t pos, bool genotype) {
+		if (contigs.empty() || contigs.back() != chr) contigs.push_back(chr);
+		variant_contig.push_back(contigs.size() - 1);
+		variant_pos.push_back(pos);
+		variant_genotype.push_back(genotype);
+		if (++block_nvariants == block_size) flush();
+	}
+
+	void flush() {
+		if (!block_nvariants) return;
+		fd.write(block.data(), block.size());
+		std::fill(block.begin(), block.end(), 0);
+		block_nvariants = 0;
+	}
+
+	void close() {
+		flush();
+		uint64_t footer = fd.tellp();
+		uint64_t nvariants = variant_pos.size();
+		uint32_t ncontigs = contigs.size();
+		fd.write(reinterpret_cast< char * > (&nvariants), sizeof(uint64_t));
+		fd.write(reinterpret_cast< char * > (&ncontigs), sizeof(uint32_t));
+		for (uint32_t c = 0 ; c < ncontigs ; c ++) helper_tools::writeString(fd, contigs[c]);
+		for (uint32_t i = 0 ; i < nsamples ; i ++) helper_tools::writeString(fd, samples[i]);
+		fd.write(reinterpret_cast< char * > (variant_contig.data()), nvariants * sizeof(uint32_t));
+		fd.write(reinterpret_cast< char * > (variant_pos.data()), nvariants * sizeof(uint32_t));
+		fd.write(reinterpret_cast< char * > (variant_genotype.data()), nvariants * sizeof(uint8_t));
+		uint32_t magic = XCF_TRANSPOSED_MAGIC;
+		fd.write(reinterpret_cast< char * > (&footer), sizeof(uint64_t));
+		fd.write(reinterpret_cast< char * > (&magic), sizeof(uint32_t));
+		fd.close();
+	}
+};
+
+class xcf_transposed_reader {
+public:
+	std::string fname;
+	std::ifstream fd;
+	uint32_t nsamples;
+	uint32_t block_size;
+	uint32_t half_size;
+	std::vector < char > chunk;
+
+	std::vector < std::string > contigs;
+	std::vector < std::string > samples;
+	std::vector < uint32_t > variant_contig;
+	std::vector < uint32_t > variant_pos;
+	std::vector < uint8_t > variant_genotype;
+
+	xcf_transposed_reader(std::string _fname) {
+		fname = _fname;
+		fd.open(fname.c_str(), std::ios::in | std::ios::binary);
+		if (!fd) helper_tools::error("Cannot open file [" + fname + "] for reading");
+
+		//Header
+		uint32_t header [4];
+		fd.read(reinterpret_cast< char * > (header), 4 * sizeof(uint32_t));
+		if (!fd || header[0] != XCF_TRANSPOSED_MAGIC) helper_tools::error("[" + fname + "] is not a transposed XCF file");
+		if (header[1] != XCF_TRANSPOSED_VERSION) helper_tools::error("[" + fname + "] has an unsupported version [" + std::to_string(header[1]) + "]");
+		nsamples = header[2];
+		block_size = header[3];
+		half_size = DIVU(block_size, 8);
+		chunk = std::vector < char > (2 * half_size);
+
+		//Footer
+		uint64_t footer, nvariants;
+		uint32_t magic, ncontigs;
+		fd.seekg(-(int64_t)(sizeof(uint64_t) + sizeof(uint32_t)), std::ios::end);
+		fd.read(reinterpret_cast< char * > (&footer), sizeof(uint64_t));
+		fd.read(reinterpret_cast< char * > (&magic), sizeof(uint32_t));
+		if (!fd || magic != XCF_TRANSPOSED_MAGIC) helper_tools::error("[" + fname + "] is truncated");
+		fd.seekg(footer, std::ios::beg);
+		fd.read(reinterpret_cast< char * > (&nvariants), sizeof(uint64_t));
+		fd.read(reinterpret_cast< char * > (&ncontigs), sizeof(uint32_t));
+		contigs.resize(ncontigs);
+		samples.resize(nsamples);
+		for (uint32_t c = 0 ; c < ncontigs ; c ++) helper_tools::readString(fd, contigs[c]);
+		for (uint32_t i = 0 ; i < nsamples ; i ++) helper_tools::readString(fd, samples[i]);
+		variant_contig.resize(nvariants);
+		variant_pos.resize(nvariants);
+		variant_genotype.resize(nvariants);
+		fd.read(reinterpret_cast< char * > (variant_contig.data()), nvariants * sizeof(uint32_t));
+		fd.read(reinterpret_cast< char * > (variant_pos.data()), nvariants * sizeof(uint32_t));
+		fd.read(reinterpret_cast< char * > (variant_genotype.data()), nvariants * sizeof(uint8_t));
+		if (!fd) helper_tools::error("[" + fname + "] has a corrupted footer");
+	}
+
+	~xcf_transposed_reader() {
+		fd.close();
+	}
+
+	//Index of a sample, -1 if absent
+	int32_t getSample(const std::string & name) const {
+		auto it = std::find(samples.begin(), samples.end(), name);
+		return (it == samples.end()) ? -1 : (it - samples.begin());
+	}
+
+	//Range [first, last) of variants in region chr:start-end [1-based, inclusive]
+	void getVariants(const std::string & chr, uint32_t start, uint32_t end, uint64_t & first, uint64_t & last) const {
+		first = last = 0;
+		auto it = std::find(contigs.begin(), contigs.end(), chr);
+		if (it == contigs.end()) return;
+		uint32_t c = it - contigs.begin();
+		auto cbeg = std::lower_bound(variant_contig.begin(), variant_contig.end(), c);
+		auto cend = std::upper_bound(cbeg, variant_contig.end(), c);
+		auto pbeg = variant_pos.begin() + (cbeg - variant_contig.begin());
+		auto pend = variant_pos.begin() + (cend - variant_contig.begin());
+		first = std::lower_bound(pbeg, pend, start) - variant_pos.begin();
+		last = std::upper_bound(pbeg, pend, end) - variant_pos.begin();
+	}
+
+	//Genotypes of a sample over a region, in BCF encoding [2 per variant]; only the bytes of this sample are read
+	// >=0: Number of variants in the region
+	int64_t readSample(uint32_t sample, const std::string & chr, uint32_t start, uint32_t end, std::vector < uint32_t > & positions, std::vector < int32_t > & genotypes) {
+		if (sample >= nsamples) helper_tools::error("Sample index [" + std::to_string(sample) + "] out of range in [" + fname + "]");
+		uint64_t first, last;
+		getVariants(chr, start, end, first, last);
+		positions.assign(variant_pos.begin() + first, variant_pos.begin() + last);
+		genotypes.resize(2 * (last - first));
+		for (uint64_t b = first / block_size ; first < last && b <= (last - 1) / block_size ; b ++) {
+			uint64_t offset = 4 * sizeof(uint32_t) + b * 2UL * nsamples * half_size + 2UL * sample * half_size;
+			fd.seekg(offset, std::ios::beg);
+			fd.read(chunk.data(), chunk.size());
+			uint64_t vbeg = std::max(first, b * block_size), vend = std::min(last, (b + 1) * block_size);
+			for (uint64_t v = vbeg ; v < vend ; v ++) {
+				uint32_t idx = v - b * block_size;
+				bool a0 = (chunk[idx / 8] >> (7 - idx % 8)) & 1;
+				bool a1 = (chunk[half_size + idx / 8] >> (7 - idx % 8)) & 1;
+				int32_t * gt = genotypes.data() + 2 * (v - first);
+				if (!variant_genotype[v]) { gt[0] = bcf_gt_phased(a0); gt[1] = bcf_gt_phased(a1); }
+				else if (a0 && !a1) { gt[0] = gt[1] = bcf_gt_missing; }
+				else { gt[0] = bcf_gt_unphased(a0); gt[1] = bcf_gt_unphased(a1); }
+			}
+		}
+		return last - first;
+	}
+};
+
+#endif
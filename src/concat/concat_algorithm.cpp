@@ -102,7 +102,10 @@ void concat::concat_naive()
         bcf_hdr_destroy(hdr);
         hts_close(fp);
         n_tot_sites += nsites;
-        if (vSK) offset_seek = bin_seek+vSK[3];
+        //Next records start after the whole .bin file, which may end with padding when aligned
+        std::string bin_fname = stb.remove_extension(filenames[i]) + ".bin";
+        if (std::filesystem::exists(bin_fname)) offset_seek += std::filesystem::file_size(bin_fname);
+        else if (vSK) offset_seek = bin_seek+vSK[3];
         vrb.print("\t[#ns=" + stb.str(nsites) + "]\t(" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
     }
     vrb.print("BCF writing completed");
@@ -157,6 +160,10 @@ void concat::concat_naive_check_headers(xcf_writer& XW, const std::string& fname
         htsFormat type = *hts_get_format(fp);
         hts_close(fp);
 
+        //Rows of sharded binary files cannot be offset
+        if (bcf_hdr_get_hrec(hdr, BCF_HL_GEN, "XCF_SHARDS", NULL, NULL))
+        	vrb.error("Cannot use --naive, sample sharded binary file in " + filenames[i]);
+
         if ( i==0 )
         {
             hdr0 = hdr;
@@ -292,6 +299,8 @@ void concat::concat_ligate()
 	//BIT BUFFER ALLOCATION
 	haps_bitvector.allocate(2 * nsamples);
 
+	//Output records are not sharded, whatever the layout of the input files
+	bcf_hdr_remove(out_hdr, BCF_HL_GEN, "XCF_SHARDS");
 	XW.writeHeader(out_hdr);
 	if (!std::filesystem::exists(stb.remove_extension(filenames[i]) + ".fam")) vrb.error("File does not exists: " + stb.remove_extension(filenames[i]) + "fam");
 	std::ifstream fam_ifile(stb.remove_extension(filenames[i]) + ".fam");
@@ -377,16 +386,16 @@ void concat::concat_ligate()
         		XW.writeInfo(XR.chr, XR.pos, XR.ref, XR.alt, XR.rsid, XR.getAC(), XR.getAN());
               	const bool uphalf = !XR.hasRecord(0);
         		const int32_t type = XR.typeRecord(uphalf);
-        		if (type == RECORD_BINARY_HAPLOTYPE)
+        		if (type == RECORD_BINARY_HAPLOTYPE || type == RECORD_XOR_HAPLOTYPE || type == RECORD_SHARDED_HAPLOTYPE)
         		{
         			phase_update_common(haps_bitvector, uphalf, XR);
         			XW.writeRecord(RECORD_BINARY_HAPLOTYPE, haps_bitvector.bytes, haps_bitvector.n_bytes);
         			n_lines_comm++;
         		}
-        		else if (type == RECORD_SPARSE_HAPLOTYPE)
+        		else if (type == RECORD_SPARSE_HAPLOTYPE || type == RECORD_VBYTE_HAPLOTYPE)
         		{
         			phase_update_rare(haps_sparsevector, uphalf, XR);
-        			XW.writeRecord(RECORD_SPARSE_HAPLOTYPE, reinterpret_cast<char*>(haps_sparsevector.data()), haps_sparsevector.size() * sizeof(int32_t));
+        			XW.writeSparseRecord(type, haps_sparsevector.data(), haps_sparsevector.size());
         			n_lines_rare ++;
         		}
         		else vrb.error("Unsupported record format [" + stb.str(type) + "] in position [" + stb.str(XR.pos) + "]");
@@ -424,16 +433,16 @@ void concat::concat_ligate()
 
         		XW.writeInfo(XR.chr, XR.pos, XR.ref, XR.alt, XR.rsid, XR.getAC(), XR.getAN());
         		const int32_t type = XR.typeRecord(i);
-        		if (type == RECORD_BINARY_HAPLOTYPE)
+        		if (type == RECORD_BINARY_HAPLOTYPE || type == RECORD_XOR_HAPLOTYPE || type == RECORD_SHARDED_HAPLOTYPE)
         		{
         			phase_update_common(haps_bitvector, i, XR);
         			XW.writeRecord(RECORD_BINARY_HAPLOTYPE, haps_bitvector.bytes, haps_bitvector.n_bytes);
         			n_lines_comm++;
         		}
-        		else if (type == RECORD_SPARSE_HAPLOTYPE)
+        		else if (type == RECORD_SPARSE_HAPLOTYPE || type == RECORD_VBYTE_HAPLOTYPE)
         		{
         			phase_update_rare(haps_sparsevector, i, XR);
-        			XW.writeRecord(RECORD_SPARSE_HAPLOTYPE, reinterpret_cast<char*>(haps_sparsevector.data()), haps_sparsevector.size() * sizeof(int32_t));
+        			XW.writeSparseRecord(type, haps_sparsevector.data(), haps_sparsevector.size());
         			n_lines_rare ++;
         		}
         		else vrb.error("Unsupported record format [" + stb.str(type) + "] in position [" + stb.str(XR.pos) + "]");
@@ -454,16 +463,16 @@ void concat::concat_ligate()
         		XW.writeInfo(XR.chr, XR.pos, XR.ref, XR.alt, XR.rsid, XR.getAC(), XR.getAN());//this should not be disruptive in the INFO
 				const bool uphalf = n_sites_buff >= nsites_buff_d2.back();
         		const int32_t type = XR.typeRecord(uphalf);
-        		if (type == RECORD_BINARY_HAPLOTYPE)
+        		if (type == RECORD_BINARY_HAPLOTYPE || type == RECORD_XOR_HAPLOTYPE || type == RECORD_SHARDED_HAPLOTYPE)
         		{
         			phase_update_common(haps_bitvector, uphalf, XR);
         			XW.writeRecord(RECORD_BINARY_HAPLOTYPE, haps_bitvector.bytes, haps_bitvector.n_bytes);
         			n_lines_comm++;
         		}
-        		else if (type == RECORD_SPARSE_HAPLOTYPE)
+        		else if (type == RECORD_SPARSE_HAPLOTYPE || type == RECORD_VBYTE_HAPLOTYPE)
         		{
         			phase_update_rare(haps_sparsevector, uphalf, XR);
-        			XW.writeRecord(RECORD_SPARSE_HAPLOTYPE, reinterpret_cast<char*>(haps_sparsevector.data()), haps_sparsevector.size() * sizeof(int32_t));
+        			XW.writeSparseRecord(type, haps_sparsevector.data(), haps_sparsevector.size());
         			n_lines_rare ++;
         		}
         		else vrb.error("Unsupported record format [" + stb.str(type) + "] in position [" + stb.str(XR.pos) + "]");
@@ -488,7 +497,7 @@ void concat::concat_ligate()
 
 void concat::phase_update_common(bitvector& h_bitvector, const bool uphalf, xcf_reader& XR)
 {
-	XR.readRecord(uphalf, reinterpret_cast< char* > (h_bitvector.bytes));
+	XR.readBinaryRecord(uphalf, reinterpret_cast< char* > (h_bitvector.bytes));
     for (int i=0; i<nsamples; i++)
     {
     	if (h_bitvector.get(i*2)==h_bitvector.get(i*2+1) ) continue;
@@ -500,8 +509,8 @@ void concat::phase_update_common(bitvector& h_bitvector, const bool uphalf, xcf_
 
 void concat::phase_update_rare(std::vector<int32_t>& h_sparsevector, const bool uphalf, xcf_reader& XR)
 {
-	h_sparsevector.resize(XR.bin_size[uphalf]/ sizeof(int32_t));
-	XR.readRecord(uphalf, reinterpret_cast< char* > (h_sparsevector.data()));
+	h_sparsevector.resize(XR.bin_size[uphalf]);
+	h_sparsevector.resize(XR.readSparseRecord(uphalf, h_sparsevector.data()));
     for (int i=0; i<h_sparsevector.size(); i++)
     {
 		if ( swap_phase[uphalf][h_sparsevector[i]/2] )
@@ -509,6 +518,8 @@ void concat::phase_update_rare(std::vector<int32_t>& h_sparsevector, const bool
 			h_sparsevector[i] % 2 == 0 ? h_sparsevector[i]++ : h_sparsevector[i]--;
 		}
     }
+    //Swaps can break the ordering within a sample; delta coding needs it sorted
+    std::sort(h_sparsevector.begin(), h_sparsevector.end());
 }
 
 void concat::update_distances_common(bitvector& a, bitvector& b)
@@ -595,24 +606,25 @@ void concat::scan_overlap(const int ifname, const char * seek_chr, int seek_pos)
 			continue;
 		}
 
-		const int32_t atype = XR.typeRecord(0);
-		const int32_t btype = XR.typeRecord(1);
+		//XOR coded and sharded haplotypes are dense haplotypes once decoded
+		const int32_t atype = (XR.typeRecord(0) == RECORD_XOR_HAPLOTYPE || XR.typeRecord(0) == RECORD_SHARDED_HAPLOTYPE) ? RECORD_BINARY_HAPLOTYPE : XR.typeRecord(0);
+		const int32_t btype = (XR.typeRecord(1) == RECORD_XOR_HAPLOTYPE || XR.typeRecord(1) == RECORD_SHARDED_HAPLOTYPE) ? RECORD_BINARY_HAPLOTYPE : XR.typeRecord(1);
 		if (atype != btype)
 			vrb.error("Different encoding of the same variant between different files. Ligation between different encodings is not supported.");
 		// ... in binary haplotype format
 		if (atype == RECORD_BINARY_HAPLOTYPE)
 		{
-			XR.readRecord(0, reinterpret_cast< char* > (abit_v.bytes));
-			XR.readRecord(1, reinterpret_cast< char* > (bbit_v.bytes));
+			XR.readBinaryRecord(0, reinterpret_cast< char* > (abit_v.bytes));
+			XR.readBinaryRecord(1, reinterpret_cast< char* > (bbit_v.bytes));
 			update_distances_common(abit_v,bbit_v);
 		}
 		// ... in sparse haplotype format
-		else if (atype == RECORD_SPARSE_HAPLOTYPE)
+		else if (atype == RECORD_SPARSE_HAPLOTYPE || atype == RECORD_VBYTE_HAPLOTYPE)
 		{
-			asparse_v.resize(XR.bin_size[0]/ sizeof(int32_t));
-			XR.readRecord(0, reinterpret_cast< char* > (asparse_v.data()));
-			bsparse_v.resize(XR.bin_size[1]/ sizeof(int32_t));
-			XR.readRecord(1, reinterpret_cast< char* > (bsparse_v.data()));
+			asparse_v.resize(XR.bin_size[0]);
+			asparse_v.resize(XR.readSparseRecord(0, asparse_v.data()));
+			bsparse_v.resize(XR.bin_size[1]);
+			bsparse_v.resize(XR.readSparseRecord(1, bsparse_v.data()));
 			update_distances_rare(asparse_v,bsparse_v);
 		}
 		// ... format is unsupported
@@ -82,6 +82,9 @@ void concat::check_options() {
 	if (!options.count("output"))
 		vrb.error("You must specify an output XCF file with --output");
 
+	if (!options.count("out-only-bcf") && (options["output"].as < std::string > () == "-" || helper_tools::isStreamName(options["output"].as < std::string > ())))
+		vrb.error("XCF streams are not supported, pack the output with the stream mode");
+
 	if (options.count("seed") && options["seed"].as < int > () < 0)
 		vrb.error("Random number generator needs a positive seed value");
 
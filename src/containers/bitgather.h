@@ -0,0 +1,123 @@
+/*******************************************************************************
+ * Copyright (C) 2022-2023 Olivier Delaneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#ifndef _BITGATHER_H
+#define _BITGATHER_H
+
+#include <containers/bitvector.h>
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+//Compaction of the bits of a bitvector that are kept by a fixed mask [e.g. the haplotypes of a sample subset].
+//Kept bits are extracted 64 at a time with PEXT; words are loaded big-endian so that the MSB-first bit order
+//of bitvector is preserved. Vectors are padded to BITVECTOR_ALIGNMENT, so full word loads and stores are safe.
+//The masks double as a rank/select structure, to remap single indices of sparse records in O(1).
+class bitgather {
+public:
+	std::vector < uint64_t > masks;		//Kept bits in each 64-bit word of the input
+	std::vector < uint8_t > counts;		//Number of kept bits in each word
+	std::vector < uint32_t > ranks;		//Number of kept bits before each word
+	uint64_t n_kept;
+
+	bitgather() : n_kept(0) {
+	}
+
+	//Bit indices to keep, sorted, out of n_elements input bits
+	void set(const std::vector < uint32_t > & kept, uint64_t n_elements) {
+		masks = std::vector < uint64_t > (DIVU(n_elements, 64), 0);
+		counts = std::vector < uint8_t > (masks.size(), 0);
+		for (uint32_t i = 0 ; i < kept.size() ; i ++) {
+			masks[kept[i] / 64] |= 1ULL << (63 - (kept[i] % 64));
+			counts[kept[i] / 64] ++;
+		}
+		ranks = std::vector < uint32_t > (masks.size(), 0);
+		for (uint64_t w = 1 ; w < masks.size() ; w ++) ranks[w] = ranks[w-1] + counts[w-1];
+		n_kept = kept.size();
+	}
+
+	//Index among the kept bits of input bit idx [-1 when not kept]
+	inline int32_t rank(uint32_t idx) const {
+		const uint64_t m = masks[idx / 64];
+		const uint32_t b = 63 - (idx % 64);
+		if (!((m >> b) & 1)) return -1;
+		return ranks[idx / 64] + __builtin_popcountll((m >> b) >> 1);
+	}
+
+	static inline uint64_t extract(uint64_t v, uint64_t m) {
+#if defined(__BMI2__)
+		return _pext_u64(v, m);
+#else
+		uint64_t r = 0;
+		for (uint64_t b = 1 ; m ; b <<= 1, m &= m - 1) if (v & m & -m) r |= b;
+		return r;
+#endif
+	}
+
+	static inline uint64_t load(const char * bytes) {
+		uint64_t v;
+		memcpy(&v, bytes, sizeof(uint64_t));
+		return __builtin_bswap64(v);
+	}
+
+	static inline void store(char * bytes, uint64_t v) {
+		v = __builtin_bswap64(v);
+		memcpy(bytes, &v, sizeof(uint64_t));
+	}
+
+	//Writes the n_kept kept bits of in at the start of out; bits past them in the last word are cleared
+	void gather(const bitvector & in, bitvector & out) const {
+		uint64_t acc = 0;
+		uint32_t nacc = 0;
+		char * o = out.bytes;
+		for (uint64_t w = 0 ; w < masks.size() ; w ++) {
+			const uint32_t k = counts[w];
+			if (!k) continue;
+			//Kept bits left aligned, appended after the nacc pending ones
+			const uint64_t a = extract(load(in.bytes + 8 * w), masks[w]) << (64 - k);
+			acc |= a >> nacc;
+			nacc += k;
+			if (nacc >= 64) {
+				store(o, acc);
+				o += 8;
+				nacc -= 64;
+				acc = nacc ? (a << (k - nacc)) : 0;
+			}
+		}
+		if (nacc) store(o, acc);
+	}
+
+	//Number of set bits in the first n_bits of a bitvector; missing genotypes [10] count as zero when genotype is set
+	static uint64_t count(const bitvector & bv, uint64_t n_bits, bool genotype) {
+		uint64_t c = 0;
+		for (uint64_t w = 0 ; w < DIVU(n_bits, 64) ; w ++) {
+			uint64_t x = load(bv.bytes + 8 * w);
+			if (w == n_bits / 64) x &= ~0ULL << (64 - (n_bits % 64));
+			c += __builtin_popcountll(x);
+			if (genotype) c -= __builtin_popcountll(x & ~(x << 1) & 0xAAAAAAAAAAAAAAAAULL);
+		}
+		return c;
+	}
+};
+
+#endif
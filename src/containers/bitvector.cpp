@@ -36,8 +36,8 @@ bitvector::bitvector() {
 bitvector::bitvector(uint32_t size) {
 	n_bytes = DIVU(size, 8);
 	n_elements = size;
-	bytes = (char*)malloc(n_bytes * sizeof(char));
-	memset(bytes, 0, n_bytes);
+	bytes = (char*)aligned_alloc(BITVECTOR_ALIGNMENT, DIVU(n_bytes, BITVECTOR_ALIGNMENT) * BITVECTOR_ALIGNMENT);
+	memset(bytes, 0, DIVU(n_bytes, BITVECTOR_ALIGNMENT) * BITVECTOR_ALIGNMENT);
 }
 
 bitvector::~bitvector() {
@@ -49,6 +49,6 @@ bitvector::~bitvector() {
 void bitvector::allocate(uint32_t size) {
 	n_bytes = DIVU(size, 8);
 	n_elements = size;
-	bytes = (char*)malloc(n_bytes * sizeof(char));
-	memset(bytes, 0, n_bytes);
+	bytes = (char*)aligned_alloc(BITVECTOR_ALIGNMENT, DIVU(n_bytes, BITVECTOR_ALIGNMENT) * BITVECTOR_ALIGNMENT);
+	memset(bytes, 0, DIVU(n_bytes, BITVECTOR_ALIGNMENT) * BITVECTOR_ALIGNMENT);
 }
@@ -28,6 +28,9 @@
 
 #include <utils/otools.h>
 
+//Bytes are allocated on cache line boundaries and padded to a multiple of it, so that full vector loads are safe
+#define BITVECTOR_ALIGNMENT	64
+
 class bitvector {
 public:
 	uint64_t n_bytes, n_elements;
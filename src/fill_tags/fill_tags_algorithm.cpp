@@ -44,6 +44,28 @@ void fill_tags::set_counts(const uint32_t pop, const bool a0,const bool a1)
 	}
 	++pop_counts[pop].ns;
 }
+//Haploid samples count a single allele, apart from diploid genotypes [they are taken as homozygous for Mendel errors]
+void fill_tags::set_haploid(const uint32_t pop, const bool a0)
+{
+	++pop_counts[pop].nhap[a0];
+	++pop_counts[pop].ns;
+}
+
+//Count BCF genotypes [2 per sample; second allele of haploid samples set to vector end] per population and family
+void fill_tags::count_genotypes(const int32_t * gt)
+{
+	for(uint32_t i = 0 ; i < nsamples ; i++)
+	{
+		const bool haploid = (gt[2*i+1] == bcf_int32_vector_end);
+		const bool missing = bcf_gt_is_missing(gt[2*i+0]) || (!haploid && bcf_gt_is_missing(gt[2*i+1]));
+		const bool a0 = (bcf_gt_allele(gt[2*i+0]) > 0);
+		const bool a1 = haploid ? a0 : (bcf_gt_allele(gt[2*i+1]) > 0);
+		for (auto f=0; f<samples2fam[i].size();++f)
+			fam_trio[samples2fam[i][f]].set_gt(i,missing?-1:a0+a1);
+		for (auto p=0; p<samples2pop[i].size(); ++p)
+			missing? set_missing(samples2pop[i][p]) : (haploid ? set_haploid(samples2pop[i][p], a0) : set_counts(samples2pop[i][p], a0, a1));
+	}
+}
 
 void fill_tags::run_algorithm()
 {
@@ -62,19 +84,23 @@ void fill_tags::run_algorithm()
 	vrb.title("[Fill-tags] Processing variants");
 	binary_bit_buf.allocate(2 * nsamples);
 	sparse_int_buf.resize(2 * nsamples,0);
+	dosage_float_buf.resize(nsamples);
+	gt_int_buf.resize(2 * nsamples);
 	std::vector<double> hwe_probs;
-	uint32_t n_lines = 0;
+	uint32_t n_lines = 0, n_skipped = 0;
 
 	while (XR.nextRecord())
 	{
-		parse_genotypes(XR,idx_file);
-		process_tags(XR, XW, idx_file, hwe_probs);
+		const bool parsed = parse_genotypes(XR,idx_file);
+		n_skipped += !parsed;
+		process_tags(XR, XW, idx_file, hwe_probs, parsed);
 		bcf_translate(XW.hts_hdr, XR.sync_reader->readers[idx_file].header, XR.sync_lines[idx_file]);
 	    XW.writeRecord(XR.sync_lines[idx_file]);
 
 		if (++n_lines % 100000 == 0) vrb.bullet("Number of XCF records processed: N = " + stb.str(n_lines));
 	}
 	vrb.bullet("Number of XCF variants processed: N = " + stb.str(n_lines));
+	if (n_skipped) vrb.bullet("Number of XCF variants with genotype tags left as is: N = " + stb.str(n_skipped));
 
 	finalize_tags(XR,idx_file);
 	XR.close();
@@ -103,7 +129,8 @@ void fill_tags::finalize_tags(xcf_reader& XR, const uint32_t idx_file)
 	}
 }
 
-void fill_tags::parse_genotypes(xcf_reader& XR, const uint32_t idx_file)
+//Count the genotypes of the record per population and family; returns false when the record type is not parsed
+bool fill_tags::parse_genotypes(xcf_reader& XR, const uint32_t idx_file)
 {
 	for (auto p=0; p<pop_counts.size(); ++p)
 			pop_counts[p].reset();
@@ -111,11 +138,13 @@ void fill_tags::parse_genotypes(xcf_reader& XR, const uint32_t idx_file)
 	const int32_t type = XR.typeRecord(idx_file);
 
 	//Convert from BCF; copy the data over
-	if (type == RECORD_BCFVCF_GENOTYPE)
+	if (type == RECORD_BCFVCF_GENOTYPE) {
 		vrb.warning("VCF/BCF record type [" + stb.str(type) + "] at " + XR.chr + ":" + stb.str(XR.pos));
+		return false;
+	}
 	//Convert from binary genotypes
-	else if (type == RECORD_BINARY_GENOTYPE) {
-		const int32_t n_elements = XR.readRecord(idx_file, reinterpret_cast< char* > (&binary_bit_buf.bytes[0]));
+	else if (type == RECORD_BINARY_GENOTYPE || type == RECORD_SHARDED_GENOTYPE) {
+		const int32_t n_elements = XR.readBinaryRecord(idx_file, reinterpret_cast< char* > (&binary_bit_buf.bytes[0]));
 		for(uint32_t i = 0 ; i < nsamples ; i++)
 		{
 			const bool a0 = binary_bit_buf.get(2*i+0);
@@ -129,9 +158,9 @@ void fill_tags::parse_genotypes(xcf_reader& XR, const uint32_t idx_file)
 		}
 	}
 	//Convert from binary haplotypes
-	else if (type == RECORD_BINARY_HAPLOTYPE)
+	else if (type == RECORD_BINARY_HAPLOTYPE || type == RECORD_XOR_HAPLOTYPE || type == RECORD_SHARDED_HAPLOTYPE)
 	{
-		const int32_t n_elements = XR.readRecord(idx_file, reinterpret_cast< char* > (&binary_bit_buf.bytes[0]));
+		const int32_t n_elements = XR.readBinaryRecord(idx_file, reinterpret_cast< char* > (&binary_bit_buf.bytes[0]));
 		for(uint32_t i = 0 ; i < nsamples ; i++)
 		{
 			const bool a0 = binary_bit_buf.get(2*i+0);
@@ -143,11 +172,27 @@ void fill_tags::parse_genotypes(xcf_reader& XR, const uint32_t idx_file)
 			//no missing possible? otherwise is_half
 		}
 	}
+	//Convert from binary haplotypes with missing ones listed aside; samples with a missing haplotype are missing
+	else if (type == RECORD_MISSING_HAPLOTYPE)
+	{
+		XR.readMissingRecord(idx_file, binary_bit_buf.bytes, missing_int_buf);
+		std::vector<bool> missing_ind(nsamples, false);
+		for (auto m=0; m<missing_int_buf.size(); ++m) missing_ind[missing_int_buf[m]/2] = true;
+		for(uint32_t i = 0 ; i < nsamples ; i++)
+		{
+			const bool a0 = binary_bit_buf.get(2*i+0);
+			const bool a1 = binary_bit_buf.get(2*i+1);
+			for (auto f=0; f<samples2fam[i].size();++f)
+				fam_trio[samples2fam[i][f]].set_gt(i,missing_ind[i]?-1:a0+a1);
+			for (auto p=0; p<samples2pop[i].size(); ++p)
+				missing_ind[i]? set_missing(samples2pop[i][p]) : set_counts(samples2pop[i][p], a0, a1);
+		}
+	}
 	//Convert from sparse genotypes
-	else if (type == RECORD_SPARSE_GENOTYPE) {
-		sparse_int_buf.resize(XR.bin_size[idx_file]/ sizeof(int32_t));
-		XR.readRecord(idx_file, reinterpret_cast< char* > (sparse_int_buf.data()));
-		const bool major = (XR.getAF(idx_file)>0.5f);
+	else if (type == RECORD_SPARSE_GENOTYPE || type == RECORD_VBYTE_GENOTYPE) {
+		sparse_int_buf.resize(XR.bin_size[idx_file]);
+		sparse_int_buf.resize(XR.readSparseRecord(idx_file, sparse_int_buf.data()));
+		const bool major = (XR.getAF(idx_file)>=0.5f);
 		for (auto f=0; f<fam_trio.size();++f) fam_trio[f].reset((int8_t)major*2);
 
 		for(uint32_t r = 0 ; r < sparse_int_buf.size() ; r++)
@@ -161,12 +206,12 @@ void fill_tags::parse_genotypes(xcf_reader& XR, const uint32_t idx_file)
 		for (auto p=0; p<pop_names.size(); ++p)
 			set_sparse(p, major);
 	}
-	else if (type == RECORD_SPARSE_HAPLOTYPE)
+	else if (type == RECORD_SPARSE_HAPLOTYPE || type == RECORD_VBYTE_HAPLOTYPE)
 	{
-		sparse_int_buf.resize(XR.bin_size[idx_file]/ sizeof(int32_t));
+		sparse_int_buf.resize(XR.bin_size[idx_file]);
+		sparse_int_buf.resize(XR.readSparseRecord(idx_file, sparse_int_buf.data()));
 		if (sparse_int_buf.size()==0) vrb.error("buffer resize.");
-		XR.readRecord(idx_file, reinterpret_cast< char* > (sparse_int_buf.data()));
-		const bool major = (XR.getAF()>0.5f);
+		const bool major = (XR.getAF()>=0.5f);
 		for (auto f=0; f<fam_trio.size();++f) fam_trio[f].reset((int8_t)major*2);
 		for(uint32_t r = 0 ; r < sparse_int_buf.size() ; r++)
 		{
@@ -183,19 +228,42 @@ void fill_tags::parse_genotypes(xcf_reader& XR, const uint32_t idx_file)
 		for (auto p=0; p<pop_names.size(); ++p)
 			set_sparse(p, major);
 	}
+	//Dosages; hard calls are counted
+	else if (type == RECORD_DENSE_DOSAGE8 || type == RECORD_DENSE_DOSAGE16 || type == RECORD_SPARSE_DOSAGE)
+	{
+		dosage_char_buf.resize(XR.sizeRecord(idx_file));
+		XR.readRecord(idx_file, dosage_char_buf.data());
+		if (type == RECORD_SPARSE_DOSAGE) dosage_record::decodeSparse(dosage_char_buf.data(), nsamples, dosage_float_buf.data());
+		else dosage_record::decodeDense(dosage_char_buf.data(), nsamples, (type == RECORD_DENSE_DOSAGE8) ? 8 : 16, dosage_float_buf.data());
+		dosage_record::genotypes(dosage_float_buf.data(), nsamples, gt_int_buf.data());
+		count_genotypes(gt_int_buf.data());
+	}
+	//Haploid records; haploid samples count one allele
+	else if (type == RECORD_BINARY_HAPLOID || type == RECORD_SPARSE_HAPLOID)
+	{
+		XR.readHaploidRecord(idx_file, gt_int_buf.data());
+		count_genotypes(gt_int_buf.data());
+	}
+	//Counts are biallelic; tags of multiallelic records are left as they are
+	else if (type == RECORD_SPARSE_MULTIALLELIC) return false;
 	//Unknown record type
-	else vrb.warning("Unrecognized genotype record type [" + stb.str(type) + "] at " + XR.chr + ":" + stb.str(XR.pos));
+	else {
+		vrb.warning("Unrecognized genotype record type [" + stb.str(type) + "] at " + XR.chr + ":" + stb.str(XR.pos));
+		return false;
+	}
+	return true;
 }
 
 
-void fill_tags::process_tags(const xcf_reader& XR, xcf_writer& XW,const uint32_t idx_file, std::vector<double>& hwe_probs)
+//Update the INFO tags of the record; tags computed from genotypes are only set when parsed
+void fill_tags::process_tags(const xcf_reader& XR, xcf_writer& XW,const uint32_t idx_file, std::vector<double>& hwe_probs, const bool parsed)
 {
 	const int32_t type = XR.typeRecord(idx_file);
 	bcf1_t* rec = XR.sync_lines[idx_file];
-	const bool major = (XR.getAF(idx_file)>0.5f);
+	const bool major = (XR.getAF(idx_file)>=0.5f);
 	MendelError merr; //might not be needed, but not a big deal - at least we do not reallocate
 
-	if ( A.mTags & SET_NS )
+	if ( parsed && (A.mTags & SET_NS) )
 	{
 		for (auto p=0; p<pop_counts.size(); p++)
 		{
@@ -204,7 +272,7 @@ void fill_tags::process_tags(const xcf_reader& XR, xcf_writer& XW,const uint32_t
 	            vrb.error("Error occurred while updating INFO/" + tag_pop + " at: " + XR.chr + ":" + stb.str(XR.pos));
 		}
 	}
-	if ( A.mTags & (SET_AN | SET_AC | SET_AC_Hom | SET_AC_Het | SET_AF | SET_MAF | SET_HWE | SET_ExcHet) )
+	if ( parsed && (A.mTags & (SET_AN | SET_AC | SET_AC_Hom | SET_AC_Het | SET_AF | SET_MAF | SET_HWE | SET_ExcHet)) )
 	{
 		for (auto p=0; p<pop_counts.size(); p++)
 		{
@@ -214,10 +282,11 @@ void fill_tags::process_tags(const xcf_reader& XR, xcf_writer& XW,const uint32_t
 			const int nhom1 = pop_counts[p].nhom[1];
 			const int nhet = pop_counts[p].nhet[1];
 			const std::array<int,2> fcnt = {
-					pop_counts[p].nhet[0] + pop_counts[p].nhom[0],
-					pop_counts[p].nhet[1] + pop_counts[p].nhom[1]
+					pop_counts[p].nhet[0] + pop_counts[p].nhom[0] + pop_counts[p].nhap[0],
+					pop_counts[p].nhet[1] + pop_counts[p].nhom[1] + pop_counts[p].nhap[1]
 			};
 			const int32_t an = fcnt[0] + fcnt[1];
+			const int32_t an_dip = nref + nalt;//HWE, ExcHet and IC are computed over diploid samples only
 			std::array<float,2> farr = {0,0};
 			if ( an )
 				for (auto j=0; j<2; j++) farr[j] = static_cast<float> (fcnt[j]) / an;
@@ -264,7 +333,7 @@ void fill_tags::process_tags(const xcf_reader& XR, xcf_writer& XW,const uint32_t
 			{
 				float finbreeding_f;
 				if ( nref>0 && nalt>0 )
-					calc_inbreeding_f(an, fcnt[0], nhet, &finbreeding_f);
+					calc_inbreeding_f(an_dip, nref, nhet, &finbreeding_f);
 				else bcf_float_set_missing(finbreeding_f);
 
 				const std::string tag_pop = "IC" + (pop_names[p].empty()? "" : "_" + pop_names[p]);
@@ -294,7 +363,7 @@ void fill_tags::process_tags(const xcf_reader& XR, xcf_writer& XW,const uint32_t
 				{
 					float fhwe_chisq = 1;
 					if ( nref>0 && nalt>0 )
-						calc_hwe_chisq(an, fcnt[0], nhom0, nhom1, nhet, &fhwe_chisq);
+						calc_hwe_chisq(an_dip, nref, nhom0, nhom1, nhet, &fhwe_chisq);
 
 					const std::string tag_pop = "HWE_CHISQ" + (pop_names[p].empty()? "" : "_" + pop_names[p]);
 					if ( bcf_update_info_float(XW.hts_hdr,rec,tag_pop.c_str(),&fhwe_chisq,1)!=0 )
@@ -304,7 +373,7 @@ void fill_tags::process_tags(const xcf_reader& XR, xcf_writer& XW,const uint32_t
 		}
 	}
 
-	if (A.mTags & (SET_MENDEL))
+	if (parsed && (A.mTags & (SET_MENDEL)))
 	{
 		calc_mendel_err(merr,major);
 
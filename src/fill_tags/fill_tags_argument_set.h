@@ -2,6 +2,7 @@
 #define _FILL_TAGS_ARGUMENT_SET_H
 
 #include "../utils/otools.h"
+#include "../utils/xcf_stream.h"
 #include "../../versions/versions.h"
 
 #define SET_AN      (1<<0)
@@ -157,6 +158,9 @@ public:
     	if (!options.count("output"))
     		vrb.error("You must specify an output XCF file with --output");
 
+    	if (mInputFilename == "-" || helper_tools::isStreamName(mInputFilename) || (!options.count("out-only-bcf") && (mOutputFilename == "-" || helper_tools::isStreamName(mOutputFilename))))
+    		vrb.error("XCF streams are not supported, unpack them first with the stream mode");
+
     	if (options.count("seed") && options["seed"].as < uint32_t > () < 0)
     		vrb.error("Random number generator needs a positive seed value");
 
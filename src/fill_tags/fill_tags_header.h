@@ -28,6 +28,7 @@
 #include <utils/xcf.h>
 #include <containers/bitvector.h>
 #include <objects/sparse_genotype.h>
+#include <objects/dosage_record.h>
 
 static const int mendel_lt[27] = {
     0,  // kg=0, fg=0, mg=0
@@ -62,6 +63,7 @@ static const int mendel_lt[27] = {
 struct AlleleCount {
     std::array<int,2> nhet;
     std::array<int,2> nhom;
+    std::array<int,2> nhap;//alleles of haploid samples, kept out of HWE/ExcHet/IC
     int ns=0;
     int mis=0;
 
@@ -69,6 +71,7 @@ struct AlleleCount {
     {
     	nhet={0,0};
     	nhom={0,0};
+    	nhap={0,0};
     	ns=0;
     	mis=0;
     }
@@ -204,6 +207,10 @@ public:
 
 	bitvector binary_bit_buf;
 	std::vector<int32_t> sparse_int_buf;
+	std::vector<int32_t> missing_int_buf;
+	std::vector<char> dosage_char_buf;
+	std::vector<float> dosage_float_buf;
+	std::vector<int32_t> gt_int_buf;
 
 	//CONSTRUCTOR
 	fill_tags(std::vector < std::string > &);
@@ -221,12 +228,14 @@ public:
 	void set_sparse(const uint32_t pop, const bool major);
 	void set_missing(const uint32_t pop);
 	void set_counts(const uint32_t pop,const bool a0, const bool a1);
+	void set_haploid(const uint32_t pop, const bool a0);
+	void count_genotypes(const int32_t * gt);
 	void read_files_and_initialise();
 	void hdr_append(bcf_hdr_t* out_hdr);
 	void prepare_output(const xcf_reader& XR, xcf_writer& XW,const uint32_t idx_file);
 	void process_populations(const xcf_reader& XR, const uint32_t idx_file);
-	void parse_genotypes(xcf_reader& XR, const uint32_t idx_file);
-	void process_tags(const xcf_reader& XR, xcf_writer& XW,const uint32_t idx_file, std::vector<double>& hwe_probs);
+	bool parse_genotypes(xcf_reader& XR, const uint32_t idx_file);
+	void process_tags(const xcf_reader& XR, xcf_writer& XW,const uint32_t idx_file, std::vector<double>& hwe_probs, const bool parsed);
 	void calc_hwe(int nref, int nalt, int nhet, std::vector<double>& hwe_probs, float *p_hwe, float *p_exc_het) const;
 	void calc_hwe_chisq(const int an, const int fcnt0, const int nhom0, const int nhom1, const int nhet, float *p_chi_square_pval) const;
 	void calc_inbreeding_f(const int an, const int fcnt0, const int nhet, float *inbreeding_f) const;
@@ -92,5 +92,15 @@ void fill_tags::prepare_output(const xcf_reader& XR, xcf_writer& XW,const uint32
 		bin_ofile.close();
 		bin_ifile.close();
 		vrb.print(". Done, .bin copied successfully.");
+		//Sharded binary files hold the dense records, one per group of samples
+		for (uint32_t g = 0 ; g < XR.shard_fds[idx_file].size() ; g ++) {
+			std::ifstream shard_ifile(helper_tools::get_shard_name(A.mInputFilename, g), std::ios::in | std::ios::binary);
+			std::ofstream shard_ofile(helper_tools::get_shard_name(A.mOutputFilename, g), std::ios::out | std::ios::binary);
+			if (!shard_ifile.is_open()) vrb.error("Failed to open file: " + helper_tools::get_shard_name(A.mInputFilename, g));
+			shard_ofile << shard_ifile.rdbuf();
+			shard_ofile.close();
+			shard_ifile.close();
+		}
+		if (XR.shard_fds[idx_file].size()) vrb.bullet(stb.str(XR.shard_fds[idx_file].size()) + " sharded .bin files copied");
 	}
 }
@@ -24,6 +24,8 @@
 #include <viewer/viewer_header.h>
 #include <concat/concat_header.h>
 #include <fill_tags/fill_tags_header.h>
+#include <transpose/transpose_header.h>
+#include <stream/stream_header.h>
 
 #include "../versions/versions.h"
 
@@ -34,7 +36,7 @@ int main(int argc, char ** argv) {
 
 	string mode = (argc>1)?string(argv[1]):"";
 
-	if (argc == 1 || (mode != "view" && mode != "concat" && mode != "fill-tags")) {
+	if (argc == 1 || (mode != "view" && mode != "concat" && mode != "fill-tags" && mode != "transpose" && mode != "stream")) {
 
 		vrb.title("[XCFtools] Manage XCF files");
 		vrb.bullet("Authors       : Olivier DELANEAU and Simone RUBINACCI");
@@ -47,6 +49,8 @@ int main(int argc, char ** argv) {
 		vrb.bullet("[view]\t| Converts between XCF and BCF files");
 		vrb.bullet("[concat]\t| Concat multiple XCF files together");
 		vrb.bullet("[fill-tags]\t| Set INFO tags AF, AC, AC_Hom, AC_Het, AN, ExcHet, HWE, MAF, NS. [Note: AC_Hemi, FORMAT tag VAF, custom INFO/TAG=func(FMT/TAG) not supported]");
+		vrb.bullet("[transpose]\t| Builds a sample-major companion store of a XCF file for per-sample queries");
+		vrb.bullet("[stream]\t| Packs a XCF file into a single stream for pipes, and unpacks it back");
 
 	} else {
 		//Get args
@@ -64,6 +68,12 @@ int main(int argc, char ** argv) {
 		else if (mode == "fill-tags") {
 			fill_tags(args).run();
 		}
+		else if (mode == "transpose") {
+			transpose().transposing(args);
+		}
+		else if (mode == "stream") {
+			streamer().streaming(args);
+		}
 	}
 	return 0;
 }
@@ -25,8 +25,17 @@
 #include <modes/bcf2binary.h>
 #include <utils/xcf.h>
 
+#include <utils/vcf_text.h>
+
 #include <containers/bitvector.h>
 #include <objects/sparse_genotype.h>
+#include <objects/sparse_multiallelic.h>
+#include <objects/dosage_record.h>
+
+#include <thread>
+#include <atomic>
+
+#include <htslib/kseq.h>
 
 using namespace std;
 
@@ -36,6 +45,13 @@ bcf2binary::bcf2binary(string _region, float _minmaf, int _nthreads, int _mode,
 	region = _region;
 	minmaf = _minmaf;
 	drop_info = _drop_info;
+	compress_sparse = false;
+	adaptive = false;
+	align = false;
+	xor_keyframe = 0;
+	shard_size = 0;
+	dosage_bits = 16;
+	dosage_eps = 1e-3f;
 }
 
 bcf2binary::~bcf2binary() {
@@ -50,141 +66,529 @@ void bcf2binary::convert(string finput, string foutput) {
 		case CONV_BCF_BH: vrb.title("Converting from BCF to XCF [Binary/Haplotype]"); break;
 		case CONV_BCF_SG: vrb.title("Converting from BCF to XCF [Sparse/Genotype]"); break;
 		case CONV_BCF_SH: vrb.title("Converting from BCF to XCF [Sparse/Haplotype]"); break;
+		case CONV_BCF_BD: vrb.title("Converting from BCF to XCF [Binary/Dosage]"); break;
+		case CONV_BCF_SD: vrb.title("Converting from BCF to XCF [Sparse/Dosage]"); break;
 	}
 
 	if (region.empty()) vrb.bullet("Region        : All");
-	else vrb.bullet("Region        : " + stb.str(region));
-
-	if (mode == CONV_BCF_SG || mode == CONV_BCF_SH) vrb.bullet("Min MAF       : " + stb.str(minmaf));
+	else vrb.bullet("Region        : " + helper_tools::regionName(region));
+
+	const bool sparse_mode = (mode == CONV_BCF_SG || mode == CONV_BCF_SH);
+	if (sparse_mode && adaptive) vrb.bullet("Encoding      : Smallest per variant");
+	else if (sparse_mode) vrb.bullet("Min MAF       : " + stb.str(minmaf));
+	if (compress_sparse && sparse_mode && !adaptive) vrb.bullet("Sparse coding : Delta + Stream-VByte");
+	const bool dosage_mode = (mode == CONV_BCF_BD || mode == CONV_BCF_SD);
+	if (mode == CONV_BCF_BD) vrb.bullet("Dosage bits   : " + stb.str(dosage_bits));
+	if (mode == CONV_BCF_SD) vrb.bullet("Dosage eps    : " + stb.str(dosage_eps));
+	if (align) vrb.bullet("Alignment     : " + stb.str(BIN_ALIGNMENT) + " bytes");
+	if (xor_keyframe && (mode == CONV_BCF_BH || mode == CONV_BCF_SH)) vrb.bullet("XOR coding    : Keyframe every " + stb.str(xor_keyframe) + " records");
+	if (shard_size && !dosage_mode) vrb.bullet("Sharding      : Groups of " + stb.str(shard_size) + " samples");
+
+	//VCF text files are parsed directly when only GT is needed [sites without INFO, no region]
+	htsFile * vcf_fp = NULL;
+	bcf_hdr_t * vcf_hdr = NULL;
+	if (drop_info && !dosage_mode && region.empty() && finput != "-") {
+		vcf_fp = hts_open(finput.c_str(), "r");
+		if (!vcf_fp) vrb.error("Impossible to open [" + finput + "]");
+		if (hts_get_format(vcf_fp)->format == vcf && (vcf_hdr = bcf_hdr_read(vcf_fp))) {
+			if (nthreads > 1) hts_set_threads(vcf_fp, nthreads);
+			vrb.bullet("Parser        : VCF text [FORMAT/GT only]");
+		} else {
+			hts_close(vcf_fp);
+			vcf_fp = NULL;
+		}
+	}
 
-	//Opening XCF reader for input
+	//Opening XCF reader for input [multiallelic dosages are not supported; such records are dropped in read]
 	xcf_reader XR(region, nthreads);
-	int32_t idx_file = (finput == "-")? XR.addFile() : XR.addFile(finput);
-
-	//Check file type
-	int32_t type = XR.typeFile(idx_file);
-	if (type != FILE_BCF) vrb.error("[" + finput + "] is not a BCF file");
-
-	//Get sample IDs
+	XR.multi = true;
 	vector < string > samples;
-	int32_t nsamples = XR.getSamples(idx_file, samples);
+	if (vcf_fp) {
+		for (int32_t i = 0 ; i < bcf_hdr_nsamples(vcf_hdr) ; i ++) samples.push_back(vcf_hdr->samples[i]);
+		nsamples = samples.size();
+		if (!nsamples) vrb.error("[" + finput + "] has no sample data");
+	} else {
+		int32_t idx_file = (finput == "-")? XR.addFile() : XR.addFile(finput);
+
+		//Check file type
+		int32_t type = XR.typeFile(idx_file);
+		if (type != FILE_BCF) vrb.error("[" + finput + "] is not a BCF file");
+
+		//Get sample IDs
+		nsamples = XR.getSamples(idx_file, samples);
+	}
 	vrb.bullet("#samples = " + stb.str(nsamples));
+	bcf_hdr_t * hdr = vcf_fp ? vcf_hdr : XR.sync_reader->readers[0].header;
 
 	//Opening XCF writer for output [false means NO records in BCF body but in external BIN file]
 	xcf_writer XW(foutput, false, nthreads);
+	XW.hts_dosages = dosage_mode;
+	XW.bin_align = align ? BIN_ALIGNMENT : 0;
+	XW.xor_keyframe = xor_keyframe;
+	XW.shard_size = shard_size;
 	bcf1_t* rec = XW.hts_record;
 
 	//Write header
-	if (drop_info) XW.writeHeader(XR.sync_reader->readers[0].header, samples, string("XCFtools ") + string(XCFTLS_VERSION));
-	else XW.writeHeaderClone(XR.sync_reader->readers[0].header,samples, string("XCFtools ") + string(XCFTLS_VERSION));
+	if (drop_info) XW.writeHeader(hdr, samples, string("XCFtools ") + string(XCFTLS_VERSION));
+	else XW.writeHeaderClone(hdr, samples, string("XCFtools ") + string(XCFTLS_VERSION));
 	//XW.writeHeader(XR.sync_reader->readers[0].header, samples, string("XCFtools ") + string(XCFTLS_VERSION));
 
-	//Allocate input/output buffer
-	int32_t * input_buffer = (int32_t*)malloc(2 * nsamples * sizeof(int32_t));
-	int32_t * output_buffer = (int32_t*)malloc(2 * nsamples * sizeof(int32_t));
-
-	//Allocate output bitvector for common variants
-	bitvector binary_buffer = bitvector (2 * nsamples);
+	//Batches of records; a single record when not multi-threaded
+	uint32_t record_bytes = 2 * nsamples * (sizeof(int32_t) + sizeof(int32_t)) + sizeof(bcf2binary_record);
+	uint32_t batch_size = (nthreads > 1) ? max((uint32_t)nthreads, min(1024U, BCF2BINARY_BATCH_BYTES / record_bytes)) : 1;
+	if (nthreads > 1) vrb.bullet("Pipeline      : " + stb.str(nthreads) + " encoding threads / batches of " + stb.str(batch_size) + " records");
+
+	//Allocate input buffers
+	input_buffer = (int32_t*)malloc(2 * nsamples * sizeof(int32_t));
+	n_input_buffer = 2 * nsamples;
+	dosage_buffer = NULL;
+	n_dosage_buffer = 0;
+	n_lines_dropped = 0;
+	ploidy_mask.clear();
+	text_line = { 0, 0, NULL };
+
+	//Three batches in flight: one being read, one being encoded, one being written
+	vector < vector < bcf2binary_record > > batches = vector < vector < bcf2binary_record > > (3);
+	vector < uint32_t > batch_count = vector < uint32_t > (3, 0);
+	for (uint32_t b = 0 ; b < 3 ; b ++) {
+		batches[b] = vector < bcf2binary_record > (batch_size);
+		for (uint32_t r = 0 ; r < batch_size ; r ++) batches[b][r].binary.allocate(2 * nsamples);
+	}
 
 	//Proceed with conversion
-	uint32_t n_lines_rare = 0, n_lines_comm = 0;
-	while (XR.nextRecord())
-	{
-		//Is that a rare variant?
-		float af =  XR.getAF();
-		float maf = min(af, 1.0f-af);
-		bool minor = (af < 0.5f);
-		bool rare = (maf < minmaf);
-
-		//Get record
-		XR.readRecord(0, reinterpret_cast< char** > (&input_buffer));
-
-		//Convert
-		uint32_t n_sparse = 0;
-		for (uint32_t i = 0 ; i < nsamples ; i++) {
-			bool a0 = (bcf_gt_allele(input_buffer[2*i+0])==1);
-			bool a1 = (bcf_gt_allele(input_buffer[2*i+1])==1);
-			bool mi = (input_buffer[2*i+0] == bcf_gt_missing || input_buffer[2*i+1] == bcf_gt_missing);
-
-			if (mi && (mode == CONV_BCF_SH || mode == CONV_BCF_BH))
-				vrb.error("Missing data in phased data is not permitted!");
-
-			//BCF => SPARSE GENOTYPE
-			if (mode == CONV_BCF_SG) {
-				if (rare) {
-					if (a0 == minor || a1 == minor || mi)
-						output_buffer[n_sparse++] = sparse_genotype(i, (a0!=a1), mi, a0, a1, 0).get();
-				} else {
-					if (mi) { binary_buffer.set(2*i+0, true); binary_buffer.set(2*i+1, false); }		//Missing as 10
-					else if (a0 == a1) { binary_buffer.set(2*i+0, a0); binary_buffer.set(2*i+1, a1); }
-					else { binary_buffer.set(2*i+0, false); binary_buffer.set(2*i+1, true); }			//Hets as 01
-				}
+	uint32_t n_lines_rare = 0, n_lines_comm = 0, n_lines_multi = 0, n_lines_haploid = 0, n_lines_counted = 0;
+	bool done = false;
+	for (uint64_t step = 0 ; !done || batch_count[(step+1)%3] || batch_count[(step+2)%3] ; step ++) {
+		vector < bcf2binary_record > & read_batch = batches[step%3];
+		vector < bcf2binary_record > & encode_batch = batches[(step+2)%3];
+		vector < bcf2binary_record > & write_batch = batches[(step+1)%3];
+		uint32_t & n_read = batch_count[step%3];
+		uint32_t n_encode = batch_count[(step+2)%3], n_write = batch_count[(step+1)%3];
+		n_read = 0;
+
+		//Stages; records are read and written in order, encoding is independent across records
+		auto read_stage = [&]() {
+			while (!done && n_read < batch_size) {
+				if (vcf_fp ? readText(vcf_fp, read_batch[n_read]) : read(XR, read_batch[n_read])) n_read ++;
+				else done = true;
 			}
-
-			//BCF => SPARSE HAPLOTYPE
-			if (mode == CONV_BCF_SH) {
-				if (rare) {
-					if (a0 == minor) output_buffer[n_sparse++] = 2*i+0;
-					if (a1 == minor) output_buffer[n_sparse++] = 2*i+1;
-				} else {
-					binary_buffer.set(2*i+0, a0);
-					binary_buffer.set(2*i+1, a1);
+		};
+		atomic < uint32_t > next_encode (0);
+		auto encode_stage = [&]() {
+			for (uint32_t r = next_encode ++ ; r < n_encode ; r = next_encode ++) encode(encode_batch[r]);
+		};
+		auto write_stage = [&]() {
+			for (uint32_t r = 0 ; r < n_write ; r ++) {
+				write(XW, write_batch[r]);
+
+				//Line counting
+				n_lines_counted += write_batch[r].counted;
+				switch (write_batch[r].type) {
+				case RECORD_SPARSE_MULTIALLELIC: n_lines_multi++; break;
+				case RECORD_BCFVCF_GENOTYPE:
+				case RECORD_BINARY_HAPLOID:
+				case RECORD_SPARSE_HAPLOID: n_lines_haploid++; break;
+				case RECORD_SPARSE_GENOTYPE:
+				case RECORD_SPARSE_HAPLOTYPE:
+				case RECORD_VBYTE_GENOTYPE:
+				case RECORD_VBYTE_HAPLOTYPE:
+				case RECORD_SPARSE_DOSAGE: n_lines_rare++; break;
+				default: n_lines_comm++;
 				}
-			}
 
-			//BCF => BINARY GENOTYPE
-			if (mode == CONV_BCF_BG) {
-				if (mi) { binary_buffer.set(2*i+0, true); binary_buffer.set(2*i+1, false); }		//Missing as 10
-				else if (a0 == a1) { binary_buffer.set(2*i+0, a0); binary_buffer.set(2*i+1, a1); }
-				else { binary_buffer.set(2*i+0, false); binary_buffer.set(2*i+1, true); }			//Hets as 01
+				//Verbose
+				if (write_batch[r].type == RECORD_SPARSE_MULTIALLELIC || write_batch[r].haploid || (n_lines_comm+n_lines_rare) % 10000) continue;
+				if (mode == CONV_BCF_BG || mode == CONV_BCF_BH) vrb.bullet("Number of BCF records processed: N=" + stb.str(n_lines_comm));
+				else vrb.bullet("Number of BCF records processed: Nc=" + stb.str(n_lines_comm) + "/ Nr=" + stb.str(n_lines_rare));
 			}
-
-			//BCF => BINARY HAPLOTYPE
-			if (mode == CONV_BCF_BH) {
-				binary_buffer.set(2*i+0, a0);
-				binary_buffer.set(2*i+1, a1);
-			}
-		}
-
-		//Copy over variant information
-		if (drop_info) XW.writeInfo(XR.chr, XR.pos, XR.ref, XR.alt, XR.rsid, XR.getAC(), XR.getAN());
-		else
-		{
-			XW.hts_record = XR.sync_lines[0];
-			bcf_subset(XW.hts_hdr, XW.hts_record, 0, 0);//to remove format from XR's bcf1_t
-		}
-
-		//Write record
-		if (mode == CONV_BCF_SG && rare)
-			XW.writeRecord(RECORD_SPARSE_GENOTYPE, reinterpret_cast<char*>(output_buffer), n_sparse * sizeof(int32_t));
-		else if (mode == CONV_BCF_SH && rare)
-			XW.writeRecord(RECORD_SPARSE_HAPLOTYPE, reinterpret_cast<char*>(output_buffer), n_sparse * sizeof(int32_t));
-		else if (mode == CONV_BCF_SG || mode == CONV_BCF_BG)
-			XW.writeRecord(RECORD_BINARY_GENOTYPE, binary_buffer.bytes, binary_buffer.n_bytes);
-		else
-			XW.writeRecord(RECORD_BINARY_HAPLOTYPE, binary_buffer.bytes, binary_buffer.n_bytes);
-
-		//Line counting
-		n_lines_comm += !rare || mode == CONV_BCF_BG || mode == CONV_BCF_BH;
-		n_lines_rare += rare && (mode == CONV_BCF_SG || mode == CONV_BCF_SH);
-
-		//Verbose
-		if ((n_lines_comm+n_lines_rare) % 10000 == 0) {
-			if (mode == CONV_BCF_BG || mode == CONV_BCF_BH) vrb.bullet("Number of BCF records processed: N=" + stb.str(n_lines_comm));
-			else vrb.bullet("Number of BCF records processed: Nc=" + stb.str(n_lines_comm) + "/ Nr=" + stb.str(n_lines_rare));
+		};
+
+		if (nthreads > 1) {
+			thread reader = thread(read_stage), writer = thread(write_stage);
+			vector < thread > encoders;
+			for (int t = 0 ; t < nthreads ; t ++) encoders.push_back(thread(encode_stage));
+			for (int t = 0 ; t < nthreads ; t ++) encoders[t].join();
+			writer.join();
+			reader.join();
+		} else {
+			write_stage();
+			encode_stage();
+			read_stage();
 		}
 	}
+	if (!ploidy_mask.empty()) XW.ind_ploidy = ploidy_mask;
 
-	if (mode == CONV_BCF_BG || mode == CONV_BCF_BH) vrb.bullet("Number of BCF records processed: N=" + stb.str(n_lines_comm));
+	if (mode == CONV_BCF_BG || mode == CONV_BCF_BH || mode == CONV_BCF_BD) vrb.bullet("Number of BCF records processed: N=" + stb.str(n_lines_comm));
 	else vrb.bullet("Number of BCF records processed: Nc=" + stb.str(n_lines_comm) + "/ Nr=" + stb.str(n_lines_rare));
+	if (n_lines_multi) vrb.bullet("Number of multiallelic BCF records processed: Nm=" + stb.str(n_lines_multi));
+	if (n_lines_haploid) vrb.bullet("Number of BCF records with haploid samples processed: Nh=" + stb.str(n_lines_haploid) + " / #haploid samples = " + stb.str(std::count(ploidy_mask.begin(), ploidy_mask.end(), 1)));
+	if (n_lines_counted) vrb.bullet("Number of BCF records with AC/AN counted from FORMAT/GT: N=" + stb.str(n_lines_counted));
+	if (n_lines_dropped) vrb.warning("Number of multiallelic BCF records dropped [no multiallelic dosages]: N=" + stb.str(n_lines_dropped));
+
+	//Per-type totals
+	for (uint32_t t = 0 ; t < RECORD_NUMBER_TYPES ; t ++)
+		if (XW.bin_type_count[t]) vrb.bullet(helper_tools::recordName(t) + " : N=" + stb.str(XW.bin_type_count[t]) + " / " + stb.str(XW.bin_type_bytes[t]) + " bytes");
 
 	//Free
 	free(input_buffer);
-	free(output_buffer);
+	free(dosage_buffer);
+	free(text_line.s);
 
 	if (!drop_info) XW.hts_record = rec;
 	//Close files
 	XW.close();//always close XW first? important for multithreading if set
 	XR.close();
+	if (vcf_fp) {
+		bcf_hdr_destroy(vcf_hdr);
+		hts_close(vcf_fp);
+	}
+}
+
+//Read the next record into R; returns false when the input is exhausted
+bool bcf2binary::read(xcf_reader & XR, bcf2binary_record & R) {
+	if (!XR.nextRecord()) return false;
+
+	//Multiallelic dosages cannot be stored; such records are dropped with a warning
+	while ((mode == CONV_BCF_BD || mode == CONV_BCF_SD) && XR.n_allele > 2) {
+		if (!n_lines_dropped ++) vrb.warning("Multiallelic records cannot be stored as dosages and are dropped, first one at " + XR.chr + ":" + stb.str(XR.pos));
+		if (!XR.nextRecord()) return false;
+	}
+
+	//Copy over variant information
+	R.chr = XR.chr; R.pos = XR.pos; R.ref = XR.ref; R.alt = XR.alt; R.rsid = XR.rsid;
+	R.n_allele = XR.n_allele;
+	R.AC = XR.getAC(); R.AN = XR.getAN(); R.ACs = XR.getACs();
+	R.af = XR.getAF();
+	R.counted = XR.counted;
+	R.line = drop_info ? NULL : bcf_dup(XR.sync_lines[0]);
+	R.haploid = false;
+	R.seed = rng.getEngine()();
+
+	//Dosages
+	if (mode == CONV_BCF_BD || mode == CONV_BCF_SD) {
+		if ((uint32_t)XR.readDosages(0, &dosage_buffer, &n_dosage_buffer) != nsamples) vrb.error("FORMAT/DS or FORMAT/GP needed for dosage conversion at " + XR.chr + ":" + stb.str(XR.pos));
+		R.dosages.assign(dosage_buffer, dosage_buffer + nsamples);
+		return true;
+	}
+
+	//Diploid biallelic genotypes stored on 8 bits are taken as is from the BCF record
+	R.genotypes8.clear();
+	bcf_fmt_t * fmt = XR.readRawGenotypes(0);
+	if (fmt && fmt->type == BCF_BT_INT8 && fmt->n == 2 && R.n_allele == 2) {
+		const int8_t * gt = (const int8_t *)fmt->p;
+		uint32_t i = 0;
+		while (i < nsamples && gt[2*i+1] != bcf_int8_vector_end) i++;
+		if (i == nsamples) {
+			R.genotypes8.assign(gt, gt + 2 * nsamples);
+			return true;
+		}
+	}
+
+	//Get record
+	XR.readRecord(0, &input_buffer, &n_input_buffer);
+
+	//Records with haploid samples [e.g. chrX in males, chrY, chrM]
+	R.haploid = (XR.getPloidy(0) != 2);
+	for (uint32_t i = 0 ; i < nsamples && !R.haploid ; i++) R.haploid = (input_buffer[2*i+1] == bcf_int32_vector_end);
+	if (!R.haploid) {
+		R.genotypes.assign(input_buffer, input_buffer + 2 * nsamples);
+		return true;
+	}
+	if (XR.getPloidy(0) > 2) vrb.error("Ploidy above 2 is not supported at " + XR.chr + ":" + stb.str(XR.pos));
+
+	//Same layout as diploid records; second allele of haploid samples set to vector end
+	R.genotypes.resize(2 * nsamples);
+	for (uint32_t i = 0 ; i < nsamples ; i++) {
+		R.genotypes[2*i+0] = (XR.getPloidy(0) == 1) ? input_buffer[i] : input_buffer[2*i+0];
+		R.genotypes[2*i+1] = (XR.getPloidy(0) == 1) ? bcf_int32_vector_end : input_buffer[2*i+1];
+	}
+	if (ploidy_mask.empty()) {
+		ploidy_mask = vector < uint8_t > (nsamples);
+		for (uint32_t i = 0 ; i < nsamples ; i++) ploidy_mask[i] = (R.genotypes[2*i+1] == bcf_int32_vector_end) ? 1 : 2;
+	}
+	return true;
+}
+
+//Read the next VCF text line into R; only the site and INFO/AC/AN are parsed, genotypes are parsed when encoded
+bool bcf2binary::readText(htsFile * fp, bcf2binary_record & R) {
+	while (hts_getline(fp, KS_SEP_LINE, &text_line) >= 0) {
+		const char * line = text_line.s, * end = text_line.s + text_line.l;
+
+		//CHROM, POS, ID, REF, ALT, QUAL, FILTER, INFO and FORMAT columns
+		const char * col[9];
+		col[0] = line;
+		for (uint32_t c = 1 ; c < 9 ; c ++) col[c] = vcf_text::column(col[c-1], end);
+		if (col[8] == end) vrb.error("No sample data in VCF line [" + string(line, min(text_line.l, (size_t)64)) + "]");
+
+		//Sites without ALT allele are skipped
+		R.n_allele = 1 + std::count(col[4], col[5] - 1, ',');
+		if (col[5] - col[4] == 2 && col[4][0] == '.') continue;
+
+		//Copy over variant information
+		R.chr.assign(col[0], col[1] - 1);
+		R.pos = strtoul(col[1], NULL, 10);
+		R.rsid.assign(col[2], col[3] - 1);
+		R.ref.assign(col[3], col[4] - 1);
+		R.alt.assign(col[4], col[5] - 1);
+
+		//Get AC/AN information [counted from genotypes when parsed if missing]
+		bool hasAC = (vcf_text::infoInt(col[7], col[8] - 1, "AC", text_info) == (int32_t)R.n_allele - 1);
+		if (hasAC) R.ACs.assign(text_info.begin(), text_info.end());
+		bool hasAN = (vcf_text::infoInt(col[7], col[8] - 1, "AN", text_info) == 1);
+		if (hasAN) R.AN = text_info[0];
+		R.counted = !hasAC || !hasAN;
+		if (!R.counted) {
+			R.AC = std::accumulate(R.ACs.begin(), R.ACs.end(), 0U);
+			R.af = R.AC * 1.0f / R.AN;
+		}
+
+		//Genotypes are parsed later on
+		R.text.assign(line, end - line);
+		R.text_gt = col[8] - line;
+		R.line = NULL;
+		R.haploid = false;
+		R.seed = rng.getEngine()();
+		return true;
+	}
+	return false;
 }
 
+//Parse the GT sub-field of each sample of the VCF text line of R [biallelic records on 8 bits, as in BCF files]
+void bcf2binary::parseText(bcf2binary_record & R) {
+	const char * p = R.text.data() + R.text_gt, * end = R.text.data() + R.text.size();
+	if (end - p < 2 || p[0] != 'G' || p[1] != 'T' || (p + 2 < end && p[2] != ':' && p[2] != '\t')) vrb.error("FORMAT/GT is needed first at " + R.chr + ":" + stb.str(R.pos));
+	p = vcf_text::column(p, end);
+
+	bool narrow = (R.n_allele == 2);
+	R.genotypes8.resize(narrow ? 2 * nsamples : 0);
+	R.genotypes.resize(narrow ? 0 : 2 * nsamples);
+	for (uint32_t i = 0 ; i < nsamples ; i ++) {
+		if (p >= end) vrb.error("Missing sample columns at " + R.chr + ":" + stb.str(R.pos));
+		int32_t gt[2] = { bcf_gt_missing, bcf_gt_missing };
+		int32_t n = vcf_text::parseGenotype(p, end, gt, 2);
+		if (n > 2) vrb.error("Ploidy above 2 is not supported at " + R.chr + ":" + stb.str(R.pos));
+		R.haploid = R.haploid || (n == 1);
+		if (narrow) {
+			R.genotypes8[2*i+0] = gt[0];
+			R.genotypes8[2*i+1] = (n == 1) ? bcf_int8_vector_end : gt[1];
+		} else {
+			R.genotypes[2*i+0] = gt[0];
+			R.genotypes[2*i+1] = (n == 1) ? bcf_int32_vector_end : gt[1];
+		}
+
+		//Other FORMAT sub-fields are skipped
+		p = (p < end && *p == '\t') ? (p + 1) : vcf_text::column(p, end);
+	}
+
+	//Records with haploid samples use the int32 layout of BCF records
+	if (narrow && R.haploid) {
+		R.genotypes.resize(2 * nsamples);
+		xcf_reader::widenGenotypes(R.genotypes8.data(), 2 * nsamples, bcf_int8_vector_end, bcf_int8_missing, R.genotypes.data());
+		R.genotypes8.clear();
+	}
+
+	//AC/AN missing from INFO
+	if (R.counted) {
+		R.ACs.assign(R.n_allele - 1, 0);
+		R.AN = 0;
+		if (R.genotypes8.size()) xcf_reader::countAlleles(R.genotypes8.data(), 2 * nsamples, bcf_int8_vector_end, R.ACs, R.AN);
+		else xcf_reader::countAlleles(R.genotypes.data(), 2 * nsamples, bcf_int32_vector_end, R.ACs, R.AN);
+		R.AC = std::accumulate(R.ACs.begin(), R.ACs.end(), 0U);
+		R.af = R.AC * 1.0f / R.AN;
+	}
+}
+
+//Encode the record R; only depends on R, so that records can be encoded in any order
+void bcf2binary::encode(bcf2binary_record & R) {
+	const bool sparse_mode = (mode == CONV_BCF_SG || mode == CONV_BCF_SH);
+
+	//Genotypes of VCF text lines are parsed here, so that parsing runs on all encoding threads
+	if (R.text.size()) parseText(R);
+
+	//Is that a rare variant?
+	float maf = min(R.af, 1.0f-R.af);
+	bool minor = (R.af < 0.5f);
+	bool rare = (maf < minmaf);
+
+	//In adaptive mode, both encodings are built and the cheapest is kept
+	bool fill_sparse = sparse_mode && (rare || adaptive);
+	bool fill_binary = !sparse_mode || !rare || adaptive;
+
+	//Dosages: dense quantisation, or sparse when smaller
+	if (mode == CONV_BCF_BD || mode == CONV_BCF_SD) {
+		uint32_t n_listed = (mode == CONV_BCF_SD) ? dosage_record::countSparse(R.dosages.data(), nsamples, dosage_eps) : nsamples;
+		bool sparse = (mode == CONV_BCF_SD) && (dosage_record::sizeSparse(n_listed) < dosage_record::sizeDense(nsamples, dosage_bits));
+		R.bytes.resize(sparse ? dosage_record::sizeSparse(n_listed) : dosage_record::sizeDense(nsamples, dosage_bits));
+		if (sparse) dosage_record::encodeSparse(R.dosages.data(), nsamples, dosage_eps, R.bytes.data());
+		else dosage_record::encodeDense(R.dosages.data(), nsamples, dosage_bits, R.bytes.data());
+		R.type = sparse ? RECORD_SPARSE_DOSAGE : ((dosage_bits == 8) ? RECORD_DENSE_DOSAGE8 : RECORD_DENSE_DOSAGE16);
+		return;
+	}
+
+	//Records with haploid samples [VCF text lines are encoded when written, once the ploidy of each sample is known]
+	if (R.haploid) {
+		if (R.text.size()) R.type = RECORD_VOID;
+		else encodeHaploid(R);
+		return;
+	}
+
+	//Multiallelic variant: one sparse list of haplotypes per allele, whatever the mode
+	if (R.n_allele > 2) {
+		R.indices.resize(sparse_multiallelic::bound(nsamples, R.n_allele));
+		R.indices.resize(sparse_multiallelic::encode(R.genotypes.data(), nsamples, R.n_allele, R.indices.data()));
+		R.type = RECORD_SPARSE_MULTIALLELIC;
+		return;
+	}
+
+	//Convert
+	if (R.genotypes8.size()) encodeDiploid(R, R.genotypes8.data(), minor, fill_sparse, fill_binary);
+	else encodeDiploid(R, R.genotypes.data(), minor, fill_sparse, fill_binary);
+
+	//Pick encoding [phased data with missing haplotypes is kept dense]
+	if (R.missing.size()) R.type = RECORD_MISSING_HAPLOTYPE;
+	else if (sparse_mode && adaptive) R.type = xcf_writer::cheapestRecord(mode == CONV_BCF_SG, R.indices.data(), R.indices.size(), R.binary.n_bytes);
+	else if (sparse_mode && rare && mode == CONV_BCF_SG) R.type = compress_sparse ? RECORD_VBYTE_GENOTYPE : RECORD_SPARSE_GENOTYPE;
+	else if (sparse_mode && rare && mode == CONV_BCF_SH) R.type = compress_sparse ? RECORD_VBYTE_HAPLOTYPE : RECORD_SPARSE_HAPLOTYPE;
+	else R.type = (mode == CONV_BCF_SG || mode == CONV_BCF_BG) ? RECORD_BINARY_GENOTYPE : RECORD_BINARY_HAPLOTYPE;
+
+	//Delta/vbyte coding of sparse records
+	if (R.type == RECORD_VBYTE_GENOTYPE || R.type == RECORD_VBYTE_HAPLOTYPE) {
+		R.bytes.resize(vbyte::bound(R.indices.size()));
+		if (R.type == RECORD_VBYTE_GENOTYPE) R.bytes.resize(vbyte::encodeGenotypes(R.indices.data(), R.indices.size(), R.bytes.data()));
+		else R.bytes.resize(vbyte::encodeHaplotypes(R.indices.data(), R.indices.size(), R.bytes.data()));
+	}
+}
+
+//Encode the record R with haploid samples; compact records need biallelic data following the ploidy of each sample
+void bcf2binary::encodeHaploid(bcf2binary_record & R) {
+	const bool sparse_mode = (mode == CONV_BCF_SG || mode == CONV_BCF_SH);
+	float maf = min(R.af, 1.0f-R.af);
+	bool major = (R.af >= 0.5f);
+	bool rare = (maf < minmaf);
+
+	bool compact = (R.n_allele == 2);
+	for (uint32_t i = 0 ; i < nsamples && compact ; i++) compact = (ploidy_mask[i] == ((R.genotypes[2*i+1] == bcf_int32_vector_end) ? 1 : 2));
+
+	//Otherwise, genotypes are kept in BCF format
+	if (!compact) {
+		R.type = RECORD_BCFVCF_GENOTYPE;
+		return;
+	}
+
+	//Missing alleles are listed aside in both encodings; sparse ones list the called alleles away from the major one
+	uint32_t n_haps = std::accumulate(ploidy_mask.begin(), ploidy_mask.end(), 0U), n_listed = 0;
+	for (uint32_t i = 0 ; i < nsamples ; i++)
+		for (uint32_t a = 0 ; a < ploidy_mask[i] ; a++) n_listed += (!bcf_gt_is_missing(R.genotypes[2*i+a]) && (bcf_gt_allele(R.genotypes[2*i+a]) == 1) != major);
+	bool sparse = sparse_mode && (adaptive ? (n_listed * sizeof(int32_t) < DIVU(n_haps, 8)) : rare);
+	R.type = sparse ? RECORD_SPARSE_HAPLOID : RECORD_BINARY_HAPLOID;
+	R.bytes.resize(xcf_writer::haploidBound(n_haps));
+	R.bytes.resize(xcf_writer::encodeHaploid(R.genotypes.data(), ploidy_mask, (mode == CONV_BCF_BH || mode == CONV_BCF_SH), sparse, major, R.bytes.data()));
+}
+
+//Bit-pack the genotypes of a diploid biallelic record [T is int8_t for GT taken as is from the BCF, int32_t otherwise]
+template < typename T >
+void bcf2binary::encodeDiploid(bcf2binary_record & R, const T * gt, bool minor, bool fill_sparse, bool fill_binary) {
+	//Phased data with missing haplotypes is written dense
+	for (uint32_t i = 0 ; i < 2 * nsamples && mode == CONV_BCF_SH && !fill_binary ; i++) fill_binary = bcf_gt_is_missing(gt[i]);
+
+	R.indices.clear();
+	R.missing.clear();
+	random_number_generator coins(R.seed);
+	for (uint32_t i = 0 ; i < nsamples ; i++) {
+		bool a0 = (bcf_gt_allele(gt[2*i+0])==1);
+		bool a1 = (bcf_gt_allele(gt[2*i+1])==1);
+		bool mi = (bcf_gt_is_missing(gt[2*i+0]) || bcf_gt_is_missing(gt[2*i+1]));
+
+		//Missing haplotypes in phased data are listed aside
+		if (mi && (mode == CONV_BCF_SH || mode == CONV_BCF_BH)) {
+			if (bcf_gt_is_missing(gt[2*i+0])) R.missing.push_back(2*i+0);
+			if (bcf_gt_is_missing(gt[2*i+1])) R.missing.push_back(2*i+1);
+		}
+
+		//BCF => SPARSE GENOTYPE
+		if (mode == CONV_BCF_SG) {
+			if (fill_sparse) {
+				if (a0 == minor || a1 == minor || mi)
+					R.indices.push_back(sparse_genotype(i, (a0!=a1), mi, a0, a1, 0, coins).get());
+			}
+			if (fill_binary) {
+				if (mi) { R.binary.set(2*i+0, true); R.binary.set(2*i+1, false); }		//Missing as 10
+				else if (a0 == a1) { R.binary.set(2*i+0, a0); R.binary.set(2*i+1, a1); }
+				else { R.binary.set(2*i+0, false); R.binary.set(2*i+1, true); }			//Hets as 01
+			}
+		}
+
+		//BCF => SPARSE HAPLOTYPE
+		if (mode == CONV_BCF_SH) {
+			if (fill_sparse) {
+				if (a0 == minor) R.indices.push_back(2*i+0);
+				if (a1 == minor) R.indices.push_back(2*i+1);
+			}
+			if (fill_binary) {
+				R.binary.set(2*i+0, a0);
+				R.binary.set(2*i+1, a1);
+			}
+		}
+
+		//BCF => BINARY GENOTYPE
+		if (mode == CONV_BCF_BG) {
+			if (mi) { R.binary.set(2*i+0, true); R.binary.set(2*i+1, false); }		//Missing as 10
+			else if (a0 == a1) { R.binary.set(2*i+0, a0); R.binary.set(2*i+1, a1); }
+			else { R.binary.set(2*i+0, false); R.binary.set(2*i+1, true); }			//Hets as 01
+		}
+
+		//BCF => BINARY HAPLOTYPE
+		if (mode == CONV_BCF_BH) {
+			R.binary.set(2*i+0, a0);
+			R.binary.set(2*i+1, a1);
+		}
+	}
+}
+
+//Write the encoded record R [records must be written in order; XOR coding and sharding depend on the previous ones]
+void bcf2binary::write(xcf_writer & XW, bcf2binary_record & R) {
+	//Copy over variant information
+	bool multi = (R.type == RECORD_SPARSE_MULTIALLELIC || R.haploid);
+	if (drop_info && multi) XW.writeInfo(R.chr, R.pos, R.ref, R.alt, R.rsid, R.ACs, R.AN);
+	else if (drop_info) XW.writeInfo(R.chr, R.pos, R.ref, R.alt, R.rsid, R.AC, R.AN);
+	else {
+		XW.hts_record = R.line;
+		bcf_subset(XW.hts_hdr, XW.hts_record, 0, 0);//to remove format from XR's bcf1_t
+		if (R.counted) {
+			bcf_update_info_int32(XW.hts_hdr, XW.hts_record, "AC", R.ACs.data(), R.ACs.size());
+			bcf_update_info_int32(XW.hts_hdr, XW.hts_record, "AN", &R.AN, 1);
+		}
+	}
+
+	//Records with haploid samples from VCF text lines; the first one gives the ploidy of each sample
+	if (R.type == RECORD_VOID) {
+		if (ploidy_mask.empty()) {
+			ploidy_mask = vector < uint8_t > (nsamples);
+			for (uint32_t i = 0 ; i < nsamples ; i++) ploidy_mask[i] = (R.genotypes[2*i+1] == bcf_int32_vector_end) ? 1 : 2;
+		}
+		encodeHaploid(R);
+	}
+
+	//Ploidy is known from the first haploid record on, and goes ahead of it in streams
+	if ((R.type == RECORD_BINARY_HAPLOID || R.type == RECORD_SPARSE_HAPLOID) && XW.ind_ploidy.empty()) XW.ind_ploidy = ploidy_mask;
+
+	//Write record
+	switch (R.type) {
+	case RECORD_BCFVCF_GENOTYPE:
+		XW.writeRecord(R.type, reinterpret_cast< char* > (R.genotypes.data()), 2 * nsamples * sizeof(int32_t)); break;
+	case RECORD_SPARSE_MULTIALLELIC:
+	case RECORD_SPARSE_GENOTYPE:
+	case RECORD_SPARSE_HAPLOTYPE:
+		XW.writeRecord(R.type, reinterpret_cast< char* > (R.indices.data()), R.indices.size() * sizeof(int32_t)); break;
+	case RECORD_MISSING_HAPLOTYPE:
+		XW.writeMissingRecord(R.binary.bytes, R.binary.n_bytes, R.missing.data(), R.missing.size()); break;
+	case RECORD_BINARY_GENOTYPE:
+		XW.writeRecord(R.type, R.binary.bytes, R.binary.n_bytes); break;
+	case RECORD_BINARY_HAPLOTYPE:
+		XW.writeHaplotypeRecord(R.binary.bytes, R.binary.n_bytes); break;
+	default:
+		XW.writeRecord(R.type, R.bytes.data(), R.bytes.size());
+	}
+	if (R.line) bcf_destroy(R.line);
+	R.line = NULL;
+}
@@ -27,11 +27,45 @@
 #define CONV_BCF_BH	1
 #define CONV_BCF_SG	2
 #define CONV_BCF_SH	3
+#define CONV_BCF_BD	4
+#define CONV_BCF_SD	5
+
+//Memory used by a batch of records in multi-threaded conversions
+#define BCF2BINARY_BATCH_BYTES	(64U << 20)
 
 #include <utils/otools.h>
+#include <utils/xcf.h>
 #include <containers/bitvector.h>
 #include <objects/sparse_genotype.h>
 
+//A record travelling through the conversion pipeline [read, then encoded, then written in order]
+class bcf2binary_record {
+public:
+	//Variant information
+	std::string chr, ref, alt, rsid;
+	uint32_t pos, n_allele, AC, AN;
+	std::vector < uint32_t > ACs;
+	float af;
+	bool counted;								//AC/AN counted from FORMAT/GT [no INFO/AC or INFO/AN in the input]
+	bcf1_t * line;								//Copy of the input record when INFO is kept
+
+	//Input data
+	bool haploid;
+	std::vector < int32_t > genotypes;			//FORMAT/GT, 2 per sample [second allele of haploid samples set to vector end]
+	std::vector < int8_t > genotypes8;			//FORMAT/GT as stored in the BCF, 2 per sample [diploid biallelic records on 8 bits; replaces genotypes]
+	std::vector < float > dosages;				//FORMAT/DS, 1 per sample
+	std::string text;							//VCF text line, parsed when encoded [empty for BCF records]
+	uint32_t text_gt;							//Offset of the FORMAT column in text
+	uint32_t seed;								//Seed of the phasing coins of unphased hets [drawn in record order, so output does not depend on threads]
+
+	//Encoded data
+	uint32_t type;
+	bitvector binary;							//Dense records
+	std::vector < int32_t > indices;			//Sparse records
+	std::vector < int32_t > missing;			//Missing haplotypes of dense records
+	std::vector < char > bytes;					//Any other coded record
+};
+
 class bcf2binary {
 public:
 
@@ -42,7 +76,24 @@ public:
 	int mode;
 	float minmaf;
 	bool drop_info;
+	bool compress_sparse;
+	bool adaptive;
+	bool align;
+	uint32_t xor_keyframe;
+	uint32_t shard_size;
+	uint32_t dosage_bits;
+	float dosage_eps;
 
+	//DATA
+	uint32_t nsamples;
+	int32_t * input_buffer;
+	int32_t n_input_buffer;
+	float * dosage_buffer;
+	int32_t n_dosage_buffer;
+	uint32_t n_lines_dropped;					//Multiallelic records dropped when converting dosages
+	std::vector < uint8_t > ploidy_mask;		//Ploidy of each sample, set by the first record with haploid samples
+	kstring_t text_line;						//Line read from VCF text input
+	std::vector < int32_t > text_info;			//INFO/AC or INFO/AN values of the line
 
 	//CONSTRUCTORS/DESCTRUCTORS
 	bcf2binary(std::string, float, int, int, bool);
@@ -50,6 +101,13 @@ public:
 
 	//PROCESS
 	void convert(std::string, std::string);
+	bool read(xcf_reader &, bcf2binary_record &);
+	bool readText(htsFile *, bcf2binary_record &);
+	void parseText(bcf2binary_record &);
+	void encode(bcf2binary_record &);
+	void encodeHaploid(bcf2binary_record &);
+	template < typename T > void encodeDiploid(bcf2binary_record &, const T *, bool, bool, bool);
+	void write(xcf_writer &, bcf2binary_record &);
 };
 
 #endif
@@ -23,30 +23,116 @@
 #include "../versions/versions.h"
 
 #include <modes/binary2bcf.h>
+#include <modes/binary2binary.h>
 #include <utils/xcf.h>
 
 #include <containers/bitvector.h>
 #include <objects/sparse_genotype.h>
+#include <objects/sparse_multiallelic.h>
+#include <objects/dosage_record.h>
+
+#include <thread>
+#include <atomic>
 
 using namespace std;
 
+//int8 FORMAT/GT values of the 4 samples packed in one byte of a dense record [alleles MSB first]
+struct gt8_table {
+	int8_t hap[256][8];		//Phased haplotypes
+	int8_t gen[256][8];		//Unphased genotypes [10 is missing, 01 is het]
+
+	gt8_table() {
+		for (uint32_t c = 0 ; c < 256 ; c ++) {
+			for (uint32_t i = 0 ; i < 4 ; i ++) {
+				bool a0 = (c >> (7 - 2*i)) & 1;
+				bool a1 = (c >> (6 - 2*i)) & 1;
+				hap[c][2*i+0] = bcf_gt_phased(a0);
+				hap[c][2*i+1] = bcf_gt_phased(a1);
+				gen[c][2*i+0] = (a0 && !a1) ? bcf_gt_missing : bcf_gt_unphased(a0);
+				gen[c][2*i+1] = (a0 && !a1) ? bcf_gt_missing : bcf_gt_unphased(a1);
+			}
+		}
+	}
+
+	static const gt8_table & get() {
+		static const gt8_table T;
+		return T;
+	}
+
+	//Expand n alleles packed in bytes into n int8 values
+	void expand(const int8_t (*table)[8], const char * bytes, uint32_t n, int8_t * out) const {
+		uint32_t n_full = n / 8;
+		for (uint32_t b = 0 ; b < n_full ; b ++) memcpy(out + 8 * b, table[(uint8_t)bytes[b]], 8);
+		if (n % 8) memcpy(out + 8 * n_full, table[(uint8_t)bytes[n_full]], n % 8);
+	}
+};
+
+//VCF text of the 2 samples packed in one nibble of a dense record [alleles MSB first], as "\tA|B\tC|D"
+struct vcf_table {
+	char hap[16][8];		//Phased haplotypes
+	char gen[16][8];		//Unphased genotypes [10 is missing, 01 is het]
+
+	vcf_table() {
+		for (uint32_t c = 0 ; c < 16 ; c ++) {
+			for (uint32_t i = 0 ; i < 2 ; i ++) {
+				bool a0 = (c >> (3 - 2*i)) & 1;
+				bool a1 = (c >> (2 - 2*i)) & 1;
+				bool mi = (a0 && !a1);
+				hap[c][4*i+0] = gen[c][4*i+0] = '\t';
+				hap[c][4*i+1] = '0' + a0;
+				hap[c][4*i+2] = '|';
+				hap[c][4*i+3] = '0' + a1;
+				gen[c][4*i+1] = mi ? '.' : ('0' + a0);
+				gen[c][4*i+2] = '/';
+				gen[c][4*i+3] = mi ? '.' : ('0' + a1);
+			}
+		}
+	}
+
+	static const vcf_table & get() {
+		static const vcf_table T;
+		return T;
+	}
+
+	//Render n samples packed in bytes as 4 x n characters
+	void expand(const char (*table)[8], const char * bytes, uint32_t n, char * out) const {
+		uint32_t n_full = n / 4;
+		for (uint32_t b = 0 ; b < n_full ; b ++) {
+			memcpy(out + 16 * b + 0, table[((uint8_t)bytes[b]) >> 4], 8);
+			memcpy(out + 16 * b + 8, table[((uint8_t)bytes[b]) & 15], 8);
+		}
+		for (uint32_t i = 4 * n_full ; i < n ; i ++) {
+			uint8_t nib = ((uint8_t)bytes[i/4]) >> (4 * (1 - (i % 4) / 2));
+			memcpy(out + 4 * i, table[nib & 15] + 4 * (i % 2), 4);
+		}
+	}
+};
+
 binary2bcf::binary2bcf(string _region, int _nthreads) {
 	nthreads = _nthreads;
 	region = _region;
+	split_multi = false;
 }
 
 binary2bcf::~binary2bcf() {
 }
 
 void binary2bcf::convert(string finput, string foutput) {
+	vector < string > smpls;
+	convert(finput, foutput, false, false, smpls);
+}
+
+void binary2bcf::convert(string finput, string foutput, const bool exclude, const bool isforce, vector < string > & smpls) {
 	tac.clock();
 
 	vrb.title("Converting from XCF to BCF");
 	if (region.empty()) vrb.bullet("Region        : All");
-	else vrb.bullet("Region        : " + stb.str(region));
+	else vrb.bullet("Region        : " + helper_tools::regionName(region));
+	if (split_multi) vrb.bullet("Multiallelics : Split into biallelic records");
 
 	//Opening XCF reader for input
 	xcf_reader XR(region, nthreads);
+	XR.multi = true;
 	int32_t idx_file = XR.addFile(finput);
 
 	//Get file type
@@ -55,117 +141,452 @@ void binary2bcf::convert(string finput, string foutput) {
 
 	//Get sample IDs
 	vector < string > samples;
-	int32_t nsamples = XR.getSamples(idx_file, samples);
+	nsamples = nsamples_input = XR.getSamples(idx_file, samples);
 	vrb.bullet("#samples = " + stb.str(nsamples));
 
+	//Sample subset; records are read for all samples, then restricted to the kept ones when encoded
+	subs2full.clear();
+	if (!smpls.empty()) {
+		binary2binary::subsample_samples(XR, idx_file, exclude, isforce, smpls, subs2full);
+		if (subs2full.size() == nsamples_input) {
+			vrb.warning("No individual to remove. Proceeding without subsampling.");
+			subs2full.clear();
+		} else {
+			vector < uint32_t > kept_bits;
+			vector < string > kept_samples;
+			for (uint32_t i = 0 ; i < subs2full.size() ; i ++) {
+				kept_bits.push_back(2*subs2full[i]+0);
+				kept_bits.push_back(2*subs2full[i]+1);
+				kept_samples.push_back(samples[subs2full[i]]);
+			}
+			gather.set(kept_bits, 2 * nsamples_input);
+			samples = kept_samples;
+			nsamples = subs2full.size();
+			vrb.bullet("#kept samples = " + stb.str(nsamples));
+
+			//Sharded input; only the groups of samples holding kept samples are read
+			if (XR.shard_size[idx_file]) {
+				shard_groups = vector < bool > (XR.shard_fds[idx_file].size(), false);
+				for (uint32_t i = 0 ; i < subs2full.size() ; i ++) shard_groups[subs2full[i] / XR.shard_size[idx_file]] = true;
+				vrb.bullet("Sample groups : " + stb.str(count(shard_groups.begin(), shard_groups.end(), true)) + " / " + stb.str(shard_groups.size()) + " read");
+			}
+		}
+	}
+
 	//Opening XCF writer for output [true means records are written in BCF body]
 	xcf_writer XW(foutput, true, nthreads);
+	XW.hts_dosages = XR.hasDosages(idx_file);
 
 	//Write header
 	XW.writeHeader(XR.sync_reader->readers[0].header, samples, string("XCFtools ") + string(XCFTLS_VERSION));
 
-	//Buffer for input/output
-	int32_t * input_buffer = (int32_t*)malloc(2 * nsamples * sizeof(int32_t));
-	int32_t * output_buffer = (int32_t*)malloc(2 * nsamples * sizeof(int32_t));
+	//Batches of records; a single record when not multi-threaded
+	uint32_t record_bytes = 2 * nsamples_input * (sizeof(int32_t) + sizeof(int32_t)) + sizeof(binary2bcf_record);
+	uint32_t batch_size = (nthreads > 1) ? max((uint32_t)nthreads, min(1024U, BINARY2BCF_BATCH_BYTES / record_bytes)) : 1;
+	if (nthreads > 1) vrb.bullet("Pipeline      : " + stb.str(nthreads) + " encoding threads / batches of " + stb.str(batch_size) + " records");
 
-	//Buffer for binary data
-	bitvector binary_buffer = bitvector(2 * nsamples);
+	//Buffer for input
+	input_buffer = (int32_t*)malloc(2 * nsamples_input * sizeof(int32_t));
+
+	//VCF text lines are formatted by the encoding threads; sparse records start from lines of major genotypes
+	if (XW.hts_text) {
+		text_major = vector < string > (4);
+		for (uint32_t t = 0 ; t < 4 ; t ++) {
+			string sample = string("\t") + (char)('0' + t % 2) + ((t / 2) ? '|' : '/') + (char)('0' + t % 2);
+			for (uint32_t i = 0 ; i < nsamples ; i ++) text_major[t] += sample;
+		}
+	}
+
+	//Three batches in flight: one being read, one being encoded, one being written
+	vector < vector < binary2bcf_record > > batches = vector < vector < binary2bcf_record > > (3);
+	vector < uint32_t > batch_count = vector < uint32_t > (3, 0);
+	for (uint32_t b = 0 ; b < 3 ; b ++) {
+		batches[b] = vector < binary2bcf_record > (batch_size);
+		for (uint32_t r = 0 ; r < batch_size ; r ++) {
+			batches[b][r].binary.allocate(2 * nsamples_input);
+			if (!subs2full.empty()) batches[b][r].kept.allocate(2 * nsamples_input);
+			batches[b][r].genotypes.resize(2 * nsamples_input);
+			batches[b][r].lines.push_back(bcf_init1());
+			batches[b][r].text = { 0, 0, NULL };
+		}
+	}
 
 	//Proceed with conversion
 	uint32_t n_lines = 0;
-	while (XR.nextRecord()) {
-
-		//Copy over variant information
-		XW.writeInfo(XR.chr, XR.pos, XR.ref, XR.alt, XR.rsid, XR.getAC(), XR.getAN());
-
-		//Get type of record
-		type = XR.typeRecord(idx_file);
-
-		//Convert from BCF; copy the data over
-		if (type == RECORD_BCFVCF_GENOTYPE) {
-			XR.readRecord(idx_file, reinterpret_cast< char** > (&input_buffer));
-			memcpy(output_buffer, input_buffer, 2 * nsamples * sizeof(int32_t));
-		}
-
-		//Convert from binary genotypes
-		else if (type == RECORD_BINARY_GENOTYPE) {
-			int n = XR.readRecord(idx_file, reinterpret_cast< char** > (&binary_buffer.bytes));
-			for(uint32_t i = 0 ; i < nsamples ; i++) {
-				bool a0 = binary_buffer.get(2*i+0);
-				bool a1 = binary_buffer.get(2*i+1);
-				if (a0 == true && a1 == false) {
-					output_buffer[2*i+0] = bcf_gt_missing;
-					output_buffer[2*i+1] = bcf_gt_missing;
-				} else {
-					output_buffer[2*i+0] = bcf_gt_unphased(a0);
-					output_buffer[2*i+1] = bcf_gt_unphased(a1);
-				}
+	bool done = false;
+	for (uint64_t step = 0 ; !done || batch_count[(step+1)%3] || batch_count[(step+2)%3] ; step ++) {
+		vector < binary2bcf_record > & read_batch = batches[step%3];
+		vector < binary2bcf_record > & encode_batch = batches[(step+2)%3];
+		vector < binary2bcf_record > & write_batch = batches[(step+1)%3];
+		uint32_t & n_read = batch_count[step%3];
+		uint32_t n_encode = batch_count[(step+2)%3], n_write = batch_count[(step+1)%3];
+		n_read = 0;
+
+		//Stages; records are read and written in order, encoding is independent across records
+		auto read_stage = [&]() {
+			while (!done && n_read < batch_size) {
+				if (read(XR, read_batch[n_read])) n_read ++;
+				else done = true;
+			}
+		};
+		atomic < uint32_t > next_encode (0);
+		auto encode_stage = [&]() {
+			for (uint32_t r = next_encode ++ ; r < n_encode ; r = next_encode ++) encode(XW, encode_batch[r]);
+		};
+		auto write_stage = [&]() {
+			for (uint32_t r = 0 ; r < n_write ; r ++) {
+				if (XW.hts_text) XW.writeLine(&write_batch[r].text);
+				else for (uint32_t l = 0 ; l < write_batch[r].n_lines ; l ++) XW.writeRecord(write_batch[r].lines[l]);
+				n_lines++;
+				if (n_lines % 10000 == 0) vrb.bullet("Number of XCF records processed: N = " + stb.str(n_lines));
 			}
+		};
+
+		if (nthreads > 1) {
+			thread reader = thread(read_stage), writer = thread(write_stage);
+			vector < thread > encoders;
+			for (int t = 0 ; t < nthreads ; t ++) encoders.push_back(thread(encode_stage));
+			for (int t = 0 ; t < nthreads ; t ++) encoders[t].join();
+			writer.join();
+			reader.join();
+		} else {
+			write_stage();
+			encode_stage();
+			read_stage();
 		}
+	}
 
-		//Convert from binary haplotypes
-		else if (type == RECORD_BINARY_HAPLOTYPE) {
-			XR.readRecord(idx_file, reinterpret_cast< char** > (&binary_buffer.bytes));
-			for(uint32_t i = 0 ; i < nsamples ; i++) {
-				bool a0 = binary_buffer.get(2*i+0);
-				bool a1 = binary_buffer.get(2*i+1);
-				output_buffer[2*i+0] = bcf_gt_phased(a0);
-				output_buffer[2*i+1] = bcf_gt_phased(a1);
-			}
+	vrb.bullet("Number of XCF records processed: N = " + stb.str(n_lines));
+
+	//Free
+	free(input_buffer);
+	for (uint32_t b = 0 ; b < 3 ; b ++)
+		for (uint32_t r = 0 ; r < batch_size ; r ++)
+			for (uint32_t l = 0 ; l < batches[b][r].lines.size() ; l ++) bcf_destroy1(batches[b][r].lines[l]);
+	for (uint32_t b = 0 ; b < 3 ; b ++)
+		for (uint32_t r = 0 ; r < batch_size ; r ++) free(batches[b][r].text.s);
+
+	//Close files
+	XR.close();
+	XW.close();
+}
+
+//Read the next record into R; records depending on the previous ones [e.g. XOR coded] are decoded here
+bool binary2bcf::read(xcf_reader & XR, binary2bcf_record & R) {
+	if (!XR.nextRecord()) return false;
+
+	//Copy over variant information
+	R.chr = XR.chr; R.pos = XR.pos; R.ref = XR.ref; R.alt = XR.alt; R.rsid = XR.rsid;
+	R.n_allele = XR.n_allele;
+	R.AC = XR.getAC(); R.AN = XR.getAN(); R.ACs = XR.getACs();
+	R.af = XR.getAF();
+
+	//Get record
+	R.type = XR.typeRecord(0);
+	switch (R.type) {
+	case RECORD_SPARSE_MULTIALLELIC:
+		R.indices.resize(XR.sizeRecord(0) / sizeof(int32_t));
+		XR.readRecord(0, reinterpret_cast< char* > (R.indices.data()));
+		break;
+	case RECORD_DENSE_DOSAGE8:
+	case RECORD_DENSE_DOSAGE16:
+	case RECORD_SPARSE_DOSAGE:
+		R.bytes.resize(XR.sizeRecord(0));
+		XR.readRecord(0, R.bytes.data());
+		break;
+	case RECORD_BINARY_HAPLOID:
+	case RECORD_SPARSE_HAPLOID:
+		XR.readHaploidRecord(0, R.genotypes.data());
+		break;
+	case RECORD_BCFVCF_GENOTYPE:
+		XR.readRecord(0, reinterpret_cast< char** > (&input_buffer));
+		memcpy(R.genotypes.data(), input_buffer, 2 * nsamples_input * sizeof(int32_t));
+		break;
+	case RECORD_BINARY_GENOTYPE:
+	case RECORD_BINARY_HAPLOTYPE:
+	case RECORD_XOR_HAPLOTYPE:
+		XR.readBinaryRecord(0, R.binary.bytes);
+		break;
+	case RECORD_SHARDED_GENOTYPE:
+	case RECORD_SHARDED_HAPLOTYPE:
+		XR.readShardedRecord(0, R.binary.bytes, shard_groups.empty() ? NULL : &shard_groups);
+		break;
+	case RECORD_MISSING_HAPLOTYPE:
+		XR.readMissingRecord(0, R.binary.bytes, R.indices);
+		break;
+	case RECORD_SPARSE_GENOTYPE:
+	case RECORD_VBYTE_GENOTYPE:
+	case RECORD_SPARSE_HAPLOTYPE:
+	case RECORD_VBYTE_HAPLOTYPE:
+		R.indices.resize(2 * nsamples_input);
+		R.indices.resize(XR.readSparseRecord(0, R.indices.data()));
+		break;
+	default:
+		vrb.bullet("Unrecognized record type [" + stb.str(R.type) + "] at " + XR.chr + ":" + stb.str(XR.pos));
+	}
+	return true;
+}
+
+//Encode the record R as BCF records, or as VCF lines when writing VCF text; only depends on R, so that records can be encoded in any order
+void binary2bcf::encode(xcf_writer & XW, binary2bcf_record & R) {
+	R.text.l = 0;
+	if (!subs2full.empty()) subset(R);
+	if (XW.hts_text && encodeText(XW, R)) return;
+	encodeRecord(XW, R);
+	if (XW.hts_text) for (uint32_t l = 0 ; l < R.n_lines ; l ++) XW.formatRecord(R.lines[l], &R.text);
+}
+
+//Render the record R as a VCF line straight from packed or sparse genotypes; false for records needing the BCF path
+bool binary2bcf::encodeText(xcf_writer & XW, binary2bcf_record & R) {
+	switch (R.type) {
+	case RECORD_BINARY_GENOTYPE:
+	case RECORD_SHARDED_GENOTYPE:
+	case RECORD_SPARSE_GENOTYPE:
+	case RECORD_VBYTE_GENOTYPE:
+	case RECORD_BINARY_HAPLOTYPE:
+	case RECORD_XOR_HAPLOTYPE:
+	case RECORD_SHARDED_HAPLOTYPE:
+	case RECORD_MISSING_HAPLOTYPE:
+	case RECORD_SPARSE_HAPLOTYPE:
+	case RECORD_VBYTE_HAPLOTYPE: break;
+	default: return false;
+	}
+
+	//Site
+	R.n_lines = 1;
+	bcf_clear1(R.lines[0]);
+	XW.writeInfo(R.lines[0], R.chr, R.pos, R.ref, R.alt, R.rsid, R.AC, R.AN);
+	XW.formatSite(R.lines[0], &R.text);
+
+	//Sample columns, 4 characters each [TAB, allele, separator, allele]
+	size_t off = R.text.l;
+	if (ks_resize(&R.text, off + 4 * nsamples + 2) < 0) vrb.error("Failing to allocate VCF line");
+	char * out = R.text.s + off;
+	bool major = (R.af>=0.5f);
+	switch (R.type) {
+	case RECORD_BINARY_GENOTYPE:
+	case RECORD_SHARDED_GENOTYPE:
+		vcf_table::get().expand(vcf_table::get().gen, R.binary.bytes, nsamples, out);
+		break;
+	case RECORD_BINARY_HAPLOTYPE:
+	case RECORD_XOR_HAPLOTYPE:
+	case RECORD_SHARDED_HAPLOTYPE:
+		vcf_table::get().expand(vcf_table::get().hap, R.binary.bytes, nsamples, out);
+		break;
+	case RECORD_MISSING_HAPLOTYPE:
+		vcf_table::get().expand(vcf_table::get().hap, R.binary.bytes, nsamples, out);
+		for(uint32_t m = 0 ; m < R.indices.size() ; m++) out[4*(R.indices[m]/2) + 1 + 2*(R.indices[m]%2)] = '.';
+		break;
+	case RECORD_SPARSE_GENOTYPE:
+	case RECORD_VBYTE_GENOTYPE:
+		memcpy(out, text_major[major].data(), 4 * nsamples);
+		for(uint32_t r = 0 ; r < R.indices.size() ; r++) {
+			sparse_genotype rg;
+			rg.set(R.indices[r]);
+			out[4*rg.idx+1] = rg.mis ? '.' : ('0' + rg.al0);
+			out[4*rg.idx+3] = rg.mis ? '.' : ('0' + rg.al1);
 		}
+		break;
+	default:
+		memcpy(out, text_major[2 + major].data(), 4 * nsamples);
+		for(uint32_t r = 0 ; r < R.indices.size() ; r++) out[4*(R.indices[r]/2) + 1 + 2*(R.indices[r]%2)] = '0' + !major;
+	}
+	R.text.l = off + 4 * nsamples;
+	R.text.s[R.text.l++] = '\n';
+	R.text.s[R.text.l] = 0;
+	return true;
+}
 
-		//Convert from sparse genotypes
-		else if (type == RECORD_SPARSE_GENOTYPE) {
-			int32_t n_elements = XR.readRecord(idx_file, reinterpret_cast< char** > (&input_buffer)) / sizeof(int32_t);
-			//Set all genotypes as major
-			bool major = (XR.getAF()>0.5f);
-			std::fill(output_buffer, output_buffer+2*nsamples, bcf_gt_unphased(major));
-			//Loop over sparse genotypes
-			for(uint32_t r = 0 ; r < n_elements ; r++) {
-				sparse_genotype rg;
-				rg.set(input_buffer[r]);
-				if (rg.mis) {
-					output_buffer[2*rg.idx+0] = bcf_gt_missing;
-					output_buffer[2*rg.idx+1] = bcf_gt_missing;
-				} else {
-					output_buffer[2*rg.idx+0] = bcf_gt_unphased(rg.al0);
-					output_buffer[2*rg.idx+1] = bcf_gt_unphased(rg.al1);
-				}
+//Encode the record R as BCF records
+void binary2bcf::encodeRecord(xcf_writer & XW, binary2bcf_record & R) {
+	int32_t * output_buffer = R.genotypes.data();
+	R.n_lines = 1;
+
+	//Convert from sparse multiallelic, either as a single record or split in biallelic ones
+	if (R.type == RECORD_SPARSE_MULTIALLELIC) {
+		sparse_multiallelic::decode(R.indices.data(), nsamples, output_buffer);
+		if (split_multi) {
+			vector < string > alts;
+			stb.split(R.alt, alts, ',');
+			R.split.resize(2 * nsamples);
+			R.n_lines = R.n_allele - 1;
+			while (R.lines.size() < R.n_lines) R.lines.push_back(bcf_init1());
+			for (uint32_t a = 1 ; a < R.n_allele ; a ++) {
+				sparse_multiallelic::split(output_buffer, nsamples, a, R.split.data());
+				bcf_clear1(R.lines[a-1]);
+				XW.writeInfo(R.lines[a-1], R.chr, R.pos, R.ref, alts[a-1], R.rsid, R.ACs[a-1], R.AN);
+				XW.writeGenotypes(R.lines[a-1], reinterpret_cast<char*>(R.split.data()), 2 * nsamples * sizeof(int32_t));
 			}
+		} else {
+			bcf_clear1(R.lines[0]);
+			XW.writeInfo(R.lines[0], R.chr, R.pos, R.ref, R.alt, R.rsid, R.ACs, R.AN);
+			XW.writeGenotypes(R.lines[0], reinterpret_cast<char*>(output_buffer), 2 * nsamples * sizeof(int32_t));
 		}
+		return;
+	}
 
-		//Convert from sparse haplotypes
-		else if (type == RECORD_SPARSE_HAPLOTYPE) {
-			int32_t n_elements = XR.readRecord(idx_file, reinterpret_cast< char** > (&input_buffer)) / sizeof(int32_t);
-			//Set all genotypes as major
-			bool major = (XR.getAF()>0.5f);
-			std::fill(output_buffer, output_buffer+2*nsamples, bcf_gt_phased(major));
-			//Loop over sparse genotypes
-			for(uint32_t r = 0 ; r < n_elements ; r++) output_buffer[input_buffer[r]] = bcf_gt_phased(!major);
+	//Copy over variant information
+	bcf_clear1(R.lines[0]);
+	XW.writeInfo(R.lines[0], R.chr, R.pos, R.ref, R.alt, R.rsid, R.AC, R.AN);
+
+	//Convert from dosages; written as FORMAT/DS along with hard calls in FORMAT/GT
+	if (R.type == RECORD_DENSE_DOSAGE8 || R.type == RECORD_DENSE_DOSAGE16 || R.type == RECORD_SPARSE_DOSAGE) {
+		//Already decoded by subset() when subsampling
+		if (subs2full.empty()) {
+			R.dosages.resize(nsamples);
+			if (R.type == RECORD_SPARSE_DOSAGE) dosage_record::decodeSparse(R.bytes.data(), nsamples, R.dosages.data());
+			else dosage_record::decodeDense(R.bytes.data(), nsamples, (R.type == RECORD_DENSE_DOSAGE8) ? 8 : 16, R.dosages.data());
+			dosage_record::genotypes(R.dosages.data(), nsamples, output_buffer);
 		}
+		XW.writeGenotypes(R.lines[0], reinterpret_cast<char*>(output_buffer), 2 * nsamples * sizeof(int32_t), R.dosages.data(), nsamples);
+		return;
+	}
 
-		//Unknown record type
-		else vrb.bullet("Unrecognized record type [" + stb.str(type) + "] at " + XR.chr + ":" + stb.str(XR.pos));
+	//Convert from haploid records or BCF; already decoded when read [genotypes may have any ploidy]
+	if (R.type == RECORD_BINARY_HAPLOID || R.type == RECORD_SPARSE_HAPLOID || R.type == RECORD_BCFVCF_GENOTYPE) {
+		XW.writeGenotypes(R.lines[0], reinterpret_cast<char*>(output_buffer), 2 * nsamples * sizeof(int32_t));
+		return;
+	}
 
+	//Other records only hold 0, 1 or missing alleles; their int8 FORMAT/GT values are written in place
+	int8_t * gt = XW.writeGenotypes8(R.lines[0]);
+	const gt8_table & T = gt8_table::get();
 
-		//Write record
-		XW.writeRecord(RECORD_BCFVCF_GENOTYPE, reinterpret_cast<char*>(output_buffer), 2 * nsamples * sizeof(int32_t));
+	//Convert from binary genotypes
+	if (R.type == RECORD_BINARY_GENOTYPE || R.type == RECORD_SHARDED_GENOTYPE) T.expand(T.gen, R.binary.bytes, 2 * nsamples, gt);
 
-		//Counting
-		n_lines++;
+	//Convert from binary haplotypes
+	else if (R.type == RECORD_BINARY_HAPLOTYPE || R.type == RECORD_XOR_HAPLOTYPE || R.type == RECORD_SHARDED_HAPLOTYPE) T.expand(T.hap, R.binary.bytes, 2 * nsamples, gt);
 
-		//Verbose
-		if (n_lines % 10000 == 0) vrb.bullet("Number of XCF records processed: N = " + stb.str(n_lines));
+	//Convert from binary haplotypes with missing ones listed aside
+	else if (R.type == RECORD_MISSING_HAPLOTYPE) {
+		T.expand(T.hap, R.binary.bytes, 2 * nsamples, gt);
+		for(uint32_t m = 0 ; m < R.indices.size() ; m++) gt[R.indices[m]] = (R.indices[m] % 2) ? bcf_gt_phased(-1) : bcf_gt_missing;
 	}
 
-	vrb.bullet("Number of XCF records processed: N = " + stb.str(n_lines));
+	//Convert from sparse genotypes
+	else if (R.type == RECORD_SPARSE_GENOTYPE || R.type == RECORD_VBYTE_GENOTYPE) {
+		//Set all genotypes as major
+		bool major = (R.af>=0.5f);
+		memset(gt, bcf_gt_unphased(major), 2 * nsamples);
+		//Loop over sparse genotypes
+		for(uint32_t r = 0 ; r < R.indices.size() ; r++) {
+			sparse_genotype rg;
+			rg.set(R.indices[r]);
+			if (rg.mis) {
+				gt[2*rg.idx+0] = bcf_gt_missing;
+				gt[2*rg.idx+1] = bcf_gt_missing;
+			} else {
+				gt[2*rg.idx+0] = bcf_gt_unphased(rg.al0);
+				gt[2*rg.idx+1] = bcf_gt_unphased(rg.al1);
+			}
+		}
+	}
 
-	//Free
-	free(input_buffer);
-	free(output_buffer);
+	//Convert from sparse haplotypes
+	else if (R.type == RECORD_SPARSE_HAPLOTYPE || R.type == RECORD_VBYTE_HAPLOTYPE) {
+		//Set all genotypes as major
+		bool major = (R.af>=0.5f);
+		memset(gt, bcf_gt_phased(major), 2 * nsamples);
+		//Loop over sparse genotypes
+		for(uint32_t r = 0 ; r < R.indices.size() ; r++) gt[R.indices[r]] = bcf_gt_phased(!major);
+	}
 
-	//Close files
-	XR.close();
-	XW.close();
+	//Unknown record type; genotypes are set as missing
+	else memset(gt, bcf_gt_missing, 2 * nsamples);
 }
 
+//Restrict the record R to the kept samples, in place, and count AC/AN over them; only the kept samples are decoded or remapped
+//Sparse records list the carriers of the minor allele of the full input, so that R.af still drives their major allele
+void binary2bcf::subset(binary2bcf_record & R) {
+	const uint32_t n_haps = 2 * nsamples;
+	switch (R.type) {
+	case RECORD_BINARY_GENOTYPE:
+	case RECORD_SHARDED_GENOTYPE:
+	case RECORD_BINARY_HAPLOTYPE:
+	case RECORD_XOR_HAPLOTYPE:
+	case RECORD_SHARDED_HAPLOTYPE:
+	case RECORD_MISSING_HAPLOTYPE: {
+		//Kept samples are in input order, so their bits are compacted 64 at a time; both buffers are sized for the input
+		gather.gather(R.binary, R.kept);
+		swap(R.binary.bytes, R.kept.bytes);
+		bool genotype = (R.type == RECORD_BINARY_GENOTYPE || R.type == RECORD_SHARDED_GENOTYPE);
+		R.AC = bitgather::count(R.binary, n_haps, genotype);
+		R.AN = n_haps;
+		if (genotype) R.AN -= 2 * (bitgather::count(R.binary, n_haps, false) - R.AC);	//Missing genotypes [10] have a single bit set
+		if (R.type == RECORD_MISSING_HAPLOTYPE) {
+			uint32_t n = 0;
+			for (uint32_t m = 0 ; m < R.indices.size() ; m ++) {
+				int32_t h = gather.rank(R.indices[m]);
+				if (h >= 0) R.indices[n++] = h;
+			}
+			R.indices.resize(n);
+			R.AN -= n;
+		}
+		break;
+	}
+	case RECORD_SPARSE_GENOTYPE:
+	case RECORD_VBYTE_GENOTYPE: {
+		uint32_t n = 0, n_missing = 0;
+		R.AC = 0;
+		for (uint32_t e = 0 ; e < R.indices.size() ; e ++) {
+			sparse_genotype rg;
+			rg.set(R.indices[e]);
+			int32_t h = gather.rank(2*rg.idx);
+			if (h < 0) continue;
+			rg.idx = h / 2;
+			R.indices[n++] = rg.get();
+			if (rg.mis) n_missing ++;
+			else R.AC += rg.al0 + rg.al1;
+		}
+		R.indices.resize(n);
+		//Unlisted samples are Major/Major
+		if (R.af >= 0.5f) R.AC += 2 * (nsamples - n);
+		R.AN = n_haps - 2 * n_missing;
+		break;
+	}
+	case RECORD_SPARSE_HAPLOTYPE:
+	case RECORD_VBYTE_HAPLOTYPE: {
+		uint32_t n = 0;
+		for (uint32_t e = 0 ; e < R.indices.size() ; e ++) {
+			int32_t h = gather.rank(R.indices[e]);
+			if (h >= 0) R.indices[n++] = h;
+		}
+		R.indices.resize(n);
+		R.AC = (R.af >= 0.5f) ? (n_haps - n) : n;
+		R.AN = n_haps;
+		break;
+	}
+	case RECORD_SPARSE_MULTIALLELIC:
+		R.indices.resize(sparse_multiallelic::subset(R.indices.data(), gather, nsamples, R.ACs, R.AN));
+		R.AC = R.ACs.empty() ? 0 : R.ACs[0];
+		break;
+	case RECORD_DENSE_DOSAGE8:
+	case RECORD_DENSE_DOSAGE16:
+	case RECORD_SPARSE_DOSAGE:
+	case RECORD_BINARY_HAPLOID:
+	case RECORD_SPARSE_HAPLOID:
+	case RECORD_BCFVCF_GENOTYPE: {
+		//Dosages are decoded for all samples [dense coding], then kept ones give their hard calls
+		if (R.type == RECORD_DENSE_DOSAGE8 || R.type == RECORD_DENSE_DOSAGE16 || R.type == RECORD_SPARSE_DOSAGE) {
+			R.dosages.resize(nsamples_input);
+			if (R.type == RECORD_SPARSE_DOSAGE) dosage_record::decodeSparse(R.bytes.data(), nsamples_input, R.dosages.data());
+			else dosage_record::decodeDense(R.bytes.data(), nsamples_input, (R.type == RECORD_DENSE_DOSAGE8) ? 8 : 16, R.dosages.data());
+			for (uint32_t i = 0 ; i < nsamples ; i ++) R.dosages[i] = R.dosages[subs2full[i]];
+			R.dosages.resize(nsamples);
+			dosage_record::genotypes(R.dosages.data(), nsamples, R.genotypes.data());
+		} else {
+			//Kept samples are in input order, so genotypes are compacted in place
+			for (uint32_t i = 0 ; i < nsamples ; i ++) {
+				R.genotypes[2*i+0] = R.genotypes[2*subs2full[i]+0];
+				R.genotypes[2*i+1] = R.genotypes[2*subs2full[i]+1];
+			}
+		}
+		R.ACs.assign(max(1U, R.n_allele) - 1, 0);
+		R.AN = 0;
+		xcf_reader::countAlleles(R.genotypes.data(), n_haps, bcf_int32_vector_end, R.ACs, R.AN);
+		R.AC = R.ACs.empty() ? 0 : R.ACs[0];
+		break;
+	}
+	}
+}
@@ -27,9 +27,41 @@
 #define CONV_BCF_BH	1
 #define CONV_BCF_SG	2
 #define CONV_BCF_SH	3
+#define CONV_BCF_BD	4
+#define CONV_BCF_SD	5
+
+//Memory used by a batch of records in multi-threaded conversions
+#define BINARY2BCF_BATCH_BYTES	(64U << 20)
 
 #include <utils/otools.h>
+#include <utils/xcf.h>
+#include <containers/bitvector.h>
+#include <containers/bitgather.h>
+
+//A record travelling through the conversion pipeline [read, then encoded as BCF records, then written in order]
+class binary2bcf_record {
+public:
+	//Variant information
+	std::string chr, ref, alt, rsid;
+	uint32_t pos, n_allele, AC, AN;
+	std::vector < uint32_t > ACs;
+	float af;
 
+	//Input data
+	int32_t type;
+	bitvector binary;							//Dense records
+	bitvector kept;								//Dense records restricted to the subset of samples [swapped with binary]
+	std::vector < int32_t > indices;			//Sparse records, or missing haplotypes of dense ones
+	std::vector < char > bytes;					//Any other coded record
+
+	//Output data
+	std::vector < int32_t > genotypes;			//FORMAT/GT, 2 per sample
+	std::vector < int32_t > split;				//FORMAT/GT of one biallelic record split from a multiallelic one
+	std::vector < float > dosages;				//FORMAT/DS, 1 per sample
+	std::vector < bcf1_t * > lines;				//Encoded BCF records [several when multiallelics are split]
+	uint32_t n_lines;
+	kstring_t text;								//Encoded VCF lines, when writing VCF text
+};
 
 class binary2bcf {
 public:
@@ -37,6 +69,16 @@ public:
 	//PARAM
 	std::string region;
 	int nthreads;
+	bool split_multi;
+
+	//DATA
+	uint32_t nsamples;						//Samples written in the output
+	uint32_t nsamples_input;				//Samples of the input
+	std::vector < int32_t > subs2full;		//Input indices of the kept samples [empty when all are kept]
+	bitgather gather;						//Haplotypes of the kept samples [dense compaction and sparse remapping]
+	std::vector < bool > shard_groups;		//Groups of samples to read in sharded records [all when empty]
+	int32_t * input_buffer;
+	std::vector < std::string > text_major;	//Sample columns with all genotypes major [phased x major allele], patched for sparse records
 
 	//CONSTRUCTORS/DESCTRUCTORS
 	binary2bcf(std::string, int);
@@ -44,6 +86,12 @@ public:
 
 	//PROCESS
 	void convert(std::string, std::string);
+	void convert(std::string, std::string, const bool exclude, const bool isforce, std::vector<std::string>& smpls);
+	bool read(xcf_reader &, binary2bcf_record &);
+	void encode(xcf_writer &, binary2bcf_record &);
+	void encodeRecord(xcf_writer &, binary2bcf_record &);
+	bool encodeText(xcf_writer &, binary2bcf_record &);
+	void subset(binary2bcf_record &);
 };
 
 #endif
@@ -4,6 +4,8 @@
 
 #include <containers/bitvector.h>
 #include <objects/sparse_genotype.h>
+#include <objects/sparse_multiallelic.h>
+#include <objects/dosage_record.h>
 
 binary2binary::binary2binary(std::string _region, float _minmaf, int _nthreads, int _mode, bool _drop_info)
 {
@@ -12,16 +14,21 @@ binary2binary::binary2binary(std::string _region, float _minmaf, int _nthreads,
 	region = _region;
 	minmaf = _minmaf;
 	drop_info = _drop_info;
+	compress_sparse = false;
+	adaptive = false;
+	align = false;
+	xor_keyframe = 0;
+	shard_size = 0;
 }
 
 binary2binary::~binary2binary()
 {
 }
 
-int32_t binary2binary::parse_genotypes(xcf_reader& XR, const uint32_t idx_file)
+int32_t binary2binary::parse_genotypes(xcf_reader& XR, const uint32_t idx_file, int32_t& type)
 {
 	//Get type of record
-	const int32_t type = XR.typeRecord(idx_file);
+	type = XR.typeRecord(idx_file);
 	int32_t n_elements = XR.ind_names[idx_file].size();
 	if (type == RECORD_BCFVCF_GENOTYPE) {
 		XR.readRecord(idx_file, reinterpret_cast< char** > (&sparse_int_buf));
@@ -29,506 +36,615 @@ int32_t binary2binary::parse_genotypes(xcf_reader& XR, const uint32_t idx_file)
 	else if (type == RECORD_BINARY_GENOTYPE) {
 		XR.readRecord(idx_file, reinterpret_cast< char** > (&binary_bit_buf.bytes));
 	}
-	else if (type == RECORD_BINARY_HAPLOTYPE) {
-		XR.readRecord(idx_file, reinterpret_cast< char** > (&binary_bit_buf.bytes));
+	else if (type == RECORD_BINARY_HAPLOTYPE || type == RECORD_XOR_HAPLOTYPE) {
+		XR.readBinaryRecord(idx_file, binary_bit_buf.bytes);
+		type = RECORD_BINARY_HAPLOTYPE;
+	}
+	else if (type == RECORD_SHARDED_GENOTYPE || type == RECORD_SHARDED_HAPLOTYPE) {
+		XR.readShardedRecord(idx_file, binary_bit_buf.bytes, shard_groups.empty() ? NULL : &shard_groups);
+		type = (type == RECORD_SHARDED_GENOTYPE) ? RECORD_BINARY_GENOTYPE : RECORD_BINARY_HAPLOTYPE;
 	}
-	else if (type == RECORD_SPARSE_GENOTYPE) {
-		n_elements = XR.readRecord(idx_file, reinterpret_cast< char** > (&sparse_int_buf)) / sizeof(int32_t);
+	else if (type == RECORD_SPARSE_GENOTYPE || type == RECORD_VBYTE_GENOTYPE) {
+		n_elements = XR.readSparseRecord(idx_file, sparse_int_buf.data());
+		type = RECORD_SPARSE_GENOTYPE;
 	}
-	else if (type == RECORD_SPARSE_HAPLOTYPE) {
-		n_elements = XR.readRecord(idx_file, reinterpret_cast< char** > (&sparse_int_buf)) / sizeof(int32_t);
+	else if (type == RECORD_SPARSE_HAPLOTYPE || type == RECORD_VBYTE_HAPLOTYPE) {
+		n_elements = XR.readSparseRecord(idx_file, sparse_int_buf.data());
+		type = RECORD_SPARSE_HAPLOTYPE;
 	}
 	else vrb.bullet("Unrecognized record type [" + stb.str(type) + "] at " + XR.chr + ":" + stb.str(XR.pos));
 
 	return n_elements;
 }
 
-void binary2binary::convert(std::string finput, std::string foutput)
+//Sparse records from binary records; only non Major/Major genotypes or minor haplotypes are kept
+static int32_t binary2sparse(bitvector& bin, int32_t* sparse, uint32_t nsamples, bool genotype, bool minor)
 {
-	tac.clock();
-	switch (mode)
-	{
-		case CONV_BCF_BG: vrb.title("Converting from XCF to XCF [Binary/Genotype]"); break;
-		case CONV_BCF_BH: vrb.title("Converting from XCF to XCF [Binary/Haplotype]"); break;
-		case CONV_BCF_SG: vrb.title("Converting from XCF to XCF [Sparse/Genotype]"); break;
-		case CONV_BCF_SH: vrb.title("Converting from XCF to XCF [Sparse/Haplotype]"); break;
+	int32_t n = 0;
+	if (genotype) {
+		for (uint32_t i = 0 ; i < nsamples ; i++) {
+			const bool a0 = bin.get(2*i+0);
+			const bool a1 = bin.get(2*i+1);
+			const bool mi = (a0 && !a1);											//Missing as 10
+			const bool he = (!a0 && a1);											//Hets as 01
+			if (mi || he || a0 == minor) sparse[n++] = sparse_genotype(i, he, mi, a0 && !mi, a1, 0).get();
+		}
+	} else {
+		for (uint32_t i = 0 ; i < 2 * nsamples ; i++)
+			if (bin.get(i) == minor) sparse[n++] = i;
 	}
+	return n;
+}
 
-	if (region.empty()) vrb.bullet("Region        : All");
-	else vrb.bullet("Region        : " + stb.str(region));
-
-	if (mode == CONV_BCF_SG || mode == CONV_BCF_SH) vrb.bullet("Min MAF       : " + stb.str(minmaf));
-
+//Binary records from sparse records; unlisted samples are Major/Major
+static void sparse2binary(int32_t* sparse, int32_t n, bitvector& bin, bool genotype, bool minor)
+{
+	bin.set(!minor);
+	if (genotype) {
+		for (int32_t e = 0 ; e < n ; e++) {
+			sparse_genotype rg;
+			rg.set(sparse[e]);
+			if (rg.mis) { bin.set(2*rg.idx+0, true); bin.set(2*rg.idx+1, false); }		//Missing as 10
+			else if (rg.het) { bin.set(2*rg.idx+0, false); bin.set(2*rg.idx+1, true); }	//Hets as 01
+			else { bin.set(2*rg.idx+0, rg.al0); bin.set(2*rg.idx+1, rg.al1); }
+		}
+	} else {
+		for (int32_t e = 0 ; e < n ; e++) bin.set(sparse[e], minor);
+	}
+}
 
-	xcf_reader XR(1);
-	const uint32_t idx_file = XR.addFile(finput);
-	const int32_t typef = XR.typeFile(idx_file);
-	if (typef != FILE_BINARY) vrb.error("[" + finput + "] is not a XCF file");
-	uint32_t nsamples_input = XR.ind_names[idx_file].size();
-	xcf_writer XW(foutput, false, nthreads);
-	bcf1_t* rec = XW.hts_record;
+//Sparse records listing the carriers of the other allele, merged from the sorted list; returns the number of elements
+static int32_t sparse_complement(const int32_t* sparse, int32_t n, uint32_t nsamples, bool genotype, bool minor, int32_t* out)
+{
+	int32_t c = 0;
+	if (genotype) {
+		//Unlisted samples were homozygous for the new minor allele; listed ones are kept unless homozygous for the major one
+		int32_t e = 0;
+		for (uint32_t i = 0 ; i < nsamples ; i++) {
+			sparse_genotype rg;
+			if (e < n) rg.set(sparse[e]);
+			if (e < n && rg.idx == i) {
+				if (rg.mis || rg.het || rg.al0 == minor) out[c++] = sparse[e];
+				e++;
+			} else out[c++] = sparse_genotype(i, false, false, minor, minor, 0).get();
+		}
+	} else {
+		uint32_t h = 0;
+		for (int32_t e = 0 ; e < n ; e++, h++)
+			for ( ; h < (uint32_t)sparse[e] ; h++) out[c++] = h;
+		for ( ; h < 2 * nsamples ; h++) out[c++] = h;
+	}
+	return c;
+}
 
-	if (drop_info) XW.writeHeader(XR.sync_reader->readers[0].header, XR.ind_names[idx_file], std::string("XCFtools ") + std::string(XCFTLS_VERSION));
-	else XW.writeHeaderClone(XR.sync_reader->readers[0].header,XR.ind_names[idx_file], std::string("XCFtools ") + std::string(XCFTLS_VERSION));
+//Writes a record in the output encoding, converting from the input encoding when needed. Returns true when written as sparse.
+bool binary2binary::write_genotypes(xcf_writer& XW, int32_t type, bitvector& bin, int32_t* sparse, int32_t n, uint32_t nsamples, bool sparse_minor, bool minor, bool rare)
+{
+	const bool genotype = (mode == CONV_BCF_SG || mode == CONV_BCF_BG);
+	const bool sparse_mode = (mode == CONV_BCF_SG || mode == CONV_BCF_SH);
+	if (genotype && type != RECORD_SPARSE_GENOTYPE && type != RECORD_BINARY_GENOTYPE) vrb.error("Converting non-genotype type to genotype type!");
+	if (!genotype && type != RECORD_SPARSE_HAPLOTYPE && type != RECORD_BINARY_HAPLOTYPE) vrb.error("Converting non-haplotype type to haplotype type!");
+	bool in_sparse = (type == RECORD_SPARSE_GENOTYPE || type == RECORD_SPARSE_HAPLOTYPE);
+
+	//Sparse records list carriers of the minor allele, which may flip after subsetting
+	if (in_sparse && sparse_minor != minor) {
+		if (sparse_mode && (rare || adaptive)) {
+			n = sparse_complement(sparse, n, nsamples, genotype, minor, sparse_int_cpl.data());
+			sparse = sparse_int_cpl.data();
+		} else {
+			sparse2binary(sparse, n, bin, genotype, sparse_minor);
+			in_sparse = false;
+		}
+	}
 
-	binary_bit_buf.allocate(2 * nsamples_input);
-	sparse_int_buf.resize(2 * nsamples_input,0);
+	//Pick encoding
+	uint32_t out_type = genotype ? RECORD_BINARY_GENOTYPE : RECORD_BINARY_HAPLOTYPE;
+	if (sparse_mode && (rare || adaptive)) {
+		if (!in_sparse) n = binary2sparse(bin, sparse, nsamples, genotype, minor);
+		if (adaptive) out_type = XW.cheapestRecord(genotype, sparse, n, bin.n_bytes);
+		else if (genotype) out_type = compress_sparse ? RECORD_VBYTE_GENOTYPE : RECORD_SPARSE_GENOTYPE;
+		else out_type = compress_sparse ? RECORD_VBYTE_HAPLOTYPE : RECORD_SPARSE_HAPLOTYPE;
+		in_sparse = true;
+	}
 
-	uint32_t n_lines_rare = 0, n_lines_comm = 0;
+	//Write record
+	if (out_type == RECORD_BINARY_GENOTYPE || out_type == RECORD_BINARY_HAPLOTYPE) {
+		if (in_sparse) sparse2binary(sparse, n, bin, genotype, minor);
+		if (out_type == RECORD_BINARY_HAPLOTYPE) XW.writeHaplotypeRecord(bin.bytes, bin.n_bytes);
+		else XW.writeRecord(out_type, bin.bytes, bin.n_bytes);
+		return false;
+	}
+	XW.writeSparseRecord(out_type, sparse, n);
+	return true;
+}
 
-	while (XR.nextRecord())
+static std::string modeName(int mode)
+{
+	switch (mode)
 	{
-		//Is that a rare variant?
-		float af =  XR.getAF();
-		float maf = std::min(af, 1.0f-af);
-		bool minor = (af < 0.5f);
-		bool rare = (maf < minmaf);
+		case CONV_BCF_BG: return "Binary/Genotype";
+		case CONV_BCF_BH: return "Binary/Haplotype";
+		case CONV_BCF_SG: return "Sparse/Genotype";
+		case CONV_BCF_SH: return "Sparse/Haplotype";
+	}
+	return "Unknown";
+}
 
-		if (drop_info)
-			XW.writeInfo(XR.chr, XR.pos, XR.ref, XR.alt, XR.rsid, XR.getAC(), XR.getAN());
-		else
-			XW.hts_record = XR.sync_lines[0];
+//Type of the record written for a variant when it is known without decoding it [RECORD_VOID otherwise]
+int32_t binary2binary::passthrough_type(bool rare)
+{
+	const bool genotype = (mode == CONV_BCF_SG || mode == CONV_BCF_BG);
+	const bool sparse_mode = (mode == CONV_BCF_SG || mode == CONV_BCF_SH);
+	if (sparse_mode && adaptive) return RECORD_VOID;
+	if (sparse_mode && rare) {
+		if (genotype) return compress_sparse ? RECORD_VBYTE_GENOTYPE : RECORD_SPARSE_GENOTYPE;
+		else return compress_sparse ? RECORD_VBYTE_HAPLOTYPE : RECORD_SPARSE_HAPLOTYPE;
+	}
+	if (genotype) return RECORD_BINARY_GENOTYPE;
+	return xor_keyframe ? RECORD_VOID : RECORD_BINARY_HAPLOTYPE;
+}
 
-		int32_t n_elements = parse_genotypes(XR,idx_file);
-		const int32_t type = XR.typeRecord(idx_file);
+//Input indices of the samples kept in a subset, in input order
+void binary2binary::subsample_samples(xcf_reader& XR, const uint32_t idx_file, const bool exclude, const bool isforce, std::vector<std::string>& smpls, std::vector<int32_t>& subs2full)
+{
+	const int32_t nsamples_input = XR.ind_names[idx_file].size();
+	std::map<std::string, int32_t> map_str2int_inc;
+	std::set<int32_t> set_int2str_inc;
 
-		//Write record
-		if (mode == CONV_BCF_SG && rare)
-		{
-			if (type==RECORD_SPARSE_GENOTYPE)
-				XW.writeRecord(RECORD_SPARSE_GENOTYPE, reinterpret_cast<char*>(sparse_int_buf.data()), n_elements * sizeof(int32_t));
-			else if (type==RECORD_BINARY_GENOTYPE)
-			{
-				//conversion: BINARY gen -> sparse
-				n_elements=0;
-				for(uint32_t i = 0 ; i < nsamples_input ; i++)
-				{
-					const bool a0 = binary_bit_buf.get(2*i+0);
-					const bool a1 = binary_bit_buf.get(2*i+1);
-					sparse_int_buf[n_elements++] = sparse_genotype(i, (a0!=a1), (a0 && !a1), a0, a1, 0).get();
-				}
-				XW.writeRecord(RECORD_SPARSE_GENOTYPE, reinterpret_cast<char*>(sparse_int_buf.data()), n_elements * sizeof(int32_t));
-			}
-			else vrb.error("Converting non-genotype type to genotype type!");
-		}
-		else if (mode == CONV_BCF_SH && rare)
+	for (int32_t i=0; i<nsamples_input; i++)
+		map_str2int_inc[XR.ind_names[idx_file][i]] = i;
+
+	for (auto i=0; i<smpls.size(); i++)
+	{
+		if (map_str2int_inc.find(smpls[i]) == map_str2int_inc.end())
 		{
-			if (type==RECORD_SPARSE_HAPLOTYPE)
-				XW.writeRecord(RECORD_SPARSE_HAPLOTYPE, reinterpret_cast<char*>(sparse_int_buf.data()), n_elements * sizeof(int32_t));
-			else if (type==RECORD_BINARY_HAPLOTYPE)
-			{
-				//conversion: BINARY hap -> sparse
-				n_elements=0;
-			    for (size_t i = 0; i < nsamples_input; ++i)
-			    {
-			        if (binary_bit_buf.get(i) == true)
-			        	sparse_int_buf[n_elements++]=i;
-			    }
-				XW.writeRecord(RECORD_SPARSE_HAPLOTYPE, reinterpret_cast<char*>(sparse_int_buf.data()), n_elements * sizeof(int32_t));
+			const std::string call = exclude ? "Exclude" : "Include";
+			if (isforce) {
+				vrb.warning(call + " called for sample that does not exist in header: " + smpls[i] + "... skipping");
+			} else {
+				vrb.error(call + " called for sample that does not exist in header: " + smpls[i] + ". Use \"--force-samples\" to ignore this error.");
 			}
-			else vrb.error("Converting non-haplotype type to haplotype type!");
 		}
-		else if (mode == CONV_BCF_SG || mode == CONV_BCF_BG)
+		else if (exclude) map_str2int_inc[smpls[i]] = -1;
+		else set_int2str_inc.insert(map_str2int_inc[smpls[i]]);
+	}
+
+	subs2full.clear();
+	if (exclude)
+	{
+		for (int32_t i=0; i<nsamples_input; i++)
+			if (map_str2int_inc[XR.ind_names[idx_file][i]] >= 0) subs2full.push_back(i);
+	}
+	else subs2full.assign(set_int2str_inc.begin(), set_int2str_inc.end());
+
+	if (subs2full.empty()) vrb.error("Subsetting has removed all samples");
+}
+
+//Subsamples the record decoded by parse_genotypes into bin or sparse; ac is set to the ALT allele count of the subset
+int32_t binary2binary::subsample_genotypes(int32_t type, int32_t n_elements_full, bool minor_full, const bitgather& gather, uint32_t nsamples, bitvector& bin, int32_t* sparse, size_t& ac)
+{
+	int32_t n_elements_subs = 0;
+	ac = 0;
+
+	if (type==RECORD_SPARSE_GENOTYPE)
+	{
+		for (auto i=0; i<n_elements_full;++i)
 		{
-			if (type==RECORD_BINARY_GENOTYPE)
-				XW.writeRecord(RECORD_BINARY_GENOTYPE, binary_bit_buf.bytes, binary_bit_buf.n_bytes);
-			else if (type==RECORD_SPARSE_GENOTYPE)
+			sparse_genotype rg = sparse_genotype(sparse_int_buf[i]);
+			const int32_t h = gather.rank(2*rg.idx);
+			if (h >= 0)
 			{
-				binary_bit_buf.set(false);
-				for (auto gt : sparse_int_buf)
-				{
-					sparse_genotype rg;
-					rg.set(gt);
-					if (rg.mis) {
-						binary_bit_buf.set(2*rg.idx+0, true);
-						//binary_bit_buf.set(2*rg.idx+1) = false;
-					} else {
-						binary_bit_buf.set(2*rg.idx+0,rg.al0);
-						binary_bit_buf.set(2*rg.idx+1,rg.al1);
-					}
-				}
-				XW.writeRecord(RECORD_BINARY_GENOTYPE, binary_bit_buf.bytes, binary_bit_buf.n_bytes);
+				rg.idx = h / 2;
+				sparse[n_elements_subs++] = rg.get();
+				if (!rg.mis) ac+=rg.al0 + rg.al1;
 			}
-			else vrb.error("Converting non-genotype type to genotype type!");
 		}
-		else
+		//Unlisted samples are Major/Major
+		if (!minor_full) ac += 2 * (nsamples - n_elements_subs);
+	}
+	else if (type==RECORD_SPARSE_HAPLOTYPE)
+	{
+		for (auto i=0; i<n_elements_full;++i)
 		{
-			if (type==RECORD_BINARY_HAPLOTYPE)
-				XW.writeRecord(RECORD_BINARY_HAPLOTYPE, binary_bit_buf.bytes, binary_bit_buf.n_bytes);
-			else if (type==RECORD_SPARSE_HAPLOTYPE)
-			{
-				//conversion: SPARSE hap -> binary
-				binary_bit_buf.set(!minor);
-				for (auto index : sparse_int_buf)
-					binary_bit_buf.set(index,minor);
-				XW.writeRecord(RECORD_BINARY_GENOTYPE, binary_bit_buf.bytes, binary_bit_buf.n_bytes);
-			}
-			else vrb.error("Converting non-haplotype type to haplotype type!");
-		}
-		//Line counting
-		n_lines_comm += !rare || mode == CONV_BCF_BG || mode == CONV_BCF_BH;
-		n_lines_rare += rare && (mode == CONV_BCF_SG || mode == CONV_BCF_SH);
-
-		//Verbose
-		if ((n_lines_comm+n_lines_rare) % 10000 == 0) {
-			if (mode == CONV_BCF_BG || mode == CONV_BCF_BH) vrb.bullet("Number of BCF records processed: N=" + stb.str(n_lines_comm));
-			else vrb.bullet("Number of BCF records processed: Nc=" + stb.str(n_lines_comm) + "/ Nr=" + stb.str(n_lines_rare));
+			const int32_t h = gather.rank(sparse_int_buf[i]);
+			if (h >= 0) sparse[n_elements_subs++] = h;
 		}
+		ac = (minor_full) ? n_elements_subs : 2*nsamples-n_elements_subs;
 	}
-	if (mode == CONV_BCF_BG || mode == CONV_BCF_BH) vrb.bullet("Number of records processed: N=" + stb.str(n_lines_comm));
-	else vrb.bullet("Number of records processed: Nc=" + stb.str(n_lines_comm) + "/ Nr=" + stb.str(n_lines_rare));
-
-	if (!drop_info) XW.hts_record = rec;
+	else if (type==RECORD_BINARY_GENOTYPE || type==RECORD_BINARY_HAPLOTYPE)
+	{
+		//Kept samples are in input order, so their bits are compacted 64 at a time
+		gather.gather(binary_bit_buf, bin);
+		ac = bitgather::count(bin, 2*nsamples, type==RECORD_BINARY_GENOTYPE);	//Missing genotypes as 10
+		n_elements_subs=2*nsamples;
+	}
+	return n_elements_subs;
+}
 
-	XW.close();//always close XW first? important for multithreading if set
-	XR.close();
+void binary2binary::convert(std::string finput, std::string foutput)
+{
+	std::vector < binary2binary_output > outputs = { { foutput, mode, minmaf, false, std::vector < std::string > () } };
+	convert(finput, outputs, false);
 }
 
 void binary2binary::convert(std::string finput, std::string foutput, const bool exclude, const bool isforce, std::vector<std::string>& smpls)
 {
 	assert(!smpls.empty());
+	std::vector < binary2binary_output > outputs = { { foutput, mode, minmaf, exclude, smpls } };
+	convert(finput, outputs, isforce);
+}
+
+//Writer and sample subset of an output during a conversion
+struct binary2binary_sink {
+	binary2binary * conv;					//Encoding of the output, with its own buffers
+	xcf_writer * XW;
+	std::vector < int32_t > subs2full;		//Input indices of the kept samples [empty when all are kept]
+	bitgather gather;						//Haplotypes of the kept samples [dense compaction and sparse remapping]
+	uint32_t n_lines_rare, n_lines_comm, n_lines_copied;
+};
+
+//Each record is read and decoded once, then subsampled and encoded for every output
+void binary2binary::convert(std::string finput, std::vector < binary2binary_output > & outputs, const bool isforce)
+{
 	tac.clock();
 
-	xcf_reader XR(1);
+	xcf_reader XR(region, 1);
+	XR.multi = true;
 	const uint32_t idx_file = XR.addFile(finput);
 	const int32_t typef = XR.typeFile(idx_file);
 	if (typef != FILE_BINARY) vrb.error("[" + finput + "] is not a XCF file");
 	uint32_t nsamples_input = XR.ind_names[idx_file].size();
 
-	std::vector<std::string> sample_names;
-	std::vector<std::string> sample_fathers;
-	std::vector<std::string> sample_mothers;
-	std::vector<std::string> sample_pops;
-	std::vector<int32_t> subs2full;
-	std::vector<int32_t> full2subs(2*nsamples_input,-1);
-	bitvector subsample_bit;
-
-	if (exclude)
+	//Sample subsets
+	std::vector < binary2binary_sink > sinks (outputs.size());
+	bool subsampled = false;
+	for (uint32_t o = 0 ; o < outputs.size() ; o ++)
 	{
-		std::map<std::string, int32_t> map_str2int_inc;
-	    for (int32_t i=0; i<nsamples_input; i++)
-	    	map_str2int_inc[XR.ind_names[idx_file][i]] = i;
-
-		for (auto i=0; i<smpls.size(); i++)
+		binary2binary_sink & S = sinks[o];
+		if (outputs[o].samples.empty()) continue;
+		subsample_samples(XR, idx_file, outputs[o].exclude, isforce, outputs[o].samples, S.subs2full);
+		if (S.subs2full.size() == nsamples_input)
 		{
-			if (map_str2int_inc.find(smpls[i]) == map_str2int_inc.end())
-			{
-				if (isforce) {
-					vrb.warning("Exclude called for sample that does not exist in header: " + smpls[i] + "... skipping");
-				} else {
-					vrb.error("Exclude called for sample that does not exist in header: " + smpls[i] + ". Use \"--force-samples\" to ignore this error.");
-				}
-			}
-			map_str2int_inc[smpls[i]] = -1;
+			vrb.warning("No individual to remove in [" + outputs[o].fname + "]. Proceeding without subsampling.");
+			S.subs2full.clear();
+			continue;
 		}
-
-		for (auto i=0; i<nsamples_input; i++)
-		{
-			if (map_str2int_inc[XR.ind_names[idx_file][i]] < 0) continue;
-			sample_names.push_back(XR.ind_names[idx_file][i]);
-			sample_fathers.push_back(XR.ind_fathers[idx_file][i]);
-			sample_mothers.push_back(XR.ind_mothers[idx_file][i]);
-			sample_pops.push_back(XR.ind_pops[idx_file][i]);
-
-			if (mode==CONV_BCF_BG || mode==CONV_BCF_SG)
-			{
-				subs2full.push_back(i);
-				full2subs[i] = subs2full.size()-1;
-			}
-			else
-			{
-				subs2full.push_back(i*2+0);
-				full2subs[i*2+0] = subs2full.size()-1;
-				subs2full.push_back(i*2+1);
-				full2subs[i*2+1] = subs2full.size()-1;
-			}
+		std::vector < uint32_t > kept_bits;
+		for (uint32_t i = 0 ; i < S.subs2full.size() ; i ++) {
+			kept_bits.push_back(2*S.subs2full[i]+0);
+			kept_bits.push_back(2*S.subs2full[i]+1);
 		}
-	}
-	else
-	{
-		std::map<std::string, int32_t> map_str2int_inc;
-		std::set<int32_t> set_int2str_inc;
-
-	    for (int32_t i=0; i<nsamples_input; i++)
-	    	map_str2int_inc[XR.ind_names[idx_file][i]] = i;
-
-	    for (auto i=0; i<smpls.size(); i++)
-	    {
-	    	if (map_str2int_inc.find(smpls[i]) == map_str2int_inc.end())
-	    	{
-				if (isforce) {
-					vrb.warning("Exclude called for sample that does not exist in header: " + smpls[i] + "... skipping");
-				} else {
-					vrb.error("Exclude called for sample that does not exist in header: " + smpls[i] + ". Use \"--force-samples\" to ignore this error.");
-				}
-	    	} else
-	    	{
-	    		int32_t val = map_str2int_inc[smpls[i]];
-	    		set_int2str_inc.insert(val);
-	    	}
-	    }
-
-	    for (auto it = set_int2str_inc.begin(); it != set_int2str_inc.end(); ++it)
-	    {
-			sample_names.push_back(XR.ind_names[idx_file][*it]);
-			sample_fathers.push_back(XR.ind_fathers[idx_file][*it]);
-			sample_mothers.push_back(XR.ind_mothers[idx_file][*it]);
-			sample_pops.push_back(XR.ind_pops[idx_file][*it]);
-
-			if (mode==CONV_BCF_BG || mode==CONV_BCF_SG)
-			{
-				subs2full.push_back(*it);
-				full2subs[*it] = subs2full.size()-1;
-			}
-			else
-			{
-				subs2full.push_back((*it));
-				full2subs[(*it)*2+0] = 2*(subs2full.size()-1)+0;
-				full2subs[(*it)*2+1] = 2*(subs2full.size()-1)+1;
-			}
-	    }
-	}
-	if (sample_names.empty())
-	{
-		vrb.error("Subsetting has removed all samples");
-	}
-	else if (sample_names.size() == nsamples_input)
-	{
-		XR.close();
-		vrb.warning("No individual to remove. Proceeding without subsampling.");
-		convert(finput, foutput);
-		return;
+		S.gather.set(kept_bits, 2 * nsamples_input);
+		subsampled = true;
 	}
 
-	subsample_bit.allocate(2*nsamples_input);
-	for (auto i=0; i<subs2full.size(); ++i)
+	if (outputs.size() == 1) vrb.title("Converting from XCF to XCF [" + modeName(outputs[0].mode) + "]");
+	else vrb.title("Converting from XCF to " + stb.str(outputs.size()) + " XCF files in a single pass");
+
+	if (region.empty()) vrb.bullet("Region        : All");
+	else vrb.bullet("Region        : " + helper_tools::regionName(region));
+
+	for (uint32_t o = 0 ; o < outputs.size() ; o ++)
 	{
-		if (mode==CONV_BCF_BG || mode==CONV_BCF_SG)
-			subsample_bit.set(subs2full[i], true);
-		else
-		{
-			subsample_bit.set(2*subs2full[i]+0, true);
-			subsample_bit.set(2*subs2full[i]+1, true);
+		const bool sparse_mode = (outputs[o].mode == CONV_BCF_SG || outputs[o].mode == CONV_BCF_SH);
+		std::string encoding = "";
+		if (sparse_mode && adaptive) encoding = "Encoding      : Smallest per variant";
+		else if (sparse_mode) encoding = "Min MAF       : " + stb.str(outputs[o].minmaf);
+		if (outputs.size() == 1) {
+			if (!encoding.empty()) vrb.bullet(encoding);
+			continue;
 		}
+		vrb.bullet("Output        : [" + outputs[o].fname + "] / " + modeName(outputs[o].mode) + " / " + stb.str(sinks[o].subs2full.empty() ? nsamples_input : sinks[o].subs2full.size()) + " samples");
+		if (!encoding.empty()) vrb.bullet2(encoding);
 	}
 
-	switch (mode)
-	{
-		case CONV_BCF_BG: vrb.title("Converting from XCF to XCF [Binary/Genotype]"); break;
-		case CONV_BCF_BH: vrb.title("Converting from XCF to XCF [Binary/Haplotype]"); break;
-		case CONV_BCF_SG: vrb.title("Converting from XCF to XCF [Sparse/Genotype]"); break;
-		case CONV_BCF_SH: vrb.title("Converting from XCF to XCF [Sparse/Haplotype]"); break;
+	//Sharded input; only the groups of samples holding kept samples are read
+	if (XR.shard_size[idx_file] && subsampled) {
+		shard_groups = std::vector<bool>(XR.shard_fds[idx_file].size(), false);
+		for (uint32_t o = 0 ; o < sinks.size() ; o ++)
+			for (auto i=0; i<nsamples_input; ++i)
+				if (sinks[o].subs2full.empty() || sinks[o].gather.rank(2*i) >= 0) shard_groups[i / XR.shard_size[idx_file]] = true;
+		vrb.bullet("Sample groups : " + stb.str(std::count(shard_groups.begin(), shard_groups.end(), true)) + " / " + stb.str(shard_groups.size()) + " read");
 	}
 
-	if (region.empty()) vrb.bullet("Region        : All");
-	else vrb.bullet("Region        : " + stb.str(region));
-
-	if (mode == CONV_BCF_SG || mode == CONV_BCF_SH) vrb.bullet("Min MAF       : " + stb.str(minmaf));
-
-	xcf_writer XW(foutput, false, nthreads);
-	bcf1_t* rec = XW.hts_record;
+	//Writers
+	uint32_t n_sinks_full = 0;
+	for (uint32_t o = 0 ; o < outputs.size() ; o ++)
+	{
+		binary2binary_sink & S = sinks[o];
+		S.conv = new binary2binary(region, outputs[o].minmaf, nthreads, outputs[o].mode, drop_info);
+		S.conv->compress_sparse = compress_sparse;
+		S.conv->adaptive = adaptive;
+		S.conv->xor_keyframe = xor_keyframe;
+		S.XW = new xcf_writer(outputs[o].fname, false, nthreads);
+		S.XW->bin_align = align ? BIN_ALIGNMENT : 0;
+		S.XW->xor_keyframe = xor_keyframe;
+		S.XW->shard_size = shard_size;
+		S.n_lines_rare = S.n_lines_comm = S.n_lines_copied = 0;
+
+		S.XW->hts_dosages = XR.hasDosages(idx_file);
+		if (S.subs2full.empty()) {
+			if (std::count(XR.ind_ploidy[idx_file].begin(), XR.ind_ploidy[idx_file].end(), 1)) S.XW->ind_ploidy = XR.ind_ploidy[idx_file];
+			if (drop_info) S.XW->writeHeader(XR.sync_reader->readers[0].header, XR.ind_names[idx_file], std::string("XCFtools ") + std::string(XCFTLS_VERSION));
+			else S.XW->writeHeaderClone(XR.sync_reader->readers[0].header,XR.ind_names[idx_file], std::string("XCFtools ") + std::string(XCFTLS_VERSION));
+			n_sinks_full ++;
+		}
+		else S.XW->writeHeaderSubsample(XR.sync_reader->readers[0].header, XR, S.subs2full, std::string("XCFtools ") + std::string(XCFTLS_VERSION), !drop_info);
 
-	XW.writeHeaderSubsample(XR.sync_reader->readers[0].header, XR, subs2full, std::string("XCFtools ") + std::string(XCFTLS_VERSION), !drop_info);
+		const uint32_t nsamples_output = S.subs2full.empty() ? nsamples_input : S.subs2full.size();
+		S.conv->binary_bit_buf.allocate(2 * nsamples_output);
+		S.conv->sparse_int_buf.resize(2 * nsamples_output,0);
+		S.conv->sparse_int_cpl.resize(2 * nsamples_output,0);
+	}
 
 	binary_bit_buf.allocate(2 * nsamples_input);
 	sparse_int_buf.resize(2 * nsamples_input,0);
-	bitvector binary_bit_buf_subs;
-	binary_bit_buf_subs.allocate(2*sample_names.size());
-	std::vector<int32_t> sparse_int_buf_subs(2*sample_names.size());
-
-	uint32_t n_lines_rare = 0, n_lines_comm = 0;
-
-	while (XR.nextRecord())
-	{
-		const bool minor_full = (XR.getAF() < 0.5f);
-
-		int32_t n_elements_full = parse_genotypes(XR,idx_file);
-		const int32_t type = XR.typeRecord(idx_file);
-		int32_t n_elements_subs = 0;
-		size_t ac = 0;
-
-		//Now subsample
-		if (type==RECORD_SPARSE_GENOTYPE)
-		{
-			for (auto i=0; i<n_elements_full;++i)
-			{
-				if (subsample_bit.get(sparse_int_buf[i]))
-				{
-					sparse_genotype rg = sparse_genotype(sparse_int_buf[i]);
-					rg.idx = full2subs[rg.idx];
-					sparse_int_buf[n_elements_subs++] = rg.get();
-					if (!rg.mis) ac+=rg.al0 + rg.al1;
-				}
+	std::vector < char > multi_buf;
+
+	//Records needing no re-encoding have their binary data copied as is; between files on disk, in runs of contiguous records
+	int bin_fd = -1;
+	if (n_sinks_full && !XR.stream_fds[idx_file] && !XR.shard_size[idx_file]) {
+		std::string bfname = helper_tools::get_name_from_vcf(finput) + ".bin";
+		bin_fd = ::open(bfname.c_str(), O_RDONLY);
+		if (bin_fd < 0) vrb.error("Cannot open file [" + bfname + "] for copying records");
+	}
+	bool multi_read = false;
+	auto copy_record = [&](xcf_writer & XW, int32_t rtype) {
+		const uint64_t seek = XR.bin_seek[idx_file];
+		if (bin_fd >= 0 && !XW.stream && XW.shard_fds.empty() && !(XW.bin_align && seek % XW.bin_align)) {
+			XW.copyRecord(rtype, bin_fd, seek, XR.sizeRecord(idx_file));
+			return;
+		}
+		if (!multi_read) {
+			multi_buf.resize(XR.sizeRecord(idx_file));
+			XR.readRecord(idx_file, multi_buf.data());
+			multi_read = true;
+		}
+		XW.writeRecord(rtype, multi_buf.data(), multi_buf.size());
+	};
+
+	//Records subsampled in their own encoding; decoded once for all outputs
+	std::vector < int32_t > missing_full, haploid_full, haploid_subs, multi_full;
+	std::vector < char > haploid_bytes;
+	std::vector < float > dosage_full;
+	bool subset_read = false;
+	auto subset_record = [&](binary2binary_sink & S, int32_t rtype) {
+		const uint32_t nsamples_output = S.subs2full.size();
+		switch (rtype) {
+		case RECORD_MISSING_HAPLOTYPE: {
+			//Missing haplotypes have their bit unset, and are listed aside
+			if (!subset_read) XR.readMissingRecord(idx_file, binary_bit_buf.bytes, missing_full);
+			subset_read = true;
+			bitvector & bin = S.conv->binary_bit_buf;
+			S.gather.gather(binary_bit_buf, bin);
+			uint32_t nmissing = 0;
+			for (uint32_t m = 0 ; m < missing_full.size() ; m ++) {
+				const int32_t h = S.gather.rank(missing_full[m]);
+				if (h >= 0) S.conv->sparse_int_buf[nmissing++] = h;
 			}
+			if (drop_info)
+				S.XW->writeInfo(XR.chr, XR.pos, XR.ref, XR.alt, XR.rsid, bitgather::count(bin, 2*nsamples_output, false), 2*nsamples_output - nmissing);
+			else
+				bcf_copy(S.XW->hts_record, XR.sync_lines[0]);
+			if (nmissing) S.XW->writeMissingRecord(bin.bytes, bin.n_bytes, S.conv->sparse_int_buf.data(), nmissing);
+			else S.XW->writeHaplotypeRecord(bin.bytes, bin.n_bytes);
+			S.n_lines_comm++;
+			return;
 		}
-		else if (type==RECORD_SPARSE_HAPLOTYPE)
-		{
-			for (auto i=0; i<n_elements_full;++i)
-			{
-				if (subsample_bit.get(sparse_int_buf[i]))
-				{
-					sparse_int_buf_subs[n_elements_subs++] = full2subs[sparse_int_buf[i]];
+		case RECORD_BINARY_HAPLOID:
+		case RECORD_SPARSE_HAPLOID: {
+			if (!subset_read) {
+				haploid_full.resize(2 * nsamples_input);
+				XR.readHaploidRecord(idx_file, haploid_full.data());
+			}
+			subset_read = true;
+			//Ploidy of the kept samples; that of streamed inputs comes along the first haploid record
+			if (S.XW->ind_ploidy.empty())
+				for (uint32_t i = 0 ; i < nsamples_output ; i ++) S.XW->ind_ploidy.push_back(XR.ind_ploidy[idx_file][S.subs2full[i]]);
+			//Kept samples are in input order; phasing is that of the diploid samples of the input
+			haploid_subs.resize(2 * nsamples_output);
+			uint32_t n_haps = 0, an = 0, ac = 0;
+			bool phased = false;
+			for (uint32_t i = 0 ; i < nsamples_output ; i ++) {
+				const int32_t * gt = haploid_full.data() + 2 * S.subs2full[i];
+				haploid_subs[2*i+0] = gt[0];
+				haploid_subs[2*i+1] = gt[1];
+				for (uint32_t a = 0 ; a < S.XW->ind_ploidy[i] ; a ++, n_haps ++) {
+					an += !bcf_gt_is_missing(gt[a]);
+					ac += !bcf_gt_is_missing(gt[a]) && (bcf_gt_allele(gt[a]) == 1);
 				}
+				phased = phased || (S.XW->ind_ploidy[i] == 2 && bcf_gt_is_phased(gt[1]));
 			}
-			ac = (minor_full) ? n_elements_subs : 2*sample_names.size()-n_elements_subs;
+			if (drop_info)
+				S.XW->writeInfo(XR.chr, XR.pos, XR.ref, XR.alt, XR.rsid, ac, an);
+			else
+				bcf_copy(S.XW->hts_record, XR.sync_lines[0]);
+			//Sparse records list the alleles away from the major one given by the AF the output record carries
+			const bool major = drop_info ? (an && ac*1.0f/an >= 0.5f) : (XR.getAF(idx_file) >= 0.5f);
+			haploid_bytes.resize(xcf_writer::haploidBound(n_haps));
+			S.XW->writeRecord(rtype, haploid_bytes.data(), xcf_writer::encodeHaploid(haploid_subs.data(), S.XW->ind_ploidy, phased, rtype == RECORD_SPARSE_HAPLOID, major, haploid_bytes.data()));
+			S.n_lines_comm++;
+			return;
 		}
-		else if (type==RECORD_BINARY_GENOTYPE)
-		{
-			//binary_bit_buf_subs.set(false);
-			for (auto i=0; i<n_elements_full;++i)
-			{
-				if (subsample_bit.get(i))
-				{
-					const bool a0 = binary_bit_buf.get(2*i+0);
-					const bool a1 = binary_bit_buf.get(2*i+1);
-					binary_bit_buf_subs.set(full2subs[2*i+0], a0);
-					binary_bit_buf_subs.set(full2subs[2*i+1], a1);
-					if (!a0 || a1) ac+=a0+a1;
-				}
+		case RECORD_SPARSE_MULTIALLELIC: {
+			if (!subset_read) {
+				multi_full.resize(XR.sizeRecord(idx_file) / sizeof(int32_t));
+				XR.readRecord(idx_file, reinterpret_cast< char * > (multi_full.data()));
 			}
-			n_elements_subs=2*sample_names.size();
+			subset_read = true;
+			std::vector < int32_t > record = multi_full;
+			std::vector < uint32_t > ACs;
+			uint32_t AN;
+			record.resize(sparse_multiallelic::subset(record.data(), S.gather, nsamples_output, ACs, AN));
+			if (drop_info)
+				S.XW->writeInfo(XR.chr, XR.pos, XR.ref, XR.alt, XR.rsid, ACs, AN);
+			else
+				bcf_copy(S.XW->hts_record, XR.sync_lines[0]);
+			S.XW->writeRecord(rtype, reinterpret_cast< char * > (record.data()), record.size() * sizeof(int32_t));
+			S.n_lines_copied++;
+			return;
 		}
-		else if (type==RECORD_BINARY_HAPLOTYPE)
-		{
-			//binary_bit_buf_subs.set(false);
-			for (auto i=0; i<n_elements_full;++i)
-			{
-				if (subsample_bit.get(2*i))//both 2*i and 2*i+1 should be set
-				{
-					const bool a0 = binary_bit_buf.get(2*i+0);
-					const bool a1 = binary_bit_buf.get(2*i+1);
-					binary_bit_buf_subs.set(full2subs[2*i+0], a0);
-					binary_bit_buf_subs.set(full2subs[2*i+1], a1);
-					ac+=a0+a1;
-				}
+		case RECORD_DENSE_DOSAGE8:
+		case RECORD_DENSE_DOSAGE16:
+		case RECORD_SPARSE_DOSAGE: {
+			if (!subset_read) {
+				std::vector < char > bytes = std::vector < char > (XR.sizeRecord(idx_file));
+				XR.readRecord(idx_file, bytes.data());
+				dosage_full.resize(nsamples_input);
+				if (rtype == RECORD_SPARSE_DOSAGE) dosage_record::decodeSparse(bytes.data(), nsamples_input, dosage_full.data());
+				else dosage_record::decodeDense(bytes.data(), nsamples_input, (rtype == RECORD_DENSE_DOSAGE8) ? 8 : 16, dosage_full.data());
+			}
+			subset_read = true;
+			std::vector < float > dosages = std::vector < float > (nsamples_output);
+			for (uint32_t i = 0 ; i < nsamples_output ; i ++) dosages[i] = dosage_full[S.subs2full[i]];
+
+			//AC/AN from the hard calls of the kept samples
+			std::vector < uint32_t > ACs = std::vector < uint32_t > (1, 0);
+			uint32_t AN = 0;
+			dosage_record::genotypes(dosages.data(), nsamples_output, S.conv->sparse_int_buf.data());
+			xcf_reader::countAlleles(S.conv->sparse_int_buf.data(), 2 * nsamples_output, bcf_int32_vector_end, ACs, AN);
+			if (drop_info)
+				S.XW->writeInfo(XR.chr, XR.pos, XR.ref, XR.alt, XR.rsid, ACs[0], AN);
+			else
+				bcf_copy(S.XW->hts_record, XR.sync_lines[0]);
+
+			//Same encoding as the input; unlisted dosages of sparse records are 0, so listing all those above 0 keeps the listed ones
+			std::vector < char > bytes;
+			if (rtype == RECORD_SPARSE_DOSAGE) {
+				bytes.resize(dosage_record::sizeSparse(dosage_record::countSparse(dosages.data(), nsamples_output, 0.0f)));
+				dosage_record::encodeSparse(dosages.data(), nsamples_output, 0.0f, bytes.data());
+			} else {
+				const uint32_t bits = (rtype == RECORD_DENSE_DOSAGE8) ? 8 : 16;
+				bytes.resize(dosage_record::sizeDense(nsamples_output, bits));
+				dosage_record::encodeDense(dosages.data(), nsamples_output, bits, bytes.data());
 			}
-			n_elements_subs=2*sample_names.size();
+			S.XW->writeRecord(rtype, bytes.data(), bytes.size());
+			S.n_lines_copied++;
+			return;
+		}
 		}
+	};
 
-		float af =  (float) ac / (2*sample_names.size());
-		float maf = std::min(af, 1.0f-af);
-		bool rare = (maf < minmaf);
-		const bool minor = (af < 0.5f);
+	uint32_t n_lines = 0, n_lines_passed = 0;
 
-		if (drop_info)
-			XW.writeInfo(XR.chr, XR.pos, XR.ref, XR.alt, XR.rsid, ac, 2*sample_names.size());
-		else
-			XW.hts_record = XR.sync_lines[0];
+	while (XR.nextRecord())
+	{
+		multi_read = subset_read = false;
 
-		//Write record
-		if (mode == CONV_BCF_SG && rare)
+		//Multiallelic, dosage, haploid and missing haplotype records are copied over as they are, or subsampled in their own encoding
+		const int32_t rtype = XR.typeRecord(idx_file);
+		if (rtype == RECORD_SPARSE_MULTIALLELIC || rtype == RECORD_DENSE_DOSAGE8 || rtype == RECORD_DENSE_DOSAGE16 || rtype == RECORD_SPARSE_DOSAGE || rtype == RECORD_BINARY_HAPLOID || rtype == RECORD_SPARSE_HAPLOID || rtype == RECORD_MISSING_HAPLOTYPE)
 		{
-			if (type==RECORD_SPARSE_GENOTYPE)
-				XW.writeRecord(RECORD_SPARSE_GENOTYPE, reinterpret_cast<char*>(sparse_int_buf_subs.data()), n_elements_subs * sizeof(int32_t));
-			else if (type==RECORD_BINARY_GENOTYPE)
+			for (uint32_t o = 0 ; o < sinks.size() ; o ++)
 			{
-				//conversion: BINARY gen -> sparse
-				const int32_t n_buf_elements = n_elements_subs;
-				n_elements_subs=0;
-				for(uint32_t i = 0 ; i < n_buf_elements ; i++)
-				{
-					const bool a0 = binary_bit_buf_subs.get(2*i+0);
-					const bool a1 = binary_bit_buf_subs.get(2*i+1);
-					sparse_int_buf_subs[n_elements_subs++] = sparse_genotype(i, (a0!=a1), (a0 && !a1), a0, a1, 0).get();
+				binary2binary_sink & S = sinks[o];
+				if (!S.subs2full.empty()) {
+					subset_record(S, rtype);
+					continue;
 				}
-				XW.writeRecord(RECORD_SPARSE_GENOTYPE, reinterpret_cast<char*>(sparse_int_buf_subs.data()), n_elements_subs * sizeof(int32_t));
+				if (drop_info)
+					S.XW->writeInfo(XR.chr, XR.pos, XR.ref, XR.alt, XR.rsid, XR.getACs(), XR.getAN());
+				else
+					bcf_copy(S.XW->hts_record, XR.sync_lines[0]);
+				//Ploidy of streamed inputs comes along the first haploid record
+				if ((rtype == RECORD_BINARY_HAPLOID || rtype == RECORD_SPARSE_HAPLOID) && S.XW->ind_ploidy.empty()) S.XW->ind_ploidy = XR.ind_ploidy[idx_file];
+				copy_record(*S.XW, rtype);
+				S.n_lines_copied++;
 			}
-			else vrb.error("Converting non-genotype type to genotype type!");
+			continue;
 		}
-		else if (mode == CONV_BCF_SH && rare)
-		{
-			if (type==RECORD_SPARSE_HAPLOTYPE)
-			{
-				if (minor!=minor_full)
-				{
-					std::vector<int32_t> rev_sparse_int_bug(n_elements_subs);
-					std::copy(sparse_int_buf_subs.begin(), sparse_int_buf_subs.begin()+n_elements_subs, rev_sparse_int_bug.begin());
-					int32_t nextExpected = 0; // Initialize the next expected element to 0
-					int32_t i=0;
-					for (int32_t j=0; j<n_elements_subs; ++j)
-					{
-						while (nextExpected < rev_sparse_int_bug[j])
-						{
-							sparse_int_buf_subs[i++] = nextExpected;
-							++nextExpected;
-						}
-						++nextExpected;
-					}
-					while (nextExpected < 2*sample_names.size())
-					{
-						sparse_int_buf_subs[i++] = nextExpected;
-						++nextExpected;
-					}
-					n_elements_subs=i;
-				}
-				XW.writeRecord(RECORD_SPARSE_HAPLOTYPE, reinterpret_cast<char*>(sparse_int_buf_subs.data()), n_elements_subs * sizeof(int32_t));
-			}
-			else if (type==RECORD_BINARY_HAPLOTYPE)
-			{
-				//conversion: BINARY hap -> sparse
-				const int32_t n_buf_elements = n_elements_subs;
-				n_elements_subs=0;
-				for (size_t i = 0; i < n_buf_elements; ++i)
-			    {
-			        if (binary_bit_buf_subs.get(i) == minor)
-			        	sparse_int_buf_subs[n_elements_subs++]=i;
-			    }
-				XW.writeRecord(RECORD_SPARSE_HAPLOTYPE, reinterpret_cast<char*>(sparse_int_buf_subs.data()), n_elements_subs * sizeof(int32_t));
-			}
-			else vrb.error("Converting non-haplotype type to haplotype type!");
-		}
-		else if (mode == CONV_BCF_SG || mode == CONV_BCF_BG)
+
+		//Is that a rare variant?
+		float af_full = XR.getAF();
+		const bool minor_full = (af_full < 0.5f);
+
+		//Decoded once, for the first output needing it
+		int32_t type = RECORD_VOID;
+		int32_t n_elements = 0;
+		bool in_sparse = false;
+		auto decode = [&]() {
+			if (type != RECORD_VOID) return;
+			n_elements = parse_genotypes(XR,idx_file,type);
+			in_sparse = (type == RECORD_SPARSE_GENOTYPE || type == RECORD_SPARSE_HAPLOTYPE);
+		};
+
+		for (uint32_t o = 0 ; o < sinks.size() ; o ++)
 		{
-			if (type==RECORD_BINARY_GENOTYPE)
-				XW.writeRecord(RECORD_BINARY_GENOTYPE, binary_bit_buf_subs.bytes, binary_bit_buf_subs.n_bytes);
-			else if (type==RECORD_SPARSE_GENOTYPE)
+			binary2binary_sink & S = sinks[o];
+			bool rare;
+			if (S.subs2full.empty())
 			{
-				binary_bit_buf_subs.set(false);
-				for (auto gt : sparse_int_buf_subs)
-				{
-					sparse_genotype rg;
-					rg.set(gt);
-					if (rg.mis) {
-						binary_bit_buf_subs.set(2*rg.idx+0, true);
-						//binary_bit_buf.set(2*rg.idx+1) = false;
-					} else {
-						binary_bit_buf_subs.set(2*rg.idx+0,rg.al0);
-						binary_bit_buf_subs.set(2*rg.idx+1,rg.al1);
-					}
+				rare = (std::min(af_full, 1.0f-af_full) < outputs[o].minmaf);
+
+				if (drop_info)
+					S.XW->writeInfo(XR.chr, XR.pos, XR.ref, XR.alt, XR.rsid, XR.getAC(), XR.getAN());
+				else
+					bcf_copy(S.XW->hts_record, XR.sync_lines[0]);
+
+				//Record already in the output encoding
+				if (rtype == S.conv->passthrough_type(rare)) {
+					copy_record(*S.XW, rtype);
+					rare = (rtype != RECORD_BINARY_GENOTYPE && rtype != RECORD_BINARY_HAPLOTYPE);
+					S.n_lines_comm += !rare;
+					S.n_lines_rare += rare;
+					n_lines_passed ++;
+					continue;
 				}
-				XW.writeRecord(RECORD_BINARY_GENOTYPE, binary_bit_buf_subs.bytes, binary_bit_buf_subs.n_bytes);
+				decode();
+
+				//The decoded record is shared by all outputs; write_genotypes only fills the other encoding, in the buffers of the output
+				if (in_sparse) rare = S.conv->write_genotypes(*S.XW, type, S.conv->binary_bit_buf, sparse_int_buf.data(), n_elements, nsamples_input, minor_full, minor_full, rare);
+				else rare = S.conv->write_genotypes(*S.XW, type, binary_bit_buf, S.conv->sparse_int_buf.data(), n_elements, nsamples_input, minor_full, minor_full, rare);
 			}
-			else vrb.error("Converting non-genotype type to genotype type!");
-		}
-		else
-		{
-			if (type==RECORD_BINARY_HAPLOTYPE)
-				XW.writeRecord(RECORD_BINARY_HAPLOTYPE, binary_bit_buf_subs.bytes, binary_bit_buf_subs.n_bytes);
-			else if (type==RECORD_SPARSE_HAPLOTYPE)
+			else
 			{
-				//conversion: SPARSE hap -> binary
-				binary_bit_buf_subs.set(!minor_full);
-				for (auto i=0; i<n_elements_subs;++i)
-					binary_bit_buf_subs.set(sparse_int_buf_subs[i],minor_full);
-				XW.writeRecord(RECORD_BINARY_HAPLOTYPE, binary_bit_buf_subs.bytes, binary_bit_buf_subs.n_bytes);
+				decode();
+
+				//Now subsample
+				size_t ac = 0;
+				const uint32_t nsamples_output = S.subs2full.size();
+				int32_t n_elements_subs = subsample_genotypes(type, n_elements, minor_full, S.gather, nsamples_output, S.conv->binary_bit_buf, S.conv->sparse_int_buf.data(), ac);
+
+				float af =  (float) ac / (2*nsamples_output);
+				rare = (std::min(af, 1.0f-af) < outputs[o].minmaf);
+
+				if (drop_info)
+					S.XW->writeInfo(XR.chr, XR.pos, XR.ref, XR.alt, XR.rsid, ac, 2*nsamples_output);
+				else
+					bcf_copy(S.XW->hts_record, XR.sync_lines[0]);
+
+				rare = S.conv->write_genotypes(*S.XW, type, S.conv->binary_bit_buf, S.conv->sparse_int_buf.data(), n_elements_subs, nsamples_output, minor_full, (af < 0.5f), rare);
 			}
-			else vrb.error("Converting non-haplotype type to haplotype type!");
+
+			//Line counting
+			const bool sparse_mode = (outputs[o].mode == CONV_BCF_SG || outputs[o].mode == CONV_BCF_SH);
+			S.n_lines_comm += !rare || !sparse_mode;
+			S.n_lines_rare += rare && sparse_mode;
 		}
-		//Line counting
-		n_lines_comm += !rare || mode == CONV_BCF_BG || mode == CONV_BCF_BH;
-		n_lines_rare += rare && (mode == CONV_BCF_SG || mode == CONV_BCF_SH);
 
 		//Verbose
-		if ((n_lines_comm+n_lines_rare) % 10000 == 0) {
-			if (mode == CONV_BCF_BG || mode == CONV_BCF_BH) vrb.bullet("Number of BCF records processed: N=" + stb.str(n_lines_comm));
-			else vrb.bullet("Number of BCF records processed: Nc=" + stb.str(n_lines_comm) + "/ Nr=" + stb.str(n_lines_rare));
-		}
+		if ((++n_lines) % 10000 == 0) vrb.bullet("Number of records processed: N=" + stb.str(n_lines));
 	}
-	if (mode == CONV_BCF_BG || mode == CONV_BCF_BH) vrb.bullet("Number of records processed: N=" + stb.str(n_lines_comm));
-	else vrb.bullet("Number of records processed: Nc=" + stb.str(n_lines_comm) + "/ Nr=" + stb.str(n_lines_rare));
 
-	if (!drop_info) XW.hts_record = rec;
+	if (n_lines_passed) vrb.bullet("Number of records copied without re-encoding: N=" + stb.str(n_lines_passed));
+	if (bin_fd >= 0) ::close(bin_fd);
 
-	XW.close();//always close XW first? important for multithreading if set
+	for (uint32_t o = 0 ; o < sinks.size() ; o ++)
+	{
+		binary2binary_sink & S = sinks[o];
+		const bool sparse_mode = (outputs[o].mode == CONV_BCF_SG || outputs[o].mode == CONV_BCF_SH);
+		if (sinks.size() > 1) vrb.bullet("Output        : [" + outputs[o].fname + "]");
+		if (!sparse_mode) vrb.bullet("Number of records processed: N=" + stb.str(S.n_lines_comm));
+		else vrb.bullet("Number of records processed: Nc=" + stb.str(S.n_lines_comm) + "/ Nr=" + stb.str(S.n_lines_rare));
+		if (S.n_lines_copied) vrb.bullet("Number of multiallelic/dosage records copied: N=" + stb.str(S.n_lines_copied));
+
+		//Per-type totals
+		for (uint32_t t = 0 ; t < RECORD_NUMBER_TYPES ; t ++)
+			if (S.XW->bin_type_count[t]) vrb.bullet(helper_tools::recordName(t) + " : N=" + stb.str(S.XW->bin_type_count[t]) + " / " + stb.str(S.XW->bin_type_bytes[t]) + " bytes");
+
+		S.XW->close();//always close XW first? important for multithreading if set
+		delete S.XW;
+		delete S.conv;
+	}
 	XR.close();
 }
@@ -3,6 +3,7 @@
 
 #include <utils/otools.h>
 #include <containers/bitvector.h>
+#include <containers/bitgather.h>
 #include <objects/sparse_genotype.h>
 #include <utils/xcf.h>
 
@@ -11,18 +12,36 @@
 #define CONV_BCF_BH	1
 #define CONV_BCF_SG	2
 #define CONV_BCF_SH	3
+#define CONV_BCF_BD	4
+#define CONV_BCF_SD	5
+
+//One output of a conversion; all outputs are written in a single pass over the input
+struct binary2binary_output {
+	std::string fname;
+	int mode;
+	float minmaf;
+	bool exclude;
+	std::vector < std::string > samples;	//Samples to keep, or to drop when exclude is set [all when empty]
+};
 
 class binary2binary {
 public:
 	//PARAM
 	bitvector binary_bit_buf;
 	std::vector<int32_t> sparse_int_buf;
+	std::vector<int32_t> sparse_int_cpl;	//Complement of sparse records when the minor allele flips
 
 	std::string region;
 	int nthreads;
 	int mode;
 	float minmaf;
 	bool drop_info;
+	bool compress_sparse;
+	bool adaptive;
+	bool align;
+	uint32_t xor_keyframe;
+	uint32_t shard_size;
+	std::vector<bool> shard_groups;		//Groups of samples to read in sharded records [all when empty]
 
 	//CONSTRUCTORS/DESCTRUCTORS
 	binary2binary(std::string, float, int, int, bool);
@@ -31,7 +50,12 @@ public:
 	//PROCESS
 	void convert(std::string, std::string);
 	void convert(std::string, std::string, const bool exclude, const bool isforce, std::vector<std::string>& smpls);
-	int32_t parse_genotypes(xcf_reader& XR, const uint32_t idx_file);
+	void convert(std::string, std::vector < binary2binary_output > & outputs, const bool isforce);
+	int32_t parse_genotypes(xcf_reader& XR, const uint32_t idx_file, int32_t& type);
+	int32_t passthrough_type(bool rare);
+	static void subsample_samples(xcf_reader& XR, const uint32_t idx_file, const bool exclude, const bool isforce, std::vector<std::string>& smpls, std::vector<int32_t>& subs2full);
+	int32_t subsample_genotypes(int32_t type, int32_t n_elements_full, bool minor_full, const bitgather& gather, uint32_t nsamples, bitvector& bin, int32_t* sparse, size_t& ac);
+	bool write_genotypes(xcf_writer& XW, int32_t type, bitvector& bin, int32_t* sparse, int32_t n, uint32_t nsamples, bool sparse_minor, bool minor, bool rare);
 
 
 };
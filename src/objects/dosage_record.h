@@ -0,0 +1,145 @@
+/*******************************************************************************
+ * Copyright (C) 2022-2023 Olivier Delaneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#ifndef _DOSAGE_RECORD_H
+#define _DOSAGE_RECORD_H
+
+#include <utils/otools.h>
+
+// Quantised ALT dosages in [0,2], one per sample.
+// Dense 8 bits  : uint8_t q = round(DS * 127), 255 for missing.
+// Dense 16 bits : uint16_t q = round(DS * 32767), 65535 for missing.
+// Sparse        : [uint32 n][n x uint32 sample index][n x uint16 q], 16 bits quantisation.
+//                 Only dosages above eps and missing ones are listed, others are 0.
+
+#define DOSAGE_SCALE8		127.0f
+#define DOSAGE_SCALE16		32767.0f
+#define DOSAGE_MISSING8		0xFF
+#define DOSAGE_MISSING16	0xFFFF
+
+class dosage_record {
+public:
+
+	static uint8_t quantise8(float ds) {
+		if (bcf_float_is_missing(ds) || std::isnan(ds)) return DOSAGE_MISSING8;
+		return (uint8_t)std::lround(std::min(std::max(ds, 0.0f), 2.0f) * DOSAGE_SCALE8);
+	}
+
+	static uint16_t quantise16(float ds) {
+		if (bcf_float_is_missing(ds) || std::isnan(ds)) return DOSAGE_MISSING16;
+		return (uint16_t)std::lround(std::min(std::max(ds, 0.0f), 2.0f) * DOSAGE_SCALE16);
+	}
+
+	static void unquantise8(uint8_t q, float & ds) {
+		if (q == DOSAGE_MISSING8) bcf_float_set_missing(ds);
+		else ds = q / DOSAGE_SCALE8;
+	}
+
+	static void unquantise16(uint16_t q, float & ds) {
+		if (q == DOSAGE_MISSING16) bcf_float_set_missing(ds);
+		else ds = q / DOSAGE_SCALE16;
+	}
+
+	//Size in bytes of a dense record
+	static uint32_t sizeDense(uint32_t nsamples, uint32_t bits) {
+		return nsamples * (bits / 8);
+	}
+
+	//Size in bytes of a sparse record with n listed samples
+	static uint32_t sizeSparse(uint32_t n) {
+		return sizeof(uint32_t) + n * (sizeof(uint32_t) + sizeof(uint16_t));
+	}
+
+	//Number of samples to be listed in a sparse record
+	static uint32_t countSparse(const float * ds, uint32_t nsamples, float eps) {
+		uint32_t n = 0;
+		for (uint32_t i = 0 ; i < nsamples ; i ++) n += (bcf_float_is_missing(ds[i]) || !(ds[i] <= eps));
+		return n;
+	}
+
+	//Code dosages densely on 8 or 16 bits, returns the number of bytes
+	static uint32_t encodeDense(const float * ds, uint32_t nsamples, uint32_t bits, char * out) {
+		if (bits == 8) {
+			for (uint32_t i = 0 ; i < nsamples ; i ++) out[i] = quantise8(ds[i]);
+		} else {
+			for (uint32_t i = 0 ; i < nsamples ; i ++) {
+				uint16_t q = quantise16(ds[i]);
+				memcpy(out + 2 * i, &q, sizeof(uint16_t));
+			}
+		}
+		return sizeDense(nsamples, bits);
+	}
+
+	//Code dosages above eps sparsely, returns the number of bytes
+	static uint32_t encodeSparse(const float * ds, uint32_t nsamples, float eps, char * out) {
+		uint32_t n = countSparse(ds, nsamples, eps);
+		char * idx = out + sizeof(uint32_t), * val = idx + n * sizeof(uint32_t);
+		memcpy(out, &n, sizeof(uint32_t));
+		for (uint32_t i = 0 ; i < nsamples ; i ++) {
+			if (bcf_float_is_missing(ds[i]) || !(ds[i] <= eps)) {
+				uint16_t q = quantise16(ds[i]);
+				memcpy(idx, &i, sizeof(uint32_t)); idx += sizeof(uint32_t);
+				memcpy(val, &q, sizeof(uint16_t)); val += sizeof(uint16_t);
+			}
+		}
+		return sizeSparse(n);
+	}
+
+	static void decodeDense(const char * in, uint32_t nsamples, uint32_t bits, float * ds) {
+		if (bits == 8) {
+			for (uint32_t i = 0 ; i < nsamples ; i ++) unquantise8((uint8_t)in[i], ds[i]);
+		} else {
+			for (uint32_t i = 0 ; i < nsamples ; i ++) {
+				uint16_t q;
+				memcpy(&q, in + 2 * i, sizeof(uint16_t));
+				unquantise16(q, ds[i]);
+			}
+		}
+	}
+
+	static void decodeSparse(const char * in, uint32_t nsamples, float * ds) {
+		uint32_t n;
+		memcpy(&n, in, sizeof(uint32_t));
+		const char * idx = in + sizeof(uint32_t), * val = idx + n * sizeof(uint32_t);
+		std::fill(ds, ds + nsamples, 0.0f);
+		for (uint32_t e = 0 ; e < n ; e ++) {
+			uint32_t i;
+			uint16_t q;
+			memcpy(&i, idx + e * sizeof(uint32_t), sizeof(uint32_t));
+			memcpy(&q, val + e * sizeof(uint16_t), sizeof(uint16_t));
+			unquantise16(q, ds[i]);
+		}
+	}
+
+	//Hard calls from dosages [unphased]
+	static void genotypes(const float * ds, uint32_t nsamples, int32_t * gt) {
+		for (uint32_t i = 0 ; i < nsamples ; i ++) {
+			if (bcf_float_is_missing(ds[i])) gt[2*i+0] = gt[2*i+1] = bcf_gt_missing;
+			else {
+				gt[2*i+0] = bcf_gt_unphased(ds[i] >= 1.5f);
+				gt[2*i+1] = bcf_gt_unphased(ds[i] >= 0.5f);
+			}
+		}
+	}
+};
+
+#endif
@@ -54,7 +54,11 @@ public:
 		prob = pha?1.0f:-1.0f;
 	}
 
-	sparse_genotype(unsigned int _idx, bool _het, bool _mis, bool _al0, bool _al1, bool _pha) {
+	sparse_genotype(unsigned int _idx, bool _het, bool _mis, bool _al0, bool _al1, bool _pha) : sparse_genotype(_idx, _het, _mis, _al0, _al1, _pha, rng) {
+	}
+
+	//Unphased hets get their allele order from coins [a generator private to the caller when encoding in threads]
+	sparse_genotype(unsigned int _idx, bool _het, bool _mis, bool _al0, bool _al1, bool _pha, random_number_generator & coins) {
 		idx = _idx; het = _het; mis = _mis; al0 = _al0; al1 = _al1;
 
 		pha = _pha || (!het && !mis);
@@ -63,7 +67,7 @@ public:
 		else {
 			prob = -1.0f;
 			if (al0 != al1) {
-				if (rng.flipCoin()) { al0 = 0; al1 = 1; }
+				if (coins.flipCoin()) { al0 = 0; al1 = 1; }
 				else { al0 = 1; al1 = 0; }
 			}
 		}
@@ -0,0 +1,148 @@
+/*******************************************************************************
+ * Copyright (C) 2022-2023 Olivier Delaneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#ifndef _SPARSE_MULTIALLELIC_H
+#define _SPARSE_MULTIALLELIC_H
+
+#include <utils/otools.h>
+#include <containers/bitgather.h>
+
+// Multiallelic record: one sparse list of haplotype indices per allele.
+// Record layout in int32 words:
+// [0] number of alleles (REF included)
+// [1] major allele, implicit for all haplotypes that are not listed (its list is empty)
+// [2] phasing of the samples that are not listed as exceptions (1: phased, 0: unphased)
+// [3 .. 3+A) number of haplotypes carrying each allele
+// [3+A] number of missing haplotypes
+// [4+A] number of phasing exceptions
+// then the haplotype indices of each allele, of missing data, and the sample indices of phasing exceptions.
+// Haplotypes are listed on their own, so that half-missing genotypes [./1, 1|.] keep their called allele.
+// The phasing of a sample is the one of its second allele; samples missing both alleles are never exceptions
+// and decode as ./., while a missing second allele of a phased sample decodes as .| [bcf_gt_phased(-1)].
+
+class sparse_multiallelic {
+public:
+
+	//Maximum number of int32 words needed to code a record
+	static uint32_t bound(uint32_t nsamples, uint32_t n_allele) {
+		return 5 + n_allele + 3 * nsamples;
+	}
+
+	//Code BCF genotypes [2 per sample], returns the number of int32 words
+	static uint32_t encode(const int32_t * gt, uint32_t nsamples, uint32_t n_allele, int32_t * out) {
+		std::vector < uint32_t > count = std::vector < uint32_t > (n_allele + 1, 0);
+		uint32_t n_phased = 0, n_called = 0;
+		for (uint32_t i = 0 ; i < nsamples ; i ++) {
+			bool m0 = bcf_gt_is_missing(gt[2*i+0]), m1 = bcf_gt_is_missing(gt[2*i+1]);
+			count[m0 ? n_allele : bcf_gt_allele(gt[2*i+0])] ++;
+			count[m1 ? n_allele : bcf_gt_allele(gt[2*i+1])] ++;
+			if (m0 && m1) continue;
+			n_phased += bcf_gt_is_phased(gt[2*i+1]);
+			n_called ++;
+		}
+		uint32_t major = std::max_element(count.begin(), count.end() - 1) - count.begin();
+		bool phased = (2 * n_phased >= n_called);
+		count[major] = 0;
+
+		//Header
+		out[0] = n_allele;
+		out[1] = major;
+		out[2] = phased;
+		std::vector < uint32_t > offset = std::vector < uint32_t > (n_allele + 2, 5 + n_allele);
+		for (uint32_t a = 0 ; a <= n_allele ; a ++) {
+			out[3 + a] = count[a];
+			offset[a + 1] = offset[a] + count[a];
+		}
+
+		//Scatter the haplotypes in their allele list
+		for (uint32_t h = 0 ; h < 2 * nsamples ; h ++) {
+			uint32_t a = bcf_gt_is_missing(gt[h]) ? n_allele : bcf_gt_allele(gt[h]);
+			if (a != major) out[offset[a]++] = h;
+		}
+
+		//Phasing exceptions
+		uint32_t n_exceptions = 0, base = offset[n_allele];
+		for (uint32_t i = 0 ; i < nsamples ; i ++) {
+			bool mi = bcf_gt_is_missing(gt[2*i+0]) && bcf_gt_is_missing(gt[2*i+1]);
+			if (!mi && (bcf_gt_is_phased(gt[2*i+1]) != 0) != phased) out[base + n_exceptions++] = i;
+		}
+		out[4 + n_allele] = n_exceptions;
+		return base + n_exceptions;
+	}
+
+	//Decode into BCF genotypes [2 per sample] with all alleles
+	static void decode(const int32_t * in, uint32_t nsamples, int32_t * gt) {
+		uint32_t n_allele = in[0], major = in[1];
+		bool phased = in[2];
+		std::fill(gt, gt + 2 * nsamples, phased ? bcf_gt_phased(major) : bcf_gt_unphased(major));
+		const int32_t * list = in + 5 + n_allele;
+		for (uint32_t a = 0 ; a < n_allele ; a ++)
+			for (uint32_t e = 0 ; e < (uint32_t)in[3 + a] ; e ++)
+				gt[*(list++)] = phased ? bcf_gt_phased(a) : bcf_gt_unphased(a);
+		for (uint32_t e = 0 ; e < (uint32_t)in[3 + n_allele] ; e ++, list ++) {
+			bool half = (*list & 1) && !(e && list[-1] == *list - 1);
+			gt[*list] = (half && phased) ? bcf_gt_phased(-1) : bcf_gt_missing;
+		}
+		for (uint32_t e = 0 ; e < (uint32_t)in[4 + n_allele] ; e ++, list++) {
+			if (!bcf_gt_is_missing(gt[2*(*list)+0])) gt[2*(*list)+0] ^= 1;
+			gt[2*(*list)+1] ^= 1;
+		}
+	}
+
+	//Biallelic view of an ALT allele from decoded genotypes [other ALTs set to REF]
+	static void split(const int32_t * gt, uint32_t nsamples, uint32_t allele, int32_t * out) {
+		for (uint32_t h = 0 ; h < 2 * nsamples ; h ++) {
+			if (bcf_gt_is_missing(gt[h])) out[h] = gt[h];
+			else out[h] = ((uint32_t)bcf_gt_allele(gt[h]) == allele) ? ((gt[h] & 1) ? bcf_gt_phased(1) : bcf_gt_unphased(1)) : ((gt[h] & 1) ? bcf_gt_phased(0) : bcf_gt_unphased(0));
+		}
+	}
+
+	//Restrict a record to the haplotypes kept in gather, in place, for nsamples kept samples; returns the number of int32 words
+	//AC is set to the count of each ALT allele and AN to the number of called haplotypes over the kept samples
+	static uint32_t subset(int32_t * in, const bitgather & gather, uint32_t nsamples, std::vector < uint32_t > & AC, uint32_t & AN) {
+		const uint32_t n_allele = in[0], major = in[1], n_haps = 2 * nsamples;
+		int32_t * list = in + 5 + n_allele, * out = list;
+		uint32_t n_listed = 0;
+		AC.assign(n_allele - 1, 0);
+		for (uint32_t a = 0 ; a <= n_allele ; a ++) {
+			uint32_t n = 0, n_full = in[3 + a];
+			for (uint32_t e = 0 ; e < n_full ; e ++, list ++) {
+				int32_t h = gather.rank(*list);
+				if (h >= 0) { *(out++) = h; n ++; }
+			}
+			in[3 + a] = n;
+			if (a > 0 && a < n_allele) AC[a-1] = n;
+			n_listed += n;
+		}
+		uint32_t n = 0, n_full = in[4 + n_allele];
+		for (uint32_t e = 0 ; e < n_full ; e ++, list ++) {
+			int32_t h = gather.rank(2*(*list));
+			if (h >= 0) { *(out++) = h / 2; n ++; }
+		}
+		in[4 + n_allele] = n;
+		if (major > 0) AC[major-1] = n_haps - n_listed;
+		AN = n_haps - in[3 + n_allele];
+		return out - in;
+	}
+};
+
+#endif
@@ -0,0 +1,156 @@
+/*******************************************************************************
+ * Copyright (C) 2022-2023 Olivier Delaneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#include <stream/stream_header.h>
+
+//Sites and binary data are copied over as they are; the .bin file is the concatenation of the payloads, so that INFO/SEEK fields remain valid
+void streamer::pack() {
+	//Opening sites-only BCF file
+	htsFile * fp = hts_open(finput.c_str(), "r");
+	if (!fp) vrb.error("Cannot open [" + finput + "] for reading");
+	if (nthreads > 1 && hts_set_threads(fp, nthreads) < 0) vrb.error("Could not set threads for [" + finput + "]");
+	bcf_hdr_t * hdr = bcf_hdr_read(fp);
+	if (!hdr) vrb.error("Cannot read header of [" + finput + "]");
+	if (!bcf_hdr_idinfo_exists(hdr, BCF_HL_INFO, bcf_hdr_id2int(hdr, BCF_DT_ID, "SEEK")) || bcf_hdr_nsamples(hdr) != 0) vrb.error("[" + finput + "] is not a XCF file");
+	if (bcf_hdr_get_hrec(hdr, BCF_HL_GEN, "XCF_SHARDS", NULL, NULL)) vrb.error("Sharded XCF files cannot be streamed; convert [" + finput + "] with --shard-size 0 first");
+
+	//Opening binary and PED files
+	std::string bfname = helper_tools::get_name_from_vcf(finput) + ".bin";
+	std::string ffname = helper_tools::get_name_from_vcf(finput) + ".fam";
+	std::ifstream fdb (bfname, std::ios::in | std::ios::binary);
+	if (!fdb) vrb.error("Cannot open file [" + bfname + "] for reading");
+	std::ifstream fdf (ffname);
+	if (!fdf.is_open()) vrb.error("Cannot open pedigree file [" + ffname + "] for reading");
+	std::stringstream fam;
+	fam << fdf.rdbuf();
+
+	//Header and samples first
+	xcf_stream_output S;
+	S.open(foutput);
+	kstring_t line = { 0, 0, NULL };
+	if (bcf_hdr_format(hdr, 1, &line) < 0) vrb.error("Failing to format header of [" + finput + "]");
+	S.writeFrame(FRAME_HEADER, line.s, line.l);
+	S.writeFrame(FRAME_FAM, fam.str().data(), fam.str().size());
+
+	//Each site goes after the binary data up to the end of its record [padding included]
+	bcf1_t * rec = bcf_init();
+	int32_t * vsk = NULL, nsk = 0;
+	uint64_t curr = 0;
+	std::vector < char > buffer;
+	while (bcf_read(fp, hdr, rec) == 0) {
+		if (bcf_get_info_int32(hdr, rec, "SEEK", &vsk, &nsk) == 4) {
+			uint64_t end = vsk[1] * (uint64_t)MOD30BITS + vsk[2] + vsk[3];
+			if (end < curr) vrb.error("Binary records are not in order in [" + bfname + "]");
+			buffer.resize(end - curr);
+			fdb.read(buffer.data(), buffer.size());
+			if ((uint64_t)fdb.gcount() != buffer.size()) vrb.error("Truncated binary file [" + bfname + "]");
+			S.sputn(buffer.data(), buffer.size());
+			n_bytes += buffer.size();
+			curr = end;
+		}
+		S.writeSite(rec);
+		if (++n_sites % 100000 == 0) vrb.bullet("Number of XCF records processed: N = " + stb.str(n_sites));
+	}
+
+	//Trailing padding of aligned binary files
+	buffer.resize(XCF_STREAM_CHUNK);
+	for (fdb.read(buffer.data(), buffer.size()) ; fdb.gcount() ; fdb.read(buffer.data(), buffer.size())) {
+		S.sputn(buffer.data(), fdb.gcount());
+		n_bytes += fdb.gcount();
+	}
+	S.close();
+
+	free(line.s);
+	free(vsk);
+	bcf_destroy(rec);
+	bcf_hdr_destroy(hdr);
+	if (hts_close(fp)) vrb.error("Non zero status when closing [" + finput + "]");
+}
+
+//Frames are written back in the files they come from; the .fam file is the last one received
+void streamer::unpack() {
+	xcf_stream_input S;
+	S.open(finput);
+	S.readMagic();
+
+	//Opening output files
+	std::string fidx = foutput + ".csi";
+	std::string bfname = helper_tools::get_name_from_vcf(foutput) + ".bin";
+	std::string ffname = helper_tools::get_name_from_vcf(foutput) + ".fam";
+	htsFile * fp = hts_open(foutput.c_str(), "wb");
+	if (!fp) vrb.error("Could not open " + foutput);
+	if (nthreads > 1 && hts_set_threads(fp, nthreads) < 0) vrb.error("Could not set threads for " + foutput);
+	std::ofstream fdb (bfname, std::ios::out | std::ios::binary);
+	if (!fdb) vrb.error("Cannot open file [" + bfname + "] for writing");
+
+	bcf_hdr_t * hdr = NULL;
+	bcf1_t * rec = bcf_init();
+	std::string frame, fam;
+	uint8_t kind;
+	while (S.readFrame(kind, frame)) {
+		switch (kind) {
+		case FRAME_HEADER:
+			if (hdr) vrb.error("Several headers in stream [" + finput + "]");
+			hdr = bcf_hdr_init("r");
+			if (bcf_hdr_parse(hdr, &frame[0]) < 0) vrb.error("Failing to parse header of stream [" + finput + "]");
+			if (bcf_hdr_write(fp, hdr) < 0) vrb.error("Failing to write BCF/header");
+			if (bcf_idx_init(fp, hdr, 14, fidx.c_str())) vrb.error("Initializing .csi");
+			break;
+		case FRAME_FAM:
+			fam = frame;
+			break;
+		case FRAME_PAYLOAD:
+			fdb.write(frame.data(), frame.size());
+			n_bytes += frame.size();
+			break;
+		case FRAME_SITE:
+			if (!hdr) vrb.error("Records before the header in stream [" + finput + "]");
+			if (!xcf_stream_site::unpack(frame, rec)) vrb.error("Failing to parse record of stream [" + finput + "]");
+			if (bcf_write(fp, hdr, rec) < 0) vrb.error("Failing to write VCF/record");
+			if (++n_sites % 100000 == 0) vrb.bullet("Number of XCF records processed: N = " + stb.str(n_sites));
+			break;
+		}
+	}
+	if (!hdr) vrb.error("No header in stream [" + finput + "]");
+
+	//Samples, with their ploidy when sent
+	std::ofstream fdf (ffname);
+	if (!fdf.is_open()) vrb.error("Cannot open [" + ffname + "] for writing");
+	fdf << fam;
+	fdf.close();
+	fdb.close();
+
+	if (bcf_idx_save(fp)) vrb.error("Writing .csi index");
+	bcf_destroy(rec);
+	bcf_hdr_destroy(hdr);
+	if (hts_close(fp)) vrb.error("Non zero status when closing [" + foutput + "]");
+	S.close();
+}
+
+void streamer::run() {
+	tac.clock();
+	if (unpacking) unpack();
+	else pack();
+	vrb.bullet("Number of XCF records processed: N = " + stb.str(n_sites));
+	vrb.bullet("Binary data   : " + stb.str(n_bytes / (1024.0 * 1024.0), 2) + " Mb");
+	vrb.bullet("Timing: " + stb.str(tac.rel_time()*1.0/1000, 2) + "s");
+}
@@ -0,0 +1,65 @@
+/*******************************************************************************
+ * Copyright (C) 2022-2023 Olivier Delaneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#ifndef _STREAM_H
+#define _STREAM_H
+
+#include <utils/otools.h>
+#include <utils/xcf.h>
+
+class streamer {
+public:
+	//COMMAND LINE OPTIONS
+	bpo::options_description descriptions;
+	bpo::variables_map options;
+
+	//FILES
+	std::string finput;
+	std::string foutput;
+	uint32_t nthreads;
+	bool unpacking;								//Stream to .bcf/.bin/.fam triplet? [triplet to stream otherwise]
+
+	//COUNTS
+	uint64_t n_sites;
+	uint64_t n_bytes;
+
+	//CONSTRUCTOR
+	streamer();
+	~streamer();
+
+	//PARAMETERS
+	void declare_options();
+	void parse_command_line(std::vector < std::string > &);
+	void check_options();
+	void verbose_options();
+	void verbose_files();
+
+	//
+	void streaming(std::vector < std::string > &);
+	void read_files_and_initialise();
+	void run();
+	void pack();
+	void unpack();
+	void write_files_and_finalise();
+};
+
+#endif
@@ -0,0 +1,33 @@
+/*******************************************************************************
+ * Copyright (C) 2022-2023 Olivier Delaneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#include <stream/stream_header.h>
+
+void streamer::read_files_and_initialise() {
+	//step0: Direction of the conversion, given by the input
+	unpacking = xcf_stream_input::isStream(finput);
+	bool stream_output = (foutput == "-" || helper_tools::isStreamName(foutput));
+	if (unpacking && stream_output) vrb.error("Streams can only be unpacked into XCF files [.bcf]");
+	if (!unpacking && !stream_output) vrb.error("XCF files can only be packed into streams [.xcfs or - for stdout]");
+	if (unpacking && (foutput.size() < 4 || foutput.substr(foutput.size() - 4) != ".bcf")) vrb.error("Streams are unpacked into XCF files with a .bcf extension");
+	vrb.title(unpacking ? "Unpacking stream into XCF file" : "Packing XCF file into stream");
+}
@@ -0,0 +1,89 @@
+/*******************************************************************************
+ * Copyright (C) 2022-2023 Olivier Delaneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#include "../../versions/versions.h"
+
+#include <stream/stream_header.h>
+
+using namespace std;
+
+void streamer::declare_options() {
+	bpo::options_description opt_base ("Basic options");
+	opt_base.add_options()
+			("help", "Produce help message")
+			("threads,T", bpo::value<int>()->default_value(1), "Number of threads used for VCF/BCF (de-)compression");
+
+	bpo::options_description opt_input ("Input files");
+	opt_input.add_options()
+			("input,i", bpo::value < std::string >(), "Input XCF file, or XCF stream to unpack [.xcfs or - for stdin]");
+
+	bpo::options_description opt_output ("Output files");
+	opt_output.add_options()
+			("output,o", bpo::value< std::string >()->default_value("-"), "Output XCF stream [.xcfs or - for stdout], or XCF file when unpacking a stream")
+			("log", bpo::value< std::string >(), "Log file");
+
+	descriptions.add(opt_base).add(opt_input).add(opt_output);
+}
+
+void streamer::parse_command_line(vector < string > & args) {
+	try {
+		bpo::store(bpo::command_line_parser(args).options(descriptions).run(), options);
+		bpo::notify(options);
+	} catch ( const boost::program_options::error& e ) { cerr << "Error parsing command line arguments: " << string(e.what()) << endl; exit(0); }
+
+	if (options.count("help")) { cout << descriptions << endl; exit(0); }
+
+	if (options["output"].as < string > () == "-") vrb.set_silent();
+
+	if (options.count("log") && !vrb.open_log(options["log"].as < string > ()))
+		vrb.error("Impossible to create log file [" + options["log"].as < string > () +"]");
+
+	vrb.title("[XCFtools] Pack XCF files into streams, and back");
+	vrb.bullet("Authors       : Olivier DELANEAU and Simone RUBINACCI");
+	vrb.bullet("Contact       : olivier.delaneau@gmail.com");
+	vrb.bullet("Version       : 0." + string(XCFTLS_VERSION) + " / commit = " + string(__COMMIT_ID__) + " / release = " + string (__COMMIT_DATE__));
+	vrb.bullet("Run date      : " + tac.date());
+}
+
+void streamer::check_options() {
+	if (!options.count("input"))
+		vrb.error("You must specify the XCF file or stream to convert using --input");
+
+	if (options.count("threads") && options["threads"].as < int > () < 1)
+		vrb.error("You must use at least 1 thread");
+
+	finput = options["input"].as < string > ();
+	foutput = options["output"].as < string > ();
+	nthreads = options["threads"].as < int > ();
+}
+
+void streamer::verbose_files() {
+	vrb.title("Files:");
+	vrb.bullet("Input         : [" + string((finput == "-") ? "STDIN" : finput) + "]");
+	vrb.bullet("Output        : [" + string((foutput == "-") ? "STDOUT" : foutput) + "]");
+	if (options.count("log")) vrb.bullet("Output LOG    : [" + options["log"].as < std::string > () + "]");
+}
+
+void streamer::verbose_options() {
+	vrb.title("Parameters: ");
+	vrb.bullet("Threads       : " + stb.str(nthreads) + " threads");
+}
@@ -0,0 +1,148 @@
+/*******************************************************************************
+ * Copyright (C) 2022-2023 Olivier Delaneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#include <transpose/transpose_header.h>
+#include <objects/sparse_genotype.h>
+#include <objects/sparse_multiallelic.h>
+#include <objects/dosage_record.h>
+
+//Set the alleles of all samples at the current record, returns true when they follow the genotype convention
+bool transpose::set_genotypes(xcf_reader & XR, xcf_transposed_writer & XT) {
+	int32_t type = XR.typeRecord(0);
+
+	//Binary records carry the same bit convention; copy the bits over
+	if (type == RECORD_BINARY_GENOTYPE || type == RECORD_BINARY_HAPLOTYPE || type == RECORD_XOR_HAPLOTYPE || type == RECORD_SHARDED_GENOTYPE || type == RECORD_SHARDED_HAPLOTYPE) {
+		XR.readBinaryRecord(0, binary_buffer.bytes);
+		for (int32_t i = 0 ; i < nsamples ; i ++) XT.set(i, binary_buffer.get(2*i+0), binary_buffer.get(2*i+1));
+		return (type == RECORD_BINARY_GENOTYPE || type == RECORD_SHARDED_GENOTYPE);
+	}
+
+	//Sparse genotypes; all samples are major unless listed
+	if (type == RECORD_SPARSE_GENOTYPE || type == RECORD_VBYTE_GENOTYPE) {
+		int32_t n_elements = XR.readSparseRecord(0, sparse_buffer.data());
+		bool major = (XR.getAF() >= 0.5f);
+		std::vector < bool > listed = std::vector < bool > (nsamples, false);
+		for (int32_t r = 0 ; r < n_elements ; r ++) {
+			sparse_genotype rg;
+			rg.set(sparse_buffer[r]);
+			listed[rg.idx] = true;
+			if (rg.mis) XT.set(rg.idx, true, false);
+			else if (rg.het) XT.set(rg.idx, false, true);		//Hets as 01, whatever the allele order of unphased ones
+			else XT.set(rg.idx, rg.al0, rg.al1);
+		}
+		if (major) for (int32_t i = 0 ; i < nsamples ; i ++) if (!listed[i]) XT.set(i, true, true);
+		return true;
+	}
+
+	//Sparse haplotypes; all haplotypes are major unless listed
+	if (type == RECORD_SPARSE_HAPLOTYPE || type == RECORD_VBYTE_HAPLOTYPE) {
+		int32_t n_elements = XR.readSparseRecord(0, sparse_buffer.data());
+		bool major = (XR.getAF() >= 0.5f);
+		binary_buffer.set(major);
+		for (int32_t r = 0 ; r < n_elements ; r ++) binary_buffer.set(sparse_buffer[r], !major);
+		for (int32_t i = 0 ; i < nsamples ; i ++) XT.set(i, binary_buffer.get(2*i+0), binary_buffer.get(2*i+1));
+		return false;
+	}
+
+	//Dosages; only hard calls are transposed
+	if (type == RECORD_DENSE_DOSAGE8 || type == RECORD_DENSE_DOSAGE16 || type == RECORD_SPARSE_DOSAGE) {
+		dosage_input.resize(XR.sizeRecord(0));
+		XR.readRecord(0, dosage_input.data());
+		if (type == RECORD_SPARSE_DOSAGE) dosage_record::decodeSparse(dosage_input.data(), nsamples, dosage_buffer.data());
+		else dosage_record::decodeDense(dosage_input.data(), nsamples, (type == RECORD_DENSE_DOSAGE8) ? 8 : 16, dosage_buffer.data());
+		dosage_record::genotypes(dosage_buffer.data(), nsamples, bcf_buffer.data());
+	}
+
+	//Haploid records; haploid samples are transposed as homozygous
+	else if (type == RECORD_BINARY_HAPLOID || type == RECORD_SPARSE_HAPLOID) XR.readHaploidRecord(0, bcf_buffer.data());
+
+	//Binary haplotypes with missing ones listed aside
+	else if (type == RECORD_MISSING_HAPLOTYPE) {
+		XR.readMissingRecord(0, binary_buffer.bytes, missing_buffer);
+		for (int32_t i = 0 ; i < 2 * nsamples ; i ++) bcf_buffer[i] = bcf_gt_phased(binary_buffer.get(i));
+		for (uint32_t m = 0 ; m < missing_buffer.size() ; m ++) bcf_buffer[missing_buffer[m]] = bcf_gt_missing;
+	}
+
+	//Sparse multiallelic records; any ALT allele is transposed as 1
+	else if (type == RECORD_SPARSE_MULTIALLELIC) {
+		multi_input.resize(XR.sizeRecord(0) / sizeof(int32_t));
+		XR.readRecord(0, reinterpret_cast< char* > (multi_input.data()));
+		sparse_multiallelic::decode(multi_input.data(), nsamples, bcf_buffer.data());
+	}
+
+	//BCF genotypes
+	else if (type == RECORD_BCFVCF_GENOTYPE) XR.readRecord(0, reinterpret_cast< char* > (bcf_buffer.data()));
+
+	//Unknown record type; all samples are set as missing
+	else {
+		vrb.bullet("Unrecognized record type [" + stb.str(type) + "] at " + XR.chr + ":" + stb.str(XR.pos));
+		for (int32_t i = 0 ; i < nsamples ; i ++) XT.set(i, true, false);
+		return true;
+	}
+
+	//Records given in BCF encoding are phased only when all genotypes are phased and called
+	bool genotype = false;
+	for (int32_t i = 0 ; i < nsamples && !genotype ; i ++)
+		genotype = bcf_gt_is_missing(bcf_buffer[2*i+0]) || bcf_gt_is_missing(bcf_buffer[2*i+1]) || !bcf_gt_is_phased(bcf_buffer[2*i+1]);
+	for (int32_t i = 0 ; i < nsamples ; i ++) {
+		if (bcf_buffer[2*i+1] == bcf_int32_vector_end) bcf_buffer[2*i+1] = bcf_buffer[2*i+0];
+		bool a0 = (bcf_gt_allele(bcf_buffer[2*i+0]) > 0), a1 = (bcf_gt_allele(bcf_buffer[2*i+1]) > 0);
+		if (genotype && (bcf_gt_is_missing(bcf_buffer[2*i+0]) || bcf_gt_is_missing(bcf_buffer[2*i+1]))) XT.set(i, true, false);
+		else if (genotype && a0 != a1) XT.set(i, false, true);		//Hets as 01; 10 is missing
+		else XT.set(i, a0, a1);
+	}
+	return genotype;
+}
+
+void transpose::run() {
+	tac.clock();
+	std::string finput = options["input"].as < std::string > ();
+	std::string foutput = options["output"].as < std::string > ();
+	uint32_t block_size = options["block-size"].as < int > ();
+
+	vrb.title("Transposing [" + finput + "] into [" + foutput + "]");
+
+	//Opening XCF reader for input
+	xcf_reader XR(options["threads"].as < int > ());
+	XR.addFile(finput);
+
+	//Opening transposed writer for output; one block holds the data of all samples for block_size variants
+	xcf_transposed_writer XT(foutput, samples, block_size);
+	vrb.bullet("Block memory  : " + stb.str(2UL * nsamples * XT.half_size / (1024.0 * 1024.0), 2) + " Mb");
+
+	//Proceed with transposition
+	uint32_t n_lines = 0;
+	while (XR.nextRecord()) {
+		bool genotype = set_genotypes(XR, XT);
+		XT.next(XR.chr, XR.pos, genotype);
+
+		//Verbose
+		if (++n_lines % 10000 == 0) vrb.bullet("Number of XCF records processed: N = " + stb.str(n_lines));
+	}
+	vrb.bullet("Number of XCF records processed: N = " + stb.str(n_lines));
+	vrb.bullet("Number of blocks written: N = " + stb.str(DIVU(n_lines, block_size)));
+
+	//Close files
+	XR.close();
+	XT.close();
+	vrb.bullet("Timing: " + stb.str(tac.rel_time()*1.0/1000, 2) + "s");
+}
@@ -0,0 +1,70 @@
+/*******************************************************************************
+ * Copyright (C) 2022-2023 Olivier Delaneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#ifndef _TRANSPOSE_H
+#define _TRANSPOSE_H
+
+#include <utils/otools.h>
+#include <utils/xcf.h>
+#include <utils/xcf_transposed.h>
+#include <containers/bitvector.h>
+
+class transpose {
+public:
+	//COMMAND LINE OPTIONS
+	bpo::options_description descriptions;
+	bpo::variables_map options;
+
+	//SAMPLE DATA
+	int32_t nsamples;
+	std::vector < std::string > samples;
+
+	//BUFFERS
+	bitvector binary_buffer;
+	std::vector < int32_t > sparse_buffer;
+	std::vector < int32_t > bcf_buffer;
+	std::vector < int32_t > missing_buffer;
+	std::vector < int32_t > multi_input;
+	std::vector < char > dosage_input;
+	std::vector < float > dosage_buffer;
+
+	//CONSTRUCTOR
+	transpose();
+	~transpose();
+
+	//PARAMETERS
+	void declare_options();
+	void parse_command_line(std::vector < std::string > &);
+	void check_options();
+	void verbose_options();
+	void verbose_files();
+
+	//
+	void transposing(std::vector < std::string > &);
+	void read_files_and_initialise();
+	void run();
+	void write_files_and_finalise();
+	//Helpers
+	bool set_genotypes(xcf_reader & XR, xcf_transposed_writer & XT);
+};
+
+#endif
@@ -0,0 +1,41 @@
+/*******************************************************************************
+ * Copyright (C) 2022-2023 Olivier Delaneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#include <transpose/transpose_header.h>
+
+void transpose::read_files_and_initialise() {
+	//step0: Check input and get sample IDs
+	std::string finput = options["input"].as < std::string > ();
+	vrb.title("Read samples in [" + finput + "]");
+	xcf_reader XR(1);
+	int32_t idx_file = XR.addFile(finput);
+	if (XR.typeFile(idx_file) != FILE_BINARY) vrb.error("[" + finput + "] is not a XCF file");
+	nsamples = XR.getSamples(idx_file, samples);
+	XR.close();
+	vrb.bullet("#samples = " + stb.str(nsamples));
+
+	//step1: Allocate buffers
+	binary_buffer.allocate(2 * nsamples);
+	sparse_buffer.resize(2 * nsamples);
+	bcf_buffer.resize(2 * nsamples);
+	dosage_buffer.resize(nsamples);
+}
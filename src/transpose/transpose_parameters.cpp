@@ -0,0 +1,97 @@
+/*******************************************************************************
+ * Copyright (C) 2022-2023 Olivier Delaneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#include "../../versions/versions.h"
+
+#include <transpose/transpose_header.h>
+
+using namespace std;
+
+void transpose::declare_options() {
+	bpo::options_description opt_base ("Basic options");
+	opt_base.add_options()
+			("help", "Produce help message")
+			("threads,T", bpo::value<int>()->default_value(1), "Number of threads used for VCF/BCF (de-)compression");
+
+	bpo::options_description opt_input ("Input files");
+	opt_input.add_options()
+			("input,i", bpo::value < std::string >(), "Input XCF file to transpose");
+
+	bpo::options_description opt_par ("Parameters");
+	opt_par.add_options()
+			("block-size", bpo::value<int>()->default_value(4096), "Number of variants per block of the transposed store");
+
+	bpo::options_description opt_output ("Output files");
+	opt_output.add_options()
+			("output,o", bpo::value< std::string >(), "Output sample-major store [.tbin]")
+			("log", bpo::value< std::string >(), "Log file");
+
+	descriptions.add(opt_base).add(opt_input).add(opt_par).add(opt_output);
+}
+
+void transpose::parse_command_line(vector < string > & args) {
+	try {
+		bpo::store(bpo::command_line_parser(args).options(descriptions).run(), options);
+		bpo::notify(options);
+	} catch ( const boost::program_options::error& e ) { cerr << "Error parsing command line arguments: " << string(e.what()) << endl; exit(0); }
+
+	if (options.count("help")) { cout << descriptions << endl; exit(0); }
+
+	if (options.count("log") && !vrb.open_log(options["log"].as < string > ()))
+		vrb.error("Impossible to create log file [" + options["log"].as < string > () +"]");
+
+	vrb.title("[XCFtools] Transpose XCF files into sample-major stores");
+	vrb.bullet("Authors       : Olivier DELANEAU and Simone RUBINACCI");
+	vrb.bullet("Contact       : olivier.delaneau@gmail.com");
+	vrb.bullet("Version       : 0." + string(XCFTLS_VERSION) + " / commit = " + string(__COMMIT_ID__) + " / release = " + string (__COMMIT_DATE__));
+	vrb.bullet("Run date      : " + tac.date());
+}
+
+void transpose::check_options() {
+	if (!options.count("input"))
+		vrb.error("You must specify the XCF file to transpose using --input");
+
+	if (!options.count("output"))
+		vrb.error("You must specify an output file with --output");
+
+	if (options["input"].as < std::string > () == "-")
+		vrb.error("The input is read twice; XCF streams can only be transposed from .xcfs files");
+
+	if (options.count("threads") && options["threads"].as < int > () < 1)
+		vrb.error("You must use at least 1 thread");
+
+	if (options["block-size"].as < int > () < 8)
+		vrb.error("The block size must be at least 8 variants");
+}
+
+void transpose::verbose_files() {
+	vrb.title("Files:");
+	vrb.bullet("Input XCF      : [" + options["input"].as < std::string > () + "]");
+	vrb.bullet("Output TBIN    : [" + options["output"].as < std::string > () + "]");
+	if (options.count("log")) vrb.bullet("Output LOG    : [" + options["log"].as < std::string > () + "]");
+}
+
+void transpose::verbose_options() {
+	vrb.title("Parameters: ");
+	vrb.bullet("Block size : " + stb.str(options["block-size"].as < int > ()) + " variants");
+	vrb.bullet("Threads    : " + stb.str(options["threads"].as < int > ()) + " threads");
+}
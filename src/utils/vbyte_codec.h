@@ -0,0 +1 @@
+../../common/src/utils/vbyte_codec.h
\ No newline at end of file
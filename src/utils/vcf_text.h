@@ -0,0 +1 @@
+../../common/src/utils/vcf_text.h
\ No newline at end of file
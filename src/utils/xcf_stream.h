@@ -0,0 +1 @@
+../../common/src/utils/xcf_stream.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../common/src/utils/xcf_transposed.h
\ No newline at end of file
@@ -30,23 +30,56 @@ using namespace std;
 
 void viewer::view()
 {
-	if (isBCF(format) && !input_fmt_bcf) binary2bcf (region, nthreads).convert(finput, foutput);
+	//Input is read and decoded once for all outputs
+	if (!fan_out.empty()) {
+		binary2binary X2X (region, maf, nthreads, fan_out[0].mode, drop_info);
+		X2X.compress_sparse = compress_sparse;
+		X2X.adaptive = adaptive;
+		X2X.align = align;
+		X2X.xor_keyframe = xor_keyframe;
+		X2X.shard_size = shard_size;
+		X2X.convert(finput, fan_out, subsample_isforce);
+		return;
+	}
 
-    int conversion_type = -1;
-    if (format == "bg") conversion_type = CONV_BCF_BG;
-    else if (format == "bh") conversion_type = CONV_BCF_BH;
-    else if (format == "sg") conversion_type = CONV_BCF_SG;
-    else if (format == "sh") conversion_type = CONV_BCF_SH;
-    else vrb.error("Output format [" + format + "] unrecognized");
+	if (isBCF(format) && !input_fmt_bcf) {
+		binary2bcf X2B (region, nthreads);
+		X2B.split_multi = split_multi;
+		if (subsample)
+			X2B.convert(finput, foutput, subsample_exclude, subsample_isforce, samples_to_keep);
+		else
+			X2B.convert(finput, foutput);
+		return;
+	}
+
+    int conversion_type = conversionType(format);
+    if (conversion_type < 0) vrb.error("Output format [" + format + "] unrecognized");
 
     if (input_fmt_bcf)
-    	bcf2binary(region, maf, nthreads, conversion_type, drop_info).convert(finput, foutput);
+    {
+    	bcf2binary B2X (region, maf, nthreads, conversion_type, drop_info);
+    	B2X.compress_sparse = compress_sparse;
+    	B2X.adaptive = adaptive;
+    	B2X.align = align;
+    	B2X.xor_keyframe = xor_keyframe;
+    	B2X.shard_size = shard_size;
+    	B2X.dosage_bits = dosage_bits;
+    	B2X.dosage_eps = dosage_eps;
+    	B2X.convert(finput, foutput);
+    }
+    else if (conversion_type == CONV_BCF_BD || conversion_type == CONV_BCF_SD)
+    	vrb.error("Dosage formats [bd/sd] can only be produced from BCF files with FORMAT/DS or FORMAT/GP");
     else
     {
+    	binary2binary X2X (region, maf, nthreads, conversion_type, drop_info);
+    	X2X.compress_sparse = compress_sparse;
+    	X2X.adaptive = adaptive;
+    	X2X.align = align;
+    	X2X.xor_keyframe = xor_keyframe;
+    	X2X.shard_size = shard_size;
     	if (subsample)
-    		binary2binary(region, maf, nthreads, conversion_type, drop_info).convert(finput, foutput, subsample_exclude, subsample_isforce, samples_to_keep);
+    		X2X.convert(finput, foutput, subsample_exclude, subsample_isforce, samples_to_keep);
     	else
-    		binary2binary(region, maf, nthreads, conversion_type, drop_info).convert(finput, foutput);
-
+    		X2X.convert(finput, foutput);
     }
 }
@@ -24,6 +24,8 @@
 #define _CONVERTER_H
 
 #include <utils/otools.h>
+#include <utils/xcf_stream.h>
+#include <modes/binary2binary.h>
 
 class viewer {
 public:
@@ -43,16 +45,26 @@ public:
 	bool input_fmt_bcf;
 	bool drop_info;
 	float maf;
+	bool compress_sparse;
+	bool adaptive;
+	bool split_multi;
+	bool align;
+	uint32_t xor_keyframe;
+	uint32_t shard_size;
+	uint32_t dosage_bits;
+	float dosage_eps;
 	bool subsample;
 	bool subsample_exclude;
 	bool subsample_isforce;
 	std::vector<std::string> samples_to_keep;
+	std::vector<binary2binary_output> fan_out;
 
 	uint32_t nthreads;
 
 
 	bool isBCF(std::string);
 	bool isXCF(std::string);
+	int conversionType(std::string);
 
 	//METHODS
 	void view();
@@ -122,6 +134,41 @@ public:
 		}
 	}
 
+	//One output per line: <output> <format> [<maf> [<samples file>]]
+	void read_fan_out(const std::string fout)
+	{
+		std::string line;
+		std::vector < std::string > tokens;
+		input_file file(fout);
+		while (std::getline(file, line))
+		{
+			if (stb.split(line, tokens) == 0) continue;
+			if (tokens.size() > 4) vrb.error("Too many columns in fan-out file for output [" + tokens[0] + "]");
+
+			binary2binary_output O;
+			O.fname = tokens[0];
+			O.mode = (tokens.size() > 1) ? conversionType(tokens[1]) : -1;
+			if (O.mode < 0 || O.mode == CONV_BCF_BD || O.mode == CONV_BCF_SD) vrb.error("Fan-out output [" + O.fname + "] needs a bg, bh, sg or sh format");
+			if (O.fname == "-") vrb.error("Fan-out outputs cannot be written to stdout");
+			O.minmaf = (tokens.size() > 2 && tokens[2] != "-") ? std::stof(tokens[2]) : maf;
+			O.exclude = false;
+			if (tokens.size() > 3)
+			{
+				std::string smp = tokens[3];
+				O.exclude = (smp[0] == '^');
+				if (O.exclude) smp = smp.substr(1);
+				input_file fsmp(smp);
+				while (std::getline(fsmp, line)) if (!line.empty()) O.samples.push_back(line);
+				fsmp.close();
+				if (O.samples.empty()) vrb.error("No sample listed in [" + smp + "]");
+			}
+			fan_out.push_back(O);
+		}
+		file.close();
+
+		if (fan_out.empty()) vrb.error("No output listed in fan-out file [" + fout + "]");
+	}
+
 };
 
 #endif
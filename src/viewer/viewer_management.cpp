@@ -24,7 +24,7 @@
 
 using namespace std;
 
-viewer::viewer() : input_fmt_bcf(true), drop_info(true), maf(1.0f/32), subsample(false), subsample_exclude(false), subsample_isforce(false), nthreads(1) {
+viewer::viewer() : input_fmt_bcf(true), drop_info(true), maf(1.0f/32), compress_sparse(false), adaptive(false), split_multi(false), align(false), xor_keyframe(0), shard_size(0), dosage_bits(16), dosage_eps(1e-3f), subsample(false), subsample_exclude(false), subsample_isforce(false), nthreads(1) {
 }
 
 viewer::~viewer() {
@@ -46,5 +46,15 @@ bool viewer::isBCF(std::string format) {
 }
 
 bool viewer::isXCF(std::string format) {
-	return (format == "bh" || format == "bg" ||format == "sh" ||format == "sg");
+	return (format == "bh" || format == "bg" ||format == "sh" ||format == "sg" || format == "bd" || format == "sd");
+}
+
+int viewer::conversionType(std::string format) {
+	if (format == "bg") return CONV_BCF_BG;
+	if (format == "bh") return CONV_BCF_BH;
+	if (format == "sg") return CONV_BCF_SG;
+	if (format == "sh") return CONV_BCF_SH;
+	if (format == "bd") return CONV_BCF_BD;
+	if (format == "sd") return CONV_BCF_SD;
+	return -1;
 }
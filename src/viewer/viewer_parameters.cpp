@@ -31,23 +31,33 @@ void viewer::declare_options() {
 	opt_base.add_options()
 			("help", "Produce help message")
 			("seed", bpo::value<int>()->default_value(15052011), "Seed of the random number generator")
-			("threads,T", bpo::value<int>()->default_value(1), "Number of threads used for VCF/BCF (de-)compression");
+			("threads,T", bpo::value<int>()->default_value(1), "Number of threads used for VCF/BCF (de-)compression, and for encoding records in BCF/XCF conversions");
 
 	bpo::options_description opt_input ("Input files");
 	opt_input.add_options()
-			("input,i", bpo::value< string >(), "Input genotype data in plain VCF/BCF format")
-			("region,r", bpo::value< string >(), "Region to be considered in --input")
+			("input,i", bpo::value< string >(), "Input genotype data in plain VCF/BCF format, or in XCF format [XCF streams on stdin or in .xcfs files]")
+			("region,r", bpo::value< string >(), "Region to be considered in --input [comma separated list of regions allowed]")
+			("regions-file,R", bpo::value< string >(), "File of regions to be considered in --input [BED, or CHR POS / CHR BEG END; overlapping regions are merged]")
 			("maf,m", bpo::value< float >()->default_value(0.001), "Threshold to distinguish rare variants from common ones")
-			("samples,s", bpo::value< string >(), "XCF2XCF only: comma separated list of samples to include (or exclude with \"^\" prefix)")
-			("samples-file,S", bpo::value< string >(), "XCF2XCF only: File of samples to include (or exclude with \"^\" prefix)")
+			("adaptive", "Ignore --maf and pick the smallest of the binary/sparse encodings for each variant [sg/sh only]")
+			("samples,s", bpo::value< string >(), "XCF input only: comma separated list of samples to include (or exclude with \"^\" prefix)")
+			("samples-file,S", bpo::value< string >(), "XCF input only: File of samples to include (or exclude with \"^\" prefix)")
 			("force-samples", "Only warn about unknown subset samples")
 			;
 
 	bpo::options_description opt_output ("Output files");
 	opt_output.add_options()
-			("output,o", bpo::value< string >()->default_value("-"), "Output file [- for stdout]")
-			("format,O", bpo::value< string >()->default_value("bcf"), "Output file format")
+			("output,o", bpo::value< string >()->default_value("-"), "Output file [- for stdout; XCF files go as a single stream on stdout or in .xcfs files]")
+			("format,O", bpo::value< string >()->default_value("bcf"), "Output file format [bd/sd: ALT dosages of biallelic records, from FORMAT/DS or FORMAT/GP; written back as FORMAT/DS only, multiallelic records are dropped]")
+			("fan-out", bpo::value< string >(), "XCF2XCF only: file listing several outputs written in a single pass over --input, one per line: <output> <format> [<maf> [<samples file>]] [- as maf for --maf; ^ before the samples file to exclude]")
 			("keep-info","Keep INFO field instead of creating a minimal BCF file")
+			("compress-sparse","Delta + stream-vbyte coding of sparse records [sg/sh only]")
+			("align","Pad records of the .bin file to 64 bytes boundaries for aligned loads")
+			("xor-keyframe", bpo::value< int >()->default_value(0), "XOR code dense haplotype records against the previous one, with a full record every N records [bh/sh only; 0 to disable]")
+			("shard-size", bpo::value< int >()->default_value(0), "Store dense records in one .bin file per group of N samples, so that subsets only read the groups they touch [multiple of 4; 0 to disable]")
+			("split-multiallelics","XCF2BCF only: split multiallelic records into biallelic ones")
+			("dosage-bits", bpo::value< int >()->default_value(16), "Quantisation of dense dosages [8 or 16 bits; bd only]")
+			("dosage-eps", bpo::value< float >()->default_value(1e-3), "Dosages below this value are stored as 0 [sd only]")
 			("log", bpo::value< string >(), "Output log file");
 
 	descriptions.add(opt_base).add(opt_input).add(opt_output);
@@ -63,8 +73,7 @@ void viewer::parse_command_line(vector < string > & args) {
 
 	string format = options["format"].as < string > ();
 	string output = options["output"].as < string > ();
-	if (!isBCF(format) && output == "-") vrb.error("Only BCF format [bcf] is supported on stdout");
-	if (output == "-") vrb.set_silent();
+	if (output == "-" && !options.count("fan-out")) vrb.set_silent();
 
 	if (options.count("log") && !vrb.open_log(options["log"].as < string > ()))
 		vrb.error("Impossible to create log file [" + options["log"].as < string > () +"]");
@@ -78,18 +87,21 @@ void viewer::parse_command_line(vector < string > & args) {
 
 void viewer::check_options() {
 	if (!options.count("input")) vrb.error("--input needs to be specified");
-	if (!options.count("region"))
+	if (options.count("region") && options.count("regions-file"))
+		vrb.error("Options --region and --regions-file cannot be both specified");
+	if (!options.count("region") && !options.count("regions-file"))
 		vrb.warning("--region parameter not specified. XCFTOOLS will attempt to read without requiring a specific index/region. Please note that this is experimental and multi-chromosome files can give rise to unexpected behaviors. Please make sure your file has only one chromosome.");
 	if (!options.count("format")) vrb.error("--format needs to be specified");
 
 	string formatS = options["format"].as < string > ();
 	string input = options["input"].as < string > ();
 	string output = options["output"].as < string > ();
-	if (isBCF(formatS) && input == "-") vrb.error("Only BCF format [bcf] is supported on stdin");
-	if (!isBCF(formatS) && output == "-") vrb.error("Only BCF format [bcf] is supported on stdout");
 
-	if (input!="-") input_fmt_bcf = !isBinaryFile(input);
-	else input_fmt_bcf=true;
+	//XCF files go through pipes as streams [see xcf_stream.h]
+	if (input!="-") input_fmt_bcf = !helper_tools::isStreamName(input) && !isBinaryFile(input);
+	else input_fmt_bcf = !xcf_stream_input::isStream(input);
+	if (isBCF(formatS) && input_fmt_bcf && input == "-") vrb.error("Only XCF streams are supported on stdin for BCF output");
+	if (!isBCF(formatS) && (output == "-" || helper_tools::isStreamName(output)) && options["shard-size"].as < int > ()) vrb.error("Sharded XCF files cannot be streamed");
 
 	if (options.count("seed") && options["seed"].as < int > () < 0)
 		vrb.error("Random number generator needs a positive seed value");
@@ -97,7 +109,16 @@ void viewer::check_options() {
 	if (options.count("threads") && options["threads"].as < int > () < 1)
 		vrb.error("You must use at least 1 thread");
 
-	if (!input_fmt_bcf && !isBCF(formatS))
+	if (options["dosage-bits"].as < int > () != 8 && options["dosage-bits"].as < int > () != 16)
+		vrb.error("Dosages can only be quantised on 8 or 16 bits");
+
+	if (options["xor-keyframe"].as < int > () < 0)
+		vrb.error("The XOR keyframe interval must be positive [0 to disable]");
+
+	if (options["shard-size"].as < int > () < 0 || options["shard-size"].as < int > () % 4)
+		vrb.error("The shard size must be a positive multiple of 4 [0 to disable]");
+
+	if (!input_fmt_bcf)
 	{
 		if (options.count("samples") || options.count("samples-file"))
 		{
@@ -115,12 +136,30 @@ void viewer::check_options() {
 		}
 	}
 	region = (options.count("region")) ? options["region"].as < string > () : "";
+	if (options.count("regions-file")) region = helper_tools::readRegions(options["regions-file"].as < string > ());
 	format = options["format"].as < string > ();
 	finput = options["input"].as < string > ();
 	foutput = options["output"].as < string > ();
 	nthreads = options["threads"].as < int > ();
 	drop_info = !options.count("keep-info");
 	maf = options["maf"].as < float > ();
+	compress_sparse = options.count("compress-sparse");
+	adaptive = options.count("adaptive");
+	split_multi = options.count("split-multiallelics");
+	align = options.count("align");
+	xor_keyframe = options["xor-keyframe"].as < int > ();
+	shard_size = options["shard-size"].as < int > ();
+	dosage_bits = options["dosage-bits"].as < int > ();
+	dosage_eps = options["dosage-eps"].as < float > ();
+
+	//Several outputs from a single pass over the input
+	if (options.count("fan-out"))
+	{
+		if (input_fmt_bcf) vrb.error("--fan-out needs a XCF file as input");
+		if (options.count("samples") || options.count("samples-file")) vrb.error("Options --fan-out and --samples/--samples-file cannot be both specified; samples are listed per output in the fan-out file");
+		subsample_isforce = options.count("force-samples");
+		read_fan_out(options["fan-out"].as < string > ());
+	}
 }
 
 void viewer::verbose_files() {
@@ -134,13 +173,20 @@ void viewer::verbose_files() {
 		else
 			vrb.bullet("Input BCF     : [" + finput + "]");
 	}
+	else if (finput == "-")
+		vrb.bullet("Input XCF     : [STDIN] / stream");
 	else
 		vrb.bullet("Input XCF     : [" + finput + "]");
 
 	//output
-	if (isXCF(format))
+	if (!fan_out.empty())
+	{
+		for (uint32_t o = 0 ; o < fan_out.size() ; o ++) vrb.bullet("Output XCF    : [" + fan_out[o].fname + "]");
+	}
+	else if (isXCF(format))
 	{
-		vrb.bullet("Output XCF    : [" + foutput + "]");
+		if (foutput == "-") vrb.bullet("Output XCF    : [STDOUT] / stream");
+		else vrb.bullet("Output XCF    : [" + foutput + "]");
 	} else if (isBCF(format))
 	{
 		if (foutput == "-") vrb.bullet("Output BCF   : [STDOUT] / uncompressed");
@@ -155,9 +201,17 @@ void viewer::verbose_options() {
 	vrb.title("Parameters:");
 	std::array<std::string,2> yes_no = {"YES","NO"};
 	vrb.bullet("Keep INFO     : [" + yes_no[!drop_info] + "]");
+	vrb.bullet("Compress rare : [" + yes_no[!compress_sparse] + "]");
+	vrb.bullet("Align records : [" + yes_no[!align] + "]");
+	if (xor_keyframe) vrb.bullet("XOR keyframes : [every " + stb.str(xor_keyframe) + " records]");
+	if (shard_size) vrb.bullet("Shard size    : [" + stb.str(shard_size) + " samples]");
+	if (isBCF(format)) vrb.bullet("Split multi   : [" + yes_no[!split_multi] + "]");
 	vrb.bullet("Seed          : [" + stb.str(options["seed"].as < int > ()) + "]");
 	vrb.bullet("Threads       : [" + stb.str(nthreads) + " threads]");
 
 	string format = options["format"].as < string > ();
-	if (format[0] == 's') vrb.bullet("MAF     : " + stb.str(maf));
+	if ((format == "sg" || format == "sh") && adaptive) vrb.bullet("Encoding      : [Smallest per variant]");
+	else if (format == "sg" || format == "sh") vrb.bullet("MAF     : " + stb.str(maf));
+	if (format == "bd") vrb.bullet("Dosage bits   : [" + stb.str(dosage_bits) + "]");
+	if (format == "sd") vrb.bullet("Dosage eps    : [" + stb.str(dosage_eps) + "]");
 }